@@ -239,8 +239,7 @@ void fmc_setLedBrightness(void* fmcHandle, int ledId, uint8_t brightness) {
 bool fmc_writeData(void* fmcHandle, const uint8_t* data, int length) {
     if (!fmcHandle || !data || length <= 0) return false;
     auto fmc = static_cast<ProductFMC*>(fmcHandle);
-    std::vector<uint8_t> dataVector(data, data + length);
-    return fmc->writeData(dataVector);
+    return fmc->writeData(std::span<const uint8_t>(data, length));
 }
 
 void fmc_setFont(void* fmcHandle, int fontType) {
@@ -277,8 +276,7 @@ void fmc_setFont(void* fmcHandle, int fontType) {
             break;
     }
     
-    auto glyphData = Font::GlyphData(variant, fmc->identifierByte);
-    fmc->setFont(glyphData);
+    fmc->setFont(variant);
 }
 
 void fmc_setFontUpdatingEnabled(void* fmcHandle, bool enabled) {
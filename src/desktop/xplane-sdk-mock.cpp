@@ -3,13 +3,16 @@
 #include <XPLMProcessing.h>
 #include <XPLMUtilities.h>
 #include <XPLMDisplay.h>
+#include <XPLMGraphics.h>
 #include <XPLMDataAccess.h>
 #include <XPLMMenus.h>
+#include <XPLMPlanes.h>
 #include "dataref.h"
 #include <vector>
 #include <string>
 #include <unordered_map>
 #include <variant>
+#include <chrono>
 #include <cstring>
 #include <ctime>
 
@@ -529,6 +532,25 @@ void XPLMUnregisterFlightLoopCallback(XPLMFlightLoop_f inFlightLoop, void *inRef
     
 }
 
+XPLMFlightLoopID XPLMCreateFlightLoop(XPLMCreateFlightLoop_t *inParams) {
+    // Flight loops never run in the mock, the ID only has to be non-null
+    static int flightLoopCount = 0;
+    return reinterpret_cast<XPLMFlightLoopID>(static_cast<intptr_t>(++flightLoopCount));
+}
+
+void XPLMDestroyFlightLoop(XPLMFlightLoopID inFlightLoopID) {
+    // noop
+}
+
+void XPLMScheduleFlightLoop(XPLMFlightLoopID inFlightLoopID, float inInterval, int inRelativeToNow) {
+    // noop
+}
+
+float XPLMGetElapsedTime() {
+    static const auto startedAt = std::chrono::steady_clock::now();
+    return std::chrono::duration<float>(std::chrono::steady_clock::now() - startedAt).count();
+}
+
 int XPLMGetCycleNumber() {
     return static_cast<int>(std::time(nullptr));
 }
@@ -545,6 +567,51 @@ void XPLMCheckMenuItem(XPLMMenuID inMenu, int index, XPLMMenuCheck inCheck) {
     // noop
 }
 
+void XPLMGetNthAircraftModel(int inIndex, char *outFileName, char *outPath) {
+    outFileName[0] = 0;
+    outPath[0] = 0;
+}
+
 void XPLMGetSystemPath(char *outSystemPath) {
     // noop
 }
+
+XPLMWindowID XPLMCreateWindowEx(XPLMCreateWindow_t *inParams) {
+    // Windows never draw in the mock, the ID only has to be non-null
+    static int windowCount = 0;
+    return reinterpret_cast<XPLMWindowID>(static_cast<intptr_t>(++windowCount));
+}
+
+void XPLMDestroyWindow(XPLMWindowID inWindowID) {
+    // noop
+}
+
+void XPLMGetScreenBoundsGlobal(int *outLeft, int *outTop, int *outRight, int *outBottom) {
+    *outLeft = 0;
+    *outTop = 1080;
+    *outRight = 1920;
+    *outBottom = 0;
+}
+
+void XPLMGetWindowGeometry(XPLMWindowID inWindowID, int *outLeft, int *outTop, int *outRight, int *outBottom) {
+    *outLeft = 0;
+    *outTop = 0;
+    *outRight = 0;
+    *outBottom = 0;
+}
+
+int XPLMGetWindowIsVisible(XPLMWindowID inWindowID) {
+    return 0;
+}
+
+void XPLMSetWindowIsVisible(XPLMWindowID inWindowID, int inIsVisible) {
+    // noop
+}
+
+void XPLMSetWindowTitle(XPLMWindowID inWindowID, const char *inWindowTitle) {
+    // noop
+}
+
+void XPLMDrawString(float *inColorRGB, int inXOffset, int inYOffset, char *inChar, int *inWordWrapWidth, XPLMFontID inFontID) {
+    // noop
+}
@@ -2,10 +2,17 @@
 
 #include "config.h"
 #include "dataref.h"
+#include "frame-arena.h"
+#include "io-stats.h"
+#include "logger.h"
+#include "memory-stats.h"
+#include "startup-profiler.h"
 #include "usbcontroller.h"
 #include "usbdevice.h"
 
+#include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <XPLMProcessing.h>
 
 AppState *AppState::instance = nullptr;
@@ -13,6 +20,10 @@ AppState *AppState::instance = nullptr;
 AppState::AppState() {
     pluginInitialized = false;
     debuggingEnabled = false;
+    dormant = false;
+    aircraftLoaded = true;
+    dormantDeviceCount = 0;
+    dormantCandidateSince = {};
 }
 
 AppState::~AppState() {
@@ -33,6 +44,8 @@ bool AppState::initialize() {
     }
 
     XPLMRegisterFlightLoopCallback(AppState::Update, REFRESH_INTERVAL_SECONDS_FAST, nullptr);
+    MemoryStats::getInstance()->registerDatarefs();
+    IOStats::getInstance()->registerDatarefs();
 
     pluginInitialized = true;
 
@@ -49,9 +62,13 @@ void AppState::deinitialize() {
     USBController::getInstance()->destroy();
 
     Dataref::getInstance()->destroyAllBindings();
+    IOStats::getInstance()->destroy();
 
     pluginInitialized = false;
+    dormant = false;
     instance = nullptr;
+
+    std::lock_guard<std::mutex> lock(taskQueueMutex);
     taskQueue.clear();
 }
 
@@ -68,22 +85,46 @@ float AppState::Update(float inElapsedSinceLastCall, float inElapsedTimeSinceLas
 }
 
 void AppState::update() {
+    Logger::getInstance()->drain();
+    FrameArena::forCurrentThread()->reset();
+
+    // Tasks may schedule further tasks (device enumeration does), so the due ones are moved
+    // out before running them instead of iterating the queue while it grows.
     auto now = std::chrono::steady_clock::now();
-    for (auto &task : taskQueue) {
-        if (now >= task.runAt && task.func) {
+    std::vector<DelayedTask> dueTasks;
+    bool hasQueuedTasks;
+    {
+        std::lock_guard<std::mutex> lock(taskQueueMutex);
+        auto firstDueTask = std::stable_partition(taskQueue.begin(), taskQueue.end(), [&](auto &task) {
+            return now < task.runAt;
+        });
+        dueTasks.assign(std::make_move_iterator(firstDueTask), std::make_move_iterator(taskQueue.end()));
+        taskQueue.erase(firstDueTask, taskQueue.end());
+        hasQueuedTasks = !taskQueue.empty();
+    }
+
+    for (auto &task : dueTasks) {
+        if (task.func) {
             task.func();
         }
     }
 
-    taskQueue.erase(std::remove_if(taskQueue.begin(), taskQueue.end(), [&](auto &task) {
-                        return now >= task.runAt;
-                    }),
-                    taskQueue.end());
-
     if (!pluginInitialized) {
         return;
     }
 
+    if (!hasQueuedTasks && USBController::getInstance()->allProfilesReady()) {
+        StartupProfiler::getInstance()->finish("all device profiles ready");
+    }
+
+    // Also while dormant, a stalled device is reconnected before anything is drawn on it again
+    USBController::getInstance()->checkDeviceHealth();
+
+    if (updateDormantState()) {
+        return;
+    }
+
+    MemoryStats::getInstance()->update();
     Dataref::getInstance()->update();
 
     for (auto *device : USBController::getInstance()->devices) {
@@ -91,13 +132,109 @@ void AppState::update() {
     }
 }
 
+bool AppState::isDormant() {
+    return dormant;
+}
+
+void AppState::wake() {
+    dormantCandidateSince = {};
+    if (dormant) {
+        exitDormantMode();
+    }
+}
+
+void AppState::setAircraftLoaded(bool loaded) {
+    aircraftLoaded = loaded;
+}
+
+bool AppState::updateDormantState() {
+    if (dormant) {
+        size_t deviceCount = USBController::getInstance()->devices.size();
+        if (shouldBeDormant() && deviceCount == dormantDeviceCount && !hasPendingHardwareInput()) {
+            return true;
+        }
+
+        exitDormantMode();
+        return false;
+    }
+
+    if (!shouldBeDormant()) {
+        dormantCandidateSince = {};
+        return false;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (dormantCandidateSince == std::chrono::steady_clock::time_point{}) {
+        dormantCandidateSince = now;
+        return false;
+    }
+
+    if (now - dormantCandidateSince < std::chrono::seconds(DORMANT_ENTRY_DELAY_SECONDS)) {
+        return false;
+    }
+
+    enterDormantMode();
+    return true;
+}
+
+bool AppState::shouldBeDormant() {
+    auto &devices = USBController::getInstance()->devices;
+    for (auto *device : devices) {
+        if (!device->allowsDormantMode()) {
+            return false;
+        }
+    }
+
+    if (devices.empty() || !aircraftLoaded) {
+        return true;
+    }
+
+    // Watch set, read directly rather than through the dataref cache since the cache is
+    // not refreshed while dormant.
+    auto datarefManager = Dataref::getInstance();
+    return datarefManager->get<int>("sim/time/paused") || !datarefManager->get<int>("sim/cockpit/electrical/avionics_on");
+}
+
+bool AppState::hasPendingHardwareInput() {
+    for (auto *device : USBController::getInstance()->devices) {
+        if (device->hasPendingInput()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AppState::enterDormantMode() {
+    debug("Entering dormant mode\n");
+    dormant = true;
+
+    auto &devices = USBController::getInstance()->devices;
+    dormantDeviceCount = devices.size();
+    for (auto *device : devices) {
+        device->didEnterDormantMode();
+    }
+}
+
+void AppState::exitDormantMode() {
+    debug("Leaving dormant mode\n");
+    dormant = false;
+    dormantCandidateSince = {};
+
+    for (auto *device : USBController::getInstance()->devices) {
+        device->didExitDormantMode();
+    }
+}
+
 void AppState::executeAfter(int milliseconds, std::function<void()> func) {
+    std::lock_guard<std::mutex> lock(taskQueueMutex);
     taskQueue.push_back({"",
                          std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds),
                          func});
 }
 
 void AppState::executeAfterDebounced(std::string taskName, int milliseconds, std::function<void()> func) {
+    std::lock_guard<std::mutex> lock(taskQueueMutex);
     auto now = std::chrono::steady_clock::now();
     auto it = std::find_if(taskQueue.begin(), taskQueue.end(), [&](const DelayedTask &t) {
         return t.name == taskName;
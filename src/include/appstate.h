@@ -1,8 +1,10 @@
 #ifndef APPSTATE_H
 #define APPSTATE_H
 
+#include <atomic>
 #include <chrono>
 #include <functional>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -18,19 +20,38 @@ class AppState {
         ~AppState();
 
         static AppState *instance;
+        std::mutex taskQueueMutex; // Tasks are also scheduled from the HID reactor thread
         std::vector<DelayedTask> taskQueue;
         void update();
 
+        // Dormant mode: while the sim is paused, the avionics are off, no user aircraft is
+        // loaded (menus, loading a flight) or no device is connected, only a small watch set
+        // is polled and devices are not updated.
+        bool dormant;
+        bool aircraftLoaded;
+        size_t dormantDeviceCount;
+        std::chrono::steady_clock::time_point dormantCandidateSince;
+        bool updateDormantState();
+        bool shouldBeDormant();
+        bool hasPendingHardwareInput();
+        void enterDormantMode();
+        void exitDormantMode();
+
     public:
         static float Update(float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop, int inCounter, void *inRefcon);
 
         bool pluginInitialized;
-        bool debuggingEnabled;
+        std::atomic<bool> debuggingEnabled;
 
         static AppState *getInstance();
         bool initialize();
         void deinitialize();
 
+        bool isDormant();
+        void wake();
+        // PLANE_LOADED and PLANE_UNLOADED of the user's aircraft, part of the dormant watch set
+        void setAircraftLoaded(bool loaded);
+
         void executeAfter(int milliseconds, std::function<void()> func);
         void executeAfterDebounced(std::string taskName, int milliseconds, std::function<void()> func);
 };
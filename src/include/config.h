@@ -2,39 +2,43 @@
 #include <windows.h>
 #endif
 
+#include "logger.h"
+
+// Messages are formatted into the lock-free log ring and written out by the main thread
+// once per frame, so these are safe to use from any thread. When debug logging is off,
+// debug() returns before any formatting happens.
 #if DEBUG
-#define debug(format, ...)                                                    \
-    {                                                                         \
-        char buffer[1024];                                                    \
-        snprintf(buffer, sizeof(buffer), "[Winwing] " format, ##__VA_ARGS__); \
-        if (AppState::getInstance()->debuggingEnabled) {                      \
-            XPLMDebugString(buffer);                                          \
-        }                                                                     \
-        printf("%s", buffer);                                                 \
-    }
-#define debug_force(format, ...)                                              \
-    {                                                                         \
-        char buffer[1024];                                                    \
-        snprintf(buffer, sizeof(buffer), "[Winwing] " format, ##__VA_ARGS__); \
-        XPLMDebugString(buffer);                                              \
-        printf("%s", buffer);                                                 \
+#define debug(format, ...)                                                                                         \
+    {                                                                                                              \
+        Logger::getInstance()->log(AppState::getInstance()->debuggingEnabled, "[Winwing] " format, ##__VA_ARGS__); \
     }
 #else
-#define debug(format, ...)                                                    \
-    {                                                                         \
-        char buffer[1024];                                                    \
-        snprintf(buffer, sizeof(buffer), "[Winwing] " format, ##__VA_ARGS__); \
-        if (AppState::getInstance()->debuggingEnabled) {                      \
-            XPLMDebugString(buffer);                                          \
-        }                                                                     \
+#define debug(format, ...)                                                        \
+    {                                                                             \
+        if (AppState::getInstance()->debuggingEnabled) {                          \
+            Logger::getInstance()->log(true, "[Winwing] " format, ##__VA_ARGS__); \
+        }                                                                         \
     }
+#endif
+
 #define debug_force(format, ...)                                              \
     {                                                                         \
-        char buffer[1024];                                                    \
-        snprintf(buffer, sizeof(buffer), "[Winwing] " format, ##__VA_ARGS__); \
-        XPLMDebugString(buffer);                                              \
+        Logger::getInstance()->log(true, "[Winwing] " format, ##__VA_ARGS__); \
+    }
+
+// Like debug, but logs at most once per intervalMilliseconds per call site and reports how
+// many messages were swallowed in between. Meant for paths that run per report or per frame.
+#define debug_throttled(intervalMilliseconds, format, ...)                                                         \
+    {                                                                                                              \
+        static LogThrottle throttle;                                                                               \
+        uint32_t suppressedCount = 0;                                                                              \
+        if (AppState::getInstance()->debuggingEnabled && throttle.allow(intervalMilliseconds, suppressedCount)) {  \
+            Logger::getInstance()->log(true, "[Winwing] " format, ##__VA_ARGS__);                                  \
+            if (suppressedCount > 0) {                                                                             \
+                Logger::getInstance()->log(true, "[Winwing] (%u similar messages suppressed)\n", suppressedCount); \
+            }                                                                                                      \
+        }                                                                                                          \
     }
-#endif
 
 #define PRODUCT_NAME "winwing"
 #define FRIENDLY_NAME "Winwing"
@@ -46,5 +50,12 @@
 #define REFRESH_INTERVAL_SECONDS_SLOW 5.0
 #define REFRESH_INTERVAL_SECONDS_FAST -1
 #define DISPLAY_UPDATE_FRAME_INTERVAL 2
+#define DORMANT_ENTRY_DELAY_SECONDS 5
+#define MEMORY_STATS_INTERVAL_SECONDS 5
+#define IO_STATS_SAMPLE_INTERVAL_SECONDS 1
+#define OUTPUT_STALL_TIMEOUT_SECONDS 5
+#define OUTPUT_WRITE_WAIT_MILLISECONDS 250
+#define OUTPUT_FLUSH_MILLISECONDS 50
+#define HOTPLUG_BATCH_MILLISECONDS 200
 
 #define WINWING_VENDOR_ID 0x4098
@@ -3,10 +3,12 @@
 #include "appstate.h"
 #include "config.h"
 #include "dataref.h"
+#include "frame-arena.h"
 #include "profiles/laminar-fcu-efis-profile.h"
 #include "profiles/toliss-fcu-efis-profile.h"
 
 #include <algorithm>
+#include <array>
 #include <cstring>
 #include <iomanip>
 #include <sstream>
@@ -30,8 +32,8 @@ std::string fixStringLength(const std::string &value, int length) {
     return result;
 }
 
-std::vector<uint8_t> encodeString(int numSegments, const std::string &str) {
-    std::vector<uint8_t> data(numSegments, 0);
+FrameVector<uint8_t> encodeString(int numSegments, const std::string &str) {
+    FrameVector<uint8_t> data(numSegments, 0);
 
     for (int i = 0; i < std::min(numSegments, static_cast<int>(str.length())); i++) {
         char c = std::toupper(str[i]);
@@ -44,8 +46,8 @@ std::vector<uint8_t> encodeString(int numSegments, const std::string &str) {
     return data;
 }
 
-std::vector<uint8_t> encodeStringSwapped(int numSegments, const std::string &str) {
-    std::vector<uint8_t> data = encodeString(numSegments, str);
+FrameVector<uint8_t> encodeStringSwapped(int numSegments, const std::string &str) {
+    FrameVector<uint8_t> data = encodeString(numSegments, str);
     data.push_back(0); // Add extra byte
 
     // Fix weird segment mapping
@@ -61,9 +63,9 @@ std::vector<uint8_t> encodeStringSwapped(int numSegments, const std::string &str
     return data;
 }
 
-std::vector<uint8_t> encodeStringEfis(int numSegments, const std::string &str) {
-    std::vector<uint8_t> data = encodeString(numSegments, str);
-    std::vector<uint8_t> result(numSegments, 0);
+FrameVector<uint8_t> encodeStringEfis(int numSegments, const std::string &str) {
+    FrameVector<uint8_t> data = encodeString(numSegments, str);
+    FrameVector<uint8_t> result(numSegments, 0);
 
     // Fix weird segment mapping for EFIS displays
     for (int i = 0; i < data.size(); i++) {
@@ -86,6 +88,7 @@ ProductFCUEfis::ProductFCUEfis(HIDDeviceHandle hidDevice, uint16_t vendorId, uin
     displayData = {};
     lastUpdateCycle = 0;
     pressedButtonIndices = {};
+    setInputLayout({.reportId = 1, .minimumLength = 13, .buttonOffset = 1, .buttonBytes = 12});
 
     connect();
 }
@@ -126,10 +129,6 @@ bool ProductFCUEfis::connect() {
         setLedBrightness(FCUEfisLed::EXPED_GREEN, 0);
         setLedBrightness(FCUEfisLed::EXPED_BACKLIGHT, 255);
 
-        if (!profile) {
-            setProfileForCurrentAircraft();
-        }
-
         return true;
     }
 
@@ -204,6 +203,36 @@ void ProductFCUEfis::update() {
     }
 }
 
+bool ProductFCUEfis::allowsDormantMode() {
+    return true;
+}
+
+void ProductFCUEfis::didEnterDormantMode() {
+    clearDisplays();
+}
+
+void ProductFCUEfis::didExitDormantMode() {
+    lastUpdateCycle = 0;
+}
+
+void ProductFCUEfis::reportMemoryUsage(MemoryUsage &usage) {
+    USBDevice::reportMemoryUsage(usage);
+
+    if (!profile) {
+        return;
+    }
+
+    const auto &datarefs = profile->displayDatarefs();
+    usage.addSharedAsset(&datarefs, MemoryUsage::StringListSize(datarefs));
+
+    const auto &buttons = profile->buttonDefs();
+    size_t buttonBytes = sizeof(buttons) + buttons.capacity() * sizeof(FCUEfisButtonDef);
+    for (const auto &button : buttons) {
+        buttonBytes += MemoryUsage::StringSize(button.name) + MemoryUsage::StringSize(button.dataref) - 2 * sizeof(std::string);
+    }
+    usage.addSharedAsset(&buttons, buttonBytes);
+}
+
 void ProductFCUEfis::updateDisplays() {
     bool shouldUpdate = false;
     auto datarefManager = Dataref::getInstance();
@@ -244,9 +273,9 @@ void ProductFCUEfis::updateDisplays() {
 
 void ProductFCUEfis::initializeDisplays() {
     // Initialize displays with proper init sequence
-    std::vector<uint8_t> initCmd = {
+    OutputReportBuffer initCmd = {
         0xF0, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    writeData(initCmd);
+    writeData(std::span<const uint8_t>(initCmd));
 }
 
 void ProductFCUEfis::clearDisplays() {
@@ -271,7 +300,7 @@ void ProductFCUEfis::sendFCUDisplay(const std::string &speed, const std::string
     auto vsData = encodeStringSwapped(4, fixStringLength(vs, 4));
 
     // Create flag bytes array
-    std::vector<uint8_t> flagBytes(17, 0);
+    std::array<uint8_t, 17> flagBytes{};
 
     // Set flags based on display data
     if (displayData.spdMach) {
@@ -356,52 +385,46 @@ void ProductFCUEfis::sendFCUDisplay(const std::string &speed, const std::string
         std::fill(flagBytes.begin(), flagBytes.end(), displayData.displayTest ? 0xFF : 0);
     }
 
+    // Both requests are built in place, zero padded to 64 bytes
+    std::array<OutputReportBuffer, 2> frame{};
+
     // First request - send display data
-    std::vector<uint8_t> data1 = {
+    OutputReportBuffer &data1 = frame[0];
+    data1 = {
         0xF0, 0x00, packetNumber, 0x31, ProductFCUEfis::IdentifierByte, 0xBB, 0x00, 0x00, 0x02, 0x01, 0x00, 0x00, 0xFF, 0xFF, 0x02, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    size_t length = 25;
 
     // Add speed data (3 bytes)
-    data1.push_back(speedData[2]);
-    data1.push_back(speedData[1] | flagBytes[static_cast<int>(DisplayByteIndex::S1)]);
-    data1.push_back(speedData[0]);
+    data1[length++] = speedData[2];
+    data1[length++] = speedData[1] | flagBytes[static_cast<int>(DisplayByteIndex::S1)];
+    data1[length++] = speedData[0];
 
     // Add heading data (4 bytes)
-    data1.push_back(headingData[3] | flagBytes[static_cast<int>(DisplayByteIndex::H3)]);
-    data1.push_back(headingData[2]);
-    data1.push_back(headingData[1]);
-    data1.push_back(headingData[0] | flagBytes[static_cast<int>(DisplayByteIndex::H0)]);
+    data1[length++] = headingData[3] | flagBytes[static_cast<int>(DisplayByteIndex::H3)];
+    data1[length++] = headingData[2];
+    data1[length++] = headingData[1];
+    data1[length++] = headingData[0] | flagBytes[static_cast<int>(DisplayByteIndex::H0)];
 
     // Add altitude data (6 bytes)
-    data1.push_back(altitudeData[5] | flagBytes[static_cast<int>(DisplayByteIndex::A5)]);
-    data1.push_back(altitudeData[4] | flagBytes[static_cast<int>(DisplayByteIndex::A4)]);
-    data1.push_back(altitudeData[3] | flagBytes[static_cast<int>(DisplayByteIndex::A3)]);
-    data1.push_back(altitudeData[2] | flagBytes[static_cast<int>(DisplayByteIndex::A2)]);
-    data1.push_back(altitudeData[1] | flagBytes[static_cast<int>(DisplayByteIndex::A1)]);
-    data1.push_back(altitudeData[0] | vsData[4] | flagBytes[static_cast<int>(DisplayByteIndex::A0)]);
+    data1[length++] = altitudeData[5] | flagBytes[static_cast<int>(DisplayByteIndex::A5)];
+    data1[length++] = altitudeData[4] | flagBytes[static_cast<int>(DisplayByteIndex::A4)];
+    data1[length++] = altitudeData[3] | flagBytes[static_cast<int>(DisplayByteIndex::A3)];
+    data1[length++] = altitudeData[2] | flagBytes[static_cast<int>(DisplayByteIndex::A2)];
+    data1[length++] = altitudeData[1] | flagBytes[static_cast<int>(DisplayByteIndex::A1)];
+    data1[length++] = altitudeData[0] | vsData[4] | flagBytes[static_cast<int>(DisplayByteIndex::A0)];
 
     // Add vertical speed data (4 bytes)
-    data1.push_back(vsData[3] | flagBytes[static_cast<int>(DisplayByteIndex::V3)]);
-    data1.push_back(vsData[2] | flagBytes[static_cast<int>(DisplayByteIndex::V2)]);
-    data1.push_back(vsData[1] | flagBytes[static_cast<int>(DisplayByteIndex::V1)]);
-    data1.push_back(vsData[0] | flagBytes[static_cast<int>(DisplayByteIndex::V0)]);
-
-    // Pad to 64 bytes
-    while (data1.size() < 64) {
-        data1.push_back(0x00);
-    }
-    
-    writeData(data1);
+    data1[length++] = vsData[3] | flagBytes[static_cast<int>(DisplayByteIndex::V3)];
+    data1[length++] = vsData[2] | flagBytes[static_cast<int>(DisplayByteIndex::V2)];
+    data1[length++] = vsData[1] | flagBytes[static_cast<int>(DisplayByteIndex::V1)];
+    data1[length++] = vsData[0] | flagBytes[static_cast<int>(DisplayByteIndex::V0)];
 
     // Second request - commit display data
-    std::vector<uint8_t> data2 = {
+    frame[1] = {
         0xF0, 0x00, packetNumber, 0x11, ProductFCUEfis::IdentifierByte, 0xBB, 0x00, 0x00, 0x03, 0x01, 0x00, 0x00, 0xFF, 0xFF, 0x02, 0x00};
 
-    // Pad to 64 bytes
-    while (data2.size() < 64) {
-        data2.push_back(0x00);
-    }
-
-    writeData(data2);
+    // Both go out as one message; a newer frame replaces a queued one
+    queueOutput(OutputLane::Display, OutputTargetFCUDisplay, std::span<const OutputReportBuffer>(frame));
 
     packetNumber++;
     if (packetNumber == 0) {
@@ -410,15 +433,16 @@ void ProductFCUEfis::sendFCUDisplay(const std::string &speed, const std::string
 }
 
 void ProductFCUEfis::sendEfisDisplayWithFlags(EfisDisplayValue *data, bool isRightSide) {
-    std::vector<uint8_t> flagBytes(17, 0);
+    std::array<uint8_t, 17> flagBytes{};
     flagBytes[static_cast<int>(isRightSide ? DisplayByteIndex::EFISR_B0 : DisplayByteIndex::EFISL_B0)] |= data->isStd ? 0x00 : (data->showQfe ? 0x01 : 0x02);
     if (data->unitIsInHg) { // Show comma
         flagBytes[static_cast<int>(isRightSide ? DisplayByteIndex::EFISR_B2 : DisplayByteIndex::EFISL_B2)] |= 0x80;
     }
 
     // EFIS display protocol
-    std::vector<uint8_t> payload = {
+    OutputReportBuffer payload = {
         0xF0, 0x00, packetNumber, 0x1A, static_cast<uint8_t>(isRightSide ? 0x0E : 0x0D), 0xBF, 0x00, 0x00, 0x02, 0x01, 0x00, 0x00, 0xFF, 0xFF, 0x1D, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    size_t length = 25;
 
     // Add barometric data
     auto baroData = encodeStringEfis(4, fixStringLength(data->isStd ? "STD " : data->baro, 4));
@@ -428,21 +452,18 @@ void ProductFCUEfis::sendEfisDisplayWithFlags(EfisDisplayValue *data, bool isRig
         std::fill(flagBytes.begin(), flagBytes.end(), data->displayTest ? 0xFF : 0);
     }
 
-    payload.push_back(baroData[3]);
-    payload.push_back(baroData[2] | flagBytes[static_cast<int>(isRightSide ? DisplayByteIndex::EFISR_B2 : DisplayByteIndex::EFISL_B2)]);
-    payload.push_back(baroData[1]);
-    payload.push_back(baroData[0]);
-    payload.push_back(flagBytes[static_cast<int>(isRightSide ? DisplayByteIndex::EFISR_B0 : DisplayByteIndex::EFISL_B0)]);
+    payload[length++] = baroData[3];
+    payload[length++] = baroData[2] | flagBytes[static_cast<int>(isRightSide ? DisplayByteIndex::EFISR_B2 : DisplayByteIndex::EFISL_B2)];
+    payload[length++] = baroData[1];
+    payload[length++] = baroData[0];
+    payload[length++] = flagBytes[static_cast<int>(isRightSide ? DisplayByteIndex::EFISR_B0 : DisplayByteIndex::EFISL_B0)];
 
     // Add second command
-    payload.insert(payload.end(), {0x0E, 0xBF, 0x00, 0x00, 0x03, 0x01, 0x00, 0x00, 0x4C, 0x0C, 0x1D});
-
-    // Pad to 64 bytes
-    while (payload.size() < 64) {
-        payload.push_back(0x00);
+    for (uint8_t byte : {0x0E, 0xBF, 0x00, 0x00, 0x03, 0x01, 0x00, 0x00, 0x4C, 0x0C, 0x1D}) {
+        payload[length++] = byte;
     }
 
-    writeData(payload);
+    queueOutput(OutputLane::Display, isRightSide ? OutputTargetEfisRightDisplay : OutputTargetEfisLeftDisplay, std::span<const uint8_t>(payload));
 
     // Increment package number for next call
     packetNumber++;
@@ -452,23 +473,26 @@ void ProductFCUEfis::sendEfisDisplayWithFlags(EfisDisplayValue *data, bool isRig
 }
 
 void ProductFCUEfis::setLedBrightness(FCUEfisLed led, uint8_t brightness) {
-    std::vector<uint8_t> data;
+    std::array<uint8_t, 14> data;
 
     int ledValue = static_cast<int>(led);
 
     if (ledValue < 100) {
         // FCU LEDs
-        data = {0x02, ProductFCUEfis::IdentifierByte, 0xBB, 0x00, 0x00, 0x03, 0x49, static_cast<uint8_t>(ledValue), brightness, 0x00, 0x00, 0x00, 0x00, 0x00};
+        data = SetValueReport(ProductFCUEfis::IdentifierByte, 0xBB, static_cast<uint8_t>(ledValue), brightness);
     } else if (ledValue < 200) {
         // EFIS Right LEDs
-        data = {0x02, 0x0E, 0xBF, 0x00, 0x00, 0x03, 0x49, static_cast<uint8_t>(ledValue - 100), brightness, 0x00, 0x00, 0x00, 0x00, 0x00};
+        data = SetValueReport(0x0E, 0xBF, static_cast<uint8_t>(ledValue - 100), brightness);
     } else if (ledValue < 300) {
         // EFIS Left LEDs
-        data = {0x02, 0x0D, 0xBF, 0x00, 0x00, 0x03, 0x49, static_cast<uint8_t>(ledValue - 200), brightness, 0x00, 0x00, 0x00, 0x00, 0x00};
+        data = SetValueReport(0x0D, 0xBF, static_cast<uint8_t>(ledValue - 200), brightness);
     }
 
-    if (!data.empty()) {
-        writeData(data);
+    if (ledValue < 300) {
+        // Selectors 0..2 of each panel (backlight, screen backlight, overall green) and the
+        // EXPED backlight are backlights, routed to the low-priority Brightness lane
+        bool isBacklightChannel = ledValue % 100 <= 2 || led == FCUEfisLed::EXPED_BACKLIGHT;
+        queueOutput(isBacklightChannel ? OutputLane::Brightness : OutputLane::Indicators, OutputTargetLed + ledValue, std::span<const uint8_t>(data));
     } else {
         debug("No LED data generated for LED %d\n", ledValue);
     }
@@ -476,76 +500,18 @@ void ProductFCUEfis::setLedBrightness(FCUEfisLed led, uint8_t brightness) {
 
 void ProductFCUEfis::forceStateSync() {
     pressedButtonIndices.clear();
-    lastButtonStateLo = 0;
-    lastButtonStateHi = 0;
 
     USBDevice::forceStateSync();
 }
 
-void ProductFCUEfis::didReceiveData(int reportId, uint8_t *report, int reportLength) {
-    if (!connected || !profile || !report || reportLength <= 0) {
-        return;
-    }
-
-    if (reportId != 1 || reportLength < 13) {
-#if DEBUG
-//        printf("[%s] Ignoring reportId %d, length %d\n", classIdentifier(), reportId, reportLength);
-//        printf("[%s] Data (hex): ", classIdentifier());
-//        for (int i = 0; i < reportLength; ++i) {
-//            printf("%02X ", report[i]);
-//        }
-//        printf("\n");
-#endif
-        return;
-    }
-
-    uint64_t buttonsLo = 0;
-    uint32_t buttonsHi = 0;
-    for (int i = 0; i < 8 && i + 1 < reportLength; ++i) {
-        buttonsLo |= ((uint64_t) report[i + 1]) << (8 * i);
-    }
-    for (int i = 0; i < 4 && i + 9 < reportLength; ++i) {
-        buttonsHi |= ((uint32_t) report[i + 9]) << (8 * i);
-    }
-
-    if (buttonsLo == lastButtonStateLo && buttonsHi == lastButtonStateHi) {
+void ProductFCUEfis::didReceiveData(const InputFrame &frame) {
+    if (!connected || !profile || frame.reportId != 1) {
         return;
     }
 
-    lastButtonStateLo = buttonsLo;
-    lastButtonStateHi = buttonsHi;
-
-    // Process FCU buttons (bytes 1-4 = buttons 0-31)
-    for (int byteIndex = 1; byteIndex <= 4 && byteIndex < reportLength; byteIndex++) {
-        uint8_t buttonByte = report[byteIndex];
-
-        for (int bitIndex = 0; bitIndex < 8; bitIndex++) {
-            int hardwareButtonIndex = (byteIndex - 1) * 8 + bitIndex; // Subtract 1 to start at button 0
-            bool pressed = (buttonByte & (1 << bitIndex)) != 0;
-            didReceiveButton(hardwareButtonIndex, pressed);
-        }
-    }
-
-    // Process EFIS-R buttons (bytes 9-12 = buttons 32-63)
-    for (int byteIndex = 9; byteIndex <= 12 && byteIndex < reportLength; byteIndex++) {
-        uint8_t buttonByte = report[byteIndex];
-
-        for (int bitIndex = 0; bitIndex < 8; bitIndex++) {
-            int hardwareButtonIndex = 64 + (byteIndex - 9) * 8 + bitIndex; // EFIS-R starts at button 64
-            bool pressed = (buttonByte & (1 << bitIndex)) != 0;
-            didReceiveButton(hardwareButtonIndex, pressed);
-        }
-    }
-
-    // Process EFIS-L buttons (bytes 5-8 = buttons 64-95)
-    for (int byteIndex = 5; byteIndex <= 8 && byteIndex < reportLength; byteIndex++) {
-        uint8_t buttonByte = report[byteIndex];
-
-        for (int bitIndex = 0; bitIndex < 8; bitIndex++) {
-            int hardwareButtonIndex = 32 + (byteIndex - 5) * 8 + bitIndex; // EFIS-L starts at button 32
-            bool pressed = (buttonByte & (1 << bitIndex)) != 0;
-            didReceiveButton(hardwareButtonIndex, pressed);
-        }
+    // Bytes 1-4 are FCU buttons 0-31, bytes 5-8 EFIS-L buttons 32-63, bytes 9-12 EFIS-R buttons 64-95
+    for (const auto &edge : frame.buttonEdges) {
+        didReceiveButton(edge.index, edge.pressed);
     }
 }
 
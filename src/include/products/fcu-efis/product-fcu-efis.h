@@ -9,6 +9,12 @@
 
 class ProductFCUEfis : public USBDevice {
     private:
+        // Output queue targets, see USBDevice::queueOutput()
+        static constexpr uint32_t OutputTargetFCUDisplay = 1;
+        static constexpr uint32_t OutputTargetEfisLeftDisplay = 2;
+        static constexpr uint32_t OutputTargetEfisRightDisplay = 3;
+        static constexpr uint32_t OutputTargetLed = 0x100;
+
         uint8_t packetNumber = 1;
         FCUEfisAircraftProfile *profile;
         FCUDisplayData displayData;
@@ -17,9 +23,6 @@ class ProductFCUEfis : public USBDevice {
         std::set<int> pressedButtonIndices;
         std::map<std::string, int> selectorPositions;
 
-        uint64_t lastButtonStateLo = 0;
-        uint32_t lastButtonStateHi = 0;
-
         void setProfileForCurrentAircraft();
         void updateDisplays();
 
@@ -33,9 +36,13 @@ class ProductFCUEfis : public USBDevice {
         bool connect() override;
         void disconnect() override;
         void update() override;
-        void didReceiveData(int reportId, uint8_t *report, int reportLength) override;
+        void didReceiveData(const InputFrame &frame) override;
         void didReceiveButton(uint16_t hardwareButtonIndex, bool pressed, uint8_t count = 1) override;
         void forceStateSync() override;
+        bool allowsDormantMode() override;
+        void didEnterDormantMode() override;
+        void didExitDormantMode() override;
+        void reportMemoryUsage(MemoryUsage &usage) override;
 
         void setLedBrightness(FCUEfisLed led, uint8_t brightness);
 
@@ -11,56 +11,94 @@
 #include "xcrafts.h"
 
 #include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
 
-const std::vector<std::vector<unsigned char>> Font::GlyphData(FontVariant variant, unsigned char hardwareIdentifier) {
-    std::vector<std::vector<unsigned char>> result = {};
+// Upload packets were sniffed from an MCDU, which identifies itself as 0x32. Such devices
+// upload the table as is; every other identifier shares one patched copy per font.
+static constexpr unsigned char SniffedHardwareIdentifier = 0x32;
 
+static std::mutex cacheMutex;
+static std::map<FontVariant, const std::vector<std::vector<unsigned char>> *> sourceTables;
+static std::map<std::pair<FontVariant, unsigned char>, std::vector<std::vector<unsigned char>>> patchedTables;
+
+static const std::vector<std::vector<unsigned char>> &SourceGlyphData(FontVariant variant) {
     switch (variant) {
         case FontVariant::FontAirbus:
-            result = fmcFontAirbus;
-            break;
+            return fmcFontAirbus();
 
         case FontVariant::Font737:
-            result = fmcFont737;
-            break;
+            return fmcFont737();
 
         case FontVariant::FontXCrafts:
-            result = fmcFontXCrafts;
-            break;
+            return fmcFontXCrafts();
 
         case FontVariant::FontVGA1:
-            result = fmcFontVGA1;
-            break;
+            return fmcFontVGA1();
 
         case FontVariant::FontVGA2:
-            result = fmcFontVGA2;
-            break;
+            return fmcFontVGA2();
 
         case FontVariant::FontVGA3:
-            result = fmcFontVGA3;
-            break;
+            return fmcFontVGA3();
 
         case FontVariant::FontVGA4:
-            result = fmcFontVGA4;
-            break;
+            return fmcFontVGA4();
 
         case FontVariant::FontMD11:
-            result = fmcFontMd11Cdu;
-            break;
+            return fmcFontMd11Cdu();
 
         case FontVariant::Default:
         default:
-            result = fmcFontDefault;
-            break;
+            return fmcFontDefault();
+    }
+}
+
+const std::vector<std::vector<unsigned char>> &Font::GlyphData(FontVariant variant, unsigned char hardwareIdentifier) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    const auto &source = SourceGlyphData(variant);
+    sourceTables[variant] = &source;
+    if (hardwareIdentifier == SniffedHardwareIdentifier) {
+        return source;
+    }
+
+    auto key = std::make_pair(variant, hardwareIdentifier);
+    auto it = patchedTables.find(key);
+    if (it != patchedTables.end()) {
+        return it->second;
     }
 
+    std::vector<std::vector<unsigned char>> result = source;
     for (auto &row : result) {
         for (size_t i = 0; i + 1 < row.size(); i++) {
-            if (row[i] == 0x32 && row[i + 1] == 0xbb) { // Sniffed packets always have the MCDU identifier
+            if (row[i] == SniffedHardwareIdentifier && row[i + 1] == 0xbb) {
                 row[i] = hardwareIdentifier;
-                row[i + 1] = 0xbb;
             }
         }
     }
-    return result;
+
+    return patchedTables.emplace(key, std::move(result)).first->second;
+}
+
+size_t Font::TableSize(const std::vector<std::vector<unsigned char>> &table) {
+    size_t bytes = sizeof(table) + table.capacity() * sizeof(table[0]);
+    for (const auto &row : table) {
+        bytes += row.capacity();
+    }
+    return bytes;
+}
+
+size_t Font::LoadedBytes() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+
+    size_t bytes = 0;
+    for (const auto &[variant, table] : sourceTables) {
+        bytes += TableSize(*table);
+    }
+    for (const auto &[key, table] : patchedTables) {
+        bytes += TableSize(table);
+    }
+    return bytes;
 }
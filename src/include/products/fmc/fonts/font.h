@@ -1,6 +1,8 @@
 #ifndef FONT_H
 #define FONT_H
 
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 enum class FontVariant : unsigned char {
@@ -17,7 +19,14 @@ enum class FontVariant : unsigned char {
 
 class Font {
     public:
-        static const std::vector<std::vector<unsigned char>> GlyphData(FontVariant variant, unsigned char hardwareIdentifier);
+        // Upload packets for the given font, patched for the device identifier. Built once per
+        // variant and identifier and kept for the lifetime of the plugin, so the reference
+        // stays valid and can be handed to an I/O thread.
+        static const std::vector<std::vector<unsigned char>> &GlyphData(FontVariant variant, unsigned char hardwareIdentifier);
+
+        // Memory accounting
+        static size_t TableSize(const std::vector<std::vector<unsigned char>> &table);
+        static size_t LoadedBytes();
 };
 
 #endif
@@ -3,6 +3,7 @@
 #include "appstate.h"
 #include "config.h"
 #include "dataref.h"
+#include "startup-profiler.h"
 #include "profiles/ff767-fmc-profile.h"
 #include "profiles/ff777-fmc-profile.h"
 #include "profiles/ixeg733-fmc-profile.h"
@@ -13,29 +14,44 @@
 #include "profiles/xcrafts-fmc-profile.h"
 #include "profiles/zibo-fmc-profile.h"
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <XPLMProcessing.h>
 
+// Splits a 0xf2 display stream into 64-byte reports of 63 payload bytes each. The reports are
+// rewritten in place, only the last one's unused tail needs clearing.
+static void ChunkDisplayStream(const std::vector<uint8_t> &stream, std::vector<OutputReportBuffer> &reports) {
+    reports.resize((stream.size() + 62) / 63);
+    for (size_t offset = 0, index = 0; offset < stream.size(); offset += 63, ++index) {
+        size_t length = std::min<size_t>(63, stream.size() - offset);
+        OutputReportBuffer &report = reports[index];
+        report[0] = 0xf2;
+        std::copy(stream.begin() + offset, stream.begin() + offset + length, report.begin() + 1);
+        std::fill(report.begin() + 1 + length, report.end(), 0);
+    }
+}
+
 ProductFMC::ProductFMC(HIDDeviceHandle hidDevice, uint16_t vendorId, uint16_t productId, std::string vendorName, std::string productName, FMCHardwareType hardwareType, FMCDeviceVariant variant, unsigned char identifierByte) :
     USBDevice(hidDevice, vendorId, productId, vendorName, productName), hardwareType(hardwareType), identifierByte(identifierByte), deviceVariant(variant) {
     profile = nullptr;
     page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageBytesPerLine, ' '));
     _sentPage = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageBytesPerLine, ' '));
+    _pendingPage = _sentPage;
+    _ioPage = _sentPage;
+    _renderBuffer.reserve(ProductFMC::PageLines * ProductFMC::PageCharsPerLine * 8);
+    _pageReports.reserve(_renderBuffer.capacity() / 63 + 1);
     lastUpdateCycle = 0;
-    lastButtonStateLo = 0;
-    lastButtonStateHi = 0;
     pressedButtonIndices = {};
     fontUpdatingEnabled = true;
+    setInputLayout({.reportId = 1, .minimumLength = 13, .buttonOffset = 1, .buttonBytes = 12});
 
     connect();
 }
 
 ProductFMC::~ProductFMC() {
-    // Stop the I/O thread before disconnecting
-    if (_ioRunning.exchange(false)) {
-        _ioCv.notify_all();
-        if (_ioThread.joinable()) _ioThread.join();
-    }
+    // No I/O pass may run once the device is gone
+    IOWorker::getInstance()->remove(_ioClient);
     disconnect();
 }
 
@@ -125,15 +141,10 @@ bool ProductFMC::connect() {
         setLedBrightness(FMCLed::MCDU_FAIL, 1);
         setLedBrightness(FMCLed::PFP_FAIL, 1);
 
-        if (!profile) {
-            setProfileForCurrentAircraft();
-        }
-
-        // Start the I/O worker thread
-        if (!_ioRunning.load()) {
-            _ioRunning.store(true);
-            _ioThread = std::thread([this]{ this->ioThreadMain(); });
-        }
+        // I/O passes run on the shared worker
+        IOWorker::getInstance()->add(_ioClient, [this]() {
+            return ioPass();
+        });
 
         return true;
     }
@@ -142,11 +153,7 @@ bool ProductFMC::connect() {
 }
 
 void ProductFMC::disconnect() {
-    // Stop the I/O thread
-    if (_ioRunning.exchange(false)) {
-        _ioCv.notify_all();
-        if (_ioThread.joinable()) _ioThread.join();
-    }
+    IOWorker::getInstance()->remove(_ioClient);
 
     setLedBrightness(FMCLed::BACKLIGHT, 0);
     setLedBrightness(FMCLed::SCREEN_BACKLIGHT, 0);
@@ -186,49 +193,56 @@ void ProductFMC::update() {
     }
 }
 
-void ProductFMC::didReceiveData(int reportId, uint8_t *report, int reportLength) {
-    if (!connected || !profile || !report || reportLength <= 0) {
-        return;
-    }
+bool ProductFMC::allowsDormantMode() {
+    return true;
+}
 
-    if (reportId != 1 || reportLength < 13) { // We only handle report #1 for now.
-#if DEBUG
-//        printf("[%s] Ignoring reportId %d, length %d\n", classIdentifier(), reportId, reportLength);
-//        printf("[%s] Data (hex): ", classIdentifier());
-//        for (int i = 0; i < reportLength; ++i) {
-//            printf("%02X ", report[i]);
-//        }
-//        printf("\n");
-#endif
-        return;
-    }
+void ProductFMC::didEnterDormantMode() {
+    ClearPage(page);
+    qDrawPage(page);
+}
 
-    uint64_t buttonsLo = 0;
-    uint32_t buttonsHi = 0;
-    for (int i = 0; i < 8; ++i) {
-        buttonsLo |= ((uint64_t) report[i + 1]) << (8 * i);
-    }
-    for (int i = 0; i < 4; ++i) {
-        buttonsHi |= ((uint32_t) report[i + 9]) << (8 * i);
-    }
+void ProductFMC::didExitDormantMode() {
+    lastUpdateCycle = 0;
+}
 
-    if (buttonsLo == lastButtonStateLo && buttonsHi == lastButtonStateHi) {
-        return;
+void ProductFMC::reportMemoryUsage(MemoryUsage &usage) {
+    USBDevice::reportMemoryUsage(usage);
+
+    usage.deviceBuffers += MemoryUsage::PageSize(page) + MemoryUsage::PageSize(_sentPage) + _renderBuffer.capacity() + _pageReports.capacity() * sizeof(OutputReportBuffer);
+
+    {
+        std::lock_guard<std::mutex> lk(_ioMx);
+        usage.deviceBuffers += MemoryUsage::PageSize(_pendingPage) + MemoryUsage::PageSize(_ioPage);
+        for (const auto &cmd : _ioQueue) {
+            usage.queues += sizeof(cmd) + cmd.data.capacity();
+        }
     }
 
-    lastButtonStateLo = buttonsLo;
-    lastButtonStateHi = buttonsHi;
+    if (currentFont) {
+        usage.addSharedAsset(currentFont, Font::TableSize(*currentFont));
+    }
 
-    for (int i = 0; i < 96; ++i) {
-        bool pressed;
+    if (profile) {
+        const auto &datarefs = profile->displayDatarefs();
+        usage.addSharedAsset(&datarefs, MemoryUsage::StringListSize(datarefs));
 
-        if (i < 64) {
-            pressed = (buttonsLo >> i) & 1;
-        } else {
-            pressed = (buttonsHi >> (i - 64)) & 1;
+        const auto &buttons = profile->buttonDefs();
+        size_t buttonBytes = sizeof(buttons) + buttons.capacity() * sizeof(FMCButtonDef);
+        for (const auto &button : buttons) {
+            buttonBytes += MemoryUsage::StringSize(button.dataref) - sizeof(std::string);
         }
+        usage.addSharedAsset(&buttons, buttonBytes);
+    }
+}
+
+void ProductFMC::didReceiveData(const InputFrame &frame) {
+    if (!connected || !profile || frame.reportId != 1) { // We only handle report #1 for now.
+        return;
+    }
 
-        didReceiveButton(i, pressed);
+    for (const auto &edge : frame.buttonEdges) {
+        didReceiveButton(edge.index, edge.pressed);
     }
 }
 
@@ -285,6 +299,7 @@ void ProductFMC::updatePage() {
             profile->updatePage(page);
             lastUpdateCycle = XPLMGetCycleNumber();
             draw();
+            break;
         }
     }
 }
@@ -311,17 +326,25 @@ std::pair<uint8_t, uint8_t> ProductFMC::dataFromColFont(char color, bool fontSma
     return {static_cast<uint8_t>(value & 0xFF), static_cast<uint8_t>((value >> 8) & 0xFF)};
 }
 
+void ProductFMC::ClearPage(std::vector<std::vector<char>> &page) {
+    // Reuses the existing line buffers; only the first call for a page allocates.
+    page.resize(ProductFMC::PageLines);
+    for (auto &line : page) {
+        line.assign(ProductFMC::PageBytesPerLine, ' ');
+    }
+}
+
 void ProductFMC::writeLineToPage(std::vector<std::vector<char>> &page, int line, int pos, const std::string &text, char color, bool fontSmall) {
     if (line < 0 || line >= ProductFMC::PageLines) {
-        debug("Not writing line %i: Line number is out of range!\n", line);
+        debug_throttled(1000, "Not writing line %i: Line number is out of range!\n", line);
         return;
     }
     if (pos < 0 || pos + text.length() > ProductFMC::PageCharsPerLine) {
-        debug("Not writing line %i: Position number (%i) is out of range!\n", line, pos);
+        debug_throttled(1000, "Not writing line %i: Position number (%i) is out of range!\n", line, pos);
         return;
     }
     if (text.length() > ProductFMC::PageCharsPerLine) {
-        debug("Not writing line %i: Text is too long (%lu) for line.\n", line, text.length());
+        debug_throttled(1000, "Not writing line %i: Text is too long (%lu) for line.\n", line, text.length());
         return;
     }
 
@@ -334,74 +357,79 @@ void ProductFMC::writeLineToPage(std::vector<std::vector<char>> &page, int line,
 }
 
 void ProductFMC::clearDisplay() {
-    std::vector<uint8_t> blankLine = {};
-    blankLine.push_back(0xf2);
-    for (int i = 0; i < ProductFMC::PageCharsPerLine; ++i) {
-        blankLine.push_back(0x42);
-        blankLine.push_back(0x00);
-        blankLine.push_back(' ');
-    }
+    // 16 blank lines, built once and sent in the same 64-byte reports as a page
+    static const std::vector<OutputReportBuffer> blankReports = []() {
+        std::vector<uint8_t> stream;
+        for (int i = 0; i < 16 * ProductFMC::PageCharsPerLine; ++i) {
+            stream.insert(stream.end(), {0x42, 0x00, ' '});
+        }
 
-    for (int i = 0; i < 16; ++i) {
-        USBDevice::writeData(blankLine);
-    }
+        std::vector<OutputReportBuffer> reports;
+        ChunkDisplayStream(stream, reports);
+        return reports;
+    }();
+
+    // Same target as the page, so the output shadow knows the device shows neither
+    queueOutput(OutputLane::Display, OutputTargetPage, std::span<const OutputReportBuffer>(blankReports));
 }
 
-void ProductFMC::setFont(std::vector<std::vector<unsigned char>> font) {
+void ProductFMC::setFont(FontVariant variant) {
     if (!fontUpdatingEnabled) {
         return;
     }
 
-    for (auto &fontBytes : font) {
-        USBDevice::writeData(fontBytes);
-    }
+    // The upload is a few hundred reports; it goes out on the I/O thread ahead of the first page.
+    currentFont = &Font::GlyphData(variant, identifierByte);
+    qUploadFont(*currentFont);
 }
 
 void ProductFMC::showBackground(FMCBackgroundVariant variant) {
-    std::vector<uint8_t> data;
+    std::array<uint8_t, 64> data = {};
+    std::array<uint8_t, 16> header;
 
     switch (variant) {
         case FMCBackgroundVariant::GRAY:
-            data = {0xf0, 0x00, 0x02, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x53, 0x20, 0x07, 0x00};
+            header = {0xf0, 0x00, 0x02, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x53, 0x20, 0x07, 0x00};
             break;
 
         case FMCBackgroundVariant::BLACK:
-            data = {0xf0, 0x00, 0x03, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xfd, 0x24, 0x07, 0x00};
+            header = {0xf0, 0x00, 0x03, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xfd, 0x24, 0x07, 0x00};
             break;
 
         case FMCBackgroundVariant::RED:
-            data = {0xf0, 0x00, 0x04, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x55, 0x29, 0x07, 0x00};
+            header = {0xf0, 0x00, 0x04, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x55, 0x29, 0x07, 0x00};
             break;
 
         case FMCBackgroundVariant::GREEN:
-            data = {0xf0, 0x00, 0x06, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xad, 0x95, 0x09, 0x00};
+            header = {0xf0, 0x00, 0x06, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xad, 0x95, 0x09, 0x00};
             break;
 
         case FMCBackgroundVariant::BLUE:
-            data = {0xf0, 0x00, 0x07, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xa7, 0x9b, 0x09, 0x00};
+            header = {0xf0, 0x00, 0x07, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xa7, 0x9b, 0x09, 0x00};
             break;
 
         case FMCBackgroundVariant::YELLOW:
-            data = {0xf0, 0x00, 0x08, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x09, 0xa1, 0x09, 0x00};
+            header = {0xf0, 0x00, 0x08, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x09, 0xa1, 0x09, 0x00};
             break;
 
         case FMCBackgroundVariant::PURPLE:
-            data = {0xf0, 0x00, 0x09, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x05, 0xa7, 0x09, 0x00};
+            header = {0xf0, 0x00, 0x09, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0x05, 0xa7, 0x09, 0x00};
             break;
 
         case FMCBackgroundVariant::WINWING_LOGO:
-            data = {0xf0, 0x00, 0x0a, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xd4, 0xac, 0x09, 0x00};
+            header = {0xf0, 0x00, 0x0a, 0x12, identifierByte, 0xbb, 0x00, 0x00, 0x04, 0x01, 0x00, 0x00, 0xd4, 0xac, 0x09, 0x00};
             break;
 
         default:
             return;
     }
 
-    std::vector<uint8_t> extra = {
-        0x00, 0x01, 0x00, 0x00, 0x00, static_cast<uint8_t>(0x0c + (int) variant), 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    data.insert(data.end(), extra.begin(), extra.end());
+    // Header, then 00 01 00 00 00 <background index> and zero padding
+    std::copy(header.begin(), header.end(), data.begin());
+    data[header.size() + 1] = 0x01;
+    data[header.size() + 5] = static_cast<uint8_t>(0x0c + (int) variant);
 
-    USBDevice::writeData(data);
+    queueOutput(OutputLane::Display, 0, std::span<const uint8_t>(data));
 }
 
 void ProductFMC::setAllLedsEnabled(bool enable) {
@@ -428,7 +456,10 @@ void ProductFMC::setLedBrightness(FMCLed led, uint8_t brightness) {
         return;
     }
 
-    USBDevice::writeData({0x02, identifierByte, 0xbb, 0x00, 0x00, 0x03, 0x49, led, brightness, 0x00, 0x00, 0x00, 0x00, 0x00});
+    // Latest brightness per LED wins while the writer is behind
+    auto report = SetValueReport(identifierByte, 0xbb, led, brightness);
+    OutputLane lane = led < FMCLed::_PFP_START ? OutputLane::Brightness : OutputLane::Indicators;
+    queueOutput(lane, OutputTargetLed + led, std::span<const uint8_t>(report));
 }
 
 void ProductFMC::setDeviceVariant(FMCDeviceVariant variant) {
@@ -437,87 +468,83 @@ void ProductFMC::setDeviceVariant(FMCDeviceVariant variant) {
 }
 
 // -----------------------------------------------------------------------------
-// Worker thread main loop
+// I/O pass, run by the shared IOWorker
 // -----------------------------------------------------------------------------
-void ProductFMC::ioThreadMain() {
-    std::vector<std::vector<char>> pendPage;
-    std::vector<std::vector<uint8_t>> pendWrites;
-    
-    auto drainQueue = [&](){
+IOWorker::Clock::time_point ProductFMC::ioPass() {
+    {
         std::unique_lock<std::mutex> lk(_ioMx);
-        _ioCv.wait_for(lk, std::chrono::milliseconds(5), [&]{ return !_ioQueue.empty() || !_ioRunning.load(); });
-        if (!_ioRunning.load()) return;
+        if (_hasPendingPage) {
+            // Both pages keep their line buffers, the swap just exchanges ownership.
+            std::swap(_ioPage, _pendingPage);
+            _hasPendingPage = false;
+        }
         while(!_ioQueue.empty()) {
             IoCmd c = std::move(_ioQueue.front());
             _ioQueue.pop_front();
             lk.unlock();
 
             switch (c.type) {
-                case IoCmd::DrawPage: {
-                    pendPage = std::move(c.pageData);
-                } break;
                 case IoCmd::WriteData: {
-                    pendWrites.push_back(std::move(c.data));
+                    _ioWrites.push_back(std::move(c.data));
+                } break;
+                case IoCmd::UploadFont: {
+                    _ioFont = c.font;
                 } break;
             }
 
             lk.lock();
         }
-    };
+    }
 
-    using clock = std::chrono::steady_clock;
-    auto lastDrawTx = clock::now();
+    // A font upload replaces any earlier one and goes out before writes queued with it
+    if (_ioFont) {
+        StartupPhase phase("FMC font queued");
+        // Skipped while the device still has this font, e.g. after an aircraft change
+        queueStaticOutput(OutputLane::Control, OutputTargetFont, *_ioFont);
+        _ioFont = nullptr;
+    }
 
-    while(_ioRunning.load()) {
-        drainQueue();
-        if (!_ioRunning.load()) break;
+    // Process any pending direct writes first
+    for (const auto& data : _ioWrites) {
+        USBDevice::writeData(std::span<const uint8_t>(data));
+    }
+    _ioWrites.clear();
 
-        // Process any pending direct writes first
-        for (auto& data : pendWrites) {
-            USBDevice::writeData(std::move(data));
-        }
-        pendWrites.clear();
-
-        // Page drawing with coalescing + rate-limit
-        const auto minPeriod = std::chrono::duration<double>(_minDrawPeriod);
-        const auto now = clock::now();
-        const bool timeOk = ((now - lastDrawTx) >= minPeriod);
-        const bool havePend = !pendPage.empty();
-        const bool changed = havePend && (pendPage != _sentPage);
-
-        if (changed && timeOk) {
-            // Render the page to USB buffers and send
-            std::vector<uint8_t> buf;
-            const auto &p = pendPage;
-
-            for (int i = 0; i < ProductFMC::PageLines; ++i) {
-                for (int j = 0; j < ProductFMC::PageCharsPerLine; ++j) {
-                    char color = p[i][j * ProductFMC::PageBytesPerChar];
-                    bool fontSmall = p[i][j * ProductFMC::PageBytesPerChar + 1];
-                    auto [dataLow, dataHigh] = dataFromColFont(color, fontSmall);
-                    buf.push_back(dataLow);
-                    buf.push_back(dataHigh);
-
-                    char val = p[i][j * ProductFMC::PageBytesPerChar + ProductFMC::PageBytesPerChar - 1];
-                    if (profile) {
-                        profile->mapCharacter(&buf, val, fontSmall);
-                    }
-                }
-            }
+    // Page drawing with coalescing + rate-limit
+    const auto minPeriod = std::chrono::duration_cast<IOWorker::Clock::duration>(std::chrono::duration<double>(_minDrawPeriod));
+    const auto now = IOWorker::Clock::now();
+    if (_ioPage == _sentPage) {
+        return IOWorker::Clock::time_point::max();
+    }
+    if (now - _lastDrawTx < minPeriod) {
+        return _lastDrawTx + minPeriod;
+    }
 
-            while (!buf.empty()) {
-                size_t maxLength = std::min<size_t>(63, buf.size());
-                std::vector<uint8_t> usbBuf(buf.begin(), buf.begin() + maxLength);
-                usbBuf.insert(usbBuf.begin(), 0xf2);
-                if (maxLength < 63) {
-                    usbBuf.insert(usbBuf.end(), 63 - maxLength, 0);
-                }
-                USBDevice::writeData(std::move(usbBuf));
-                buf.erase(buf.begin(), buf.begin() + maxLength);
-            }
+    // Render the page to USB buffers and send
+    auto &buf = _renderBuffer;
+    const auto &p = _ioPage;
+    buf.clear();
+
+    for (int i = 0; i < ProductFMC::PageLines; ++i) {
+        for (int j = 0; j < ProductFMC::PageCharsPerLine; ++j) {
+            char color = p[i][j * ProductFMC::PageBytesPerChar];
+            bool fontSmall = p[i][j * ProductFMC::PageBytesPerChar + 1];
+            auto [dataLow, dataHigh] = dataFromColFont(color, fontSmall);
+            buf.push_back(dataLow);
+            buf.push_back(dataHigh);
 
-            _sentPage = pendPage;
-            lastDrawTx = now;
+            char val = p[i][j * ProductFMC::PageBytesPerChar + ProductFMC::PageBytesPerChar - 1];
+            if (profile) {
+                profile->mapCharacter(&buf, val, fontSmall);
+            }
         }
     }
+
+    // One message, so a newer page replaces a queued one as a whole
+    ChunkDisplayStream(buf, _pageReports);
+    queueOutput(OutputLane::Display, OutputTargetPage, std::span<const OutputReportBuffer>(_pageReports));
+
+    _sentPage = _ioPage;
+    _lastDrawTx = now;
+    return IOWorker::Clock::time_point::max();
 }
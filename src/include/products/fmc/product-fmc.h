@@ -2,15 +2,14 @@
 #define PRODUCT_FMC_H
 
 #include "fmc-aircraft-profile.h"
+#include "font.h"
+#include "ioworker.h"
 #include "usbdevice.h"
 
 #include <chrono>
 #include <map>
 #include <set>
-#include <thread>
 #include <mutex>
-#include <condition_variable>
-#include <atomic>
 #include <deque>
 
 class ProductFMC : public USBDevice {
@@ -18,53 +17,79 @@ class ProductFMC : public USBDevice {
         // Worker queue command structure (needs to be declared first)
         struct IoCmd {
             enum Type : uint8_t {
-                DrawPage,
-                WriteData
+                WriteData,
+                UploadFont
             } type;
             std::vector<uint8_t> data;
-            std::vector<std::vector<char>> pageData;
+            const std::vector<std::vector<unsigned char>> *font = nullptr;
         };
 
+        // Output queue targets, see USBDevice::queueOutput()
+        static constexpr uint32_t OutputTargetPage = 1;
+        static constexpr uint32_t OutputTargetFont = 2;
+        static constexpr uint32_t OutputTargetLed = 0x100;
+
         FMCAircraftProfile *profile;
         std::vector<std::vector<char>> page;
         int lastUpdateCycle;
         int displayUpdateFrameCounter = 0;
+        const std::vector<std::vector<unsigned char>> *currentFont = nullptr;
         std::set<int> pressedButtonIndices;
-        uint64_t lastButtonStateLo;
-        uint32_t lastButtonStateHi;
 
-        // I/O worker thread
-        std::thread              _ioThread;
-        std::atomic<bool>        _ioRunning{false};
+        // I/O passes on the shared IOWorker
+        IOWorker::Client         _ioClient;
         std::mutex               _ioMx;
-        std::condition_variable  _ioCv;
         std::deque<IoCmd>        _ioQueue;
 
+        // Latest page handed over by the main thread (guarded by _ioMx). Preallocated so that
+        // queueing a redraw only copies characters and never allocates.
+        std::vector<std::vector<char>> _pendingPage;
+        bool                     _hasPendingPage = false;
+
         // Coalescing state for last sent page
         std::vector<std::vector<char>> _sentPage;
+
+        // Taken over by the I/O pass and not sent yet (I/O pass only)
+        std::vector<std::vector<char>> _ioPage;
+        std::vector<std::vector<uint8_t>> _ioWrites;
+        const std::vector<std::vector<unsigned char>> *_ioFont = nullptr;
+        IOWorker::Clock::time_point _lastDrawTx{};
+
+        // Encoded page, reused between draws (I/O thread only)
+        std::vector<uint8_t>     _renderBuffer;
+        std::vector<OutputReportBuffer> _pageReports;
         
         // Drawing rate-limit (similar to PAP3 LCD rate-limit)
         float                    _minDrawPeriod = 1.f / 25.f; // ~25 Hz
 
         void updatePage();
-        void draw(const std::vector<std::vector<char>> *pagePtr = nullptr);
         std::pair<uint8_t, uint8_t> dataFromColFont(char color, bool fontSmall = false);
 
         void setProfileForCurrentAircraft();
 
-        // Worker thread main loop
-        void ioThreadMain();
+        // One I/O pass, returns when the next one is due
+        IOWorker::Clock::time_point ioPass();
 
         inline void qEnqueue(IoCmd&& c) {
             { std::lock_guard<std::mutex> lk(_ioMx); _ioQueue.emplace_back(std::move(c)); }
-            _ioCv.notify_one();
+            IOWorker::getInstance()->wake(_ioClient);
         }
         inline void qDrawPage(const std::vector<std::vector<char>>& page) {
-            IoCmd c; c.type = IoCmd::DrawPage; c.pageData = page; qEnqueue(std::move(c));
+            {
+                std::lock_guard<std::mutex> lk(_ioMx);
+                for (size_t i = 0; i < _pendingPage.size() && i < page.size(); ++i) {
+                    _pendingPage[i].assign(page[i].begin(), page[i].end());
+                }
+                _hasPendingPage = true;
+            }
+            IOWorker::getInstance()->wake(_ioClient);
         }
         inline void qWriteData(const std::vector<uint8_t>& data) {
             IoCmd c; c.type = IoCmd::WriteData; c.data = data; qEnqueue(std::move(c));
         }
+        inline void qUploadFont(const std::vector<std::vector<unsigned char>>& font) {
+            IoCmd c; c.type = IoCmd::UploadFont; c.font = &font; qEnqueue(std::move(c));
+        }
 
     public:
         ProductFMC(HIDDeviceHandle hidDevice, uint16_t vendorId, uint16_t productId, std::string vendorName, std::string productName, FMCHardwareType hardwareType, FMCDeviceVariant variant, unsigned char identifierByte);
@@ -84,11 +109,19 @@ class ProductFMC : public USBDevice {
         void disconnect() override;
         void unloadProfile();
         void update() override;
-        void didReceiveData(int reportId, uint8_t *report, int reportLength) override;
+        void didReceiveData(const InputFrame &frame) override;
         void didReceiveButton(uint16_t hardwareButtonIndex, bool pressed, uint8_t count = 1) override;
+        bool allowsDormantMode() override;
+        void didEnterDormantMode() override;
+        void didExitDormantMode() override;
+        void reportMemoryUsage(MemoryUsage &usage) override;
 
+        static void ClearPage(std::vector<std::vector<char>> &page);
         void writeLineToPage(std::vector<std::vector<char>> &page, int line, int pos, const std::string &text, char color, bool fontSmall = false);
-        void setFont(std::vector<std::vector<unsigned char>> font);
+        // Hands the page (the current one by default) to the I/O pass, which sends it unless the
+        // device shows it already
+        void draw(const std::vector<std::vector<char>> *pagePtr = nullptr);
+        void setFont(FontVariant variant);
 
         void setAllLedsEnabled(bool enable);
         void setLedBrightness(FMCLed led, uint8_t brightness);
@@ -14,7 +14,7 @@
 
 FlightFactor767FMCProfile::FlightFactor767FMCProfile(ProductFMC *product) : FMCAircraftProfile(product) {
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::Font737, product->identifierByte));
+    product->setFont(FontVariant::Font737);
 
     Dataref::getInstance()->monitorExistingDataref<float>("sim/cockpit/electrical/instrument_brightness", [product](float brightness) {
         uint8_t target = Dataref::getInstance()->get<bool>("sim/cockpit/electrical/avionics_on") ? brightness * 255.0f : 0;
@@ -164,7 +164,7 @@ void FlightFactor767FMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8
 }
 
 void FlightFactor767FMCProfile::updatePage(std::vector<std::vector<char>>& page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
     
     auto datarefManager = Dataref::getInstance();
     std::vector<unsigned char> symbols = datarefManager->getCached<std::vector<unsigned char>>("1-sim/cduL/display/symbols");
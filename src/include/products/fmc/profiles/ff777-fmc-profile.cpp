@@ -11,7 +11,7 @@
 FlightFactor777FMCProfile::FlightFactor777FMCProfile(ProductFMC *product) :
     FMCAircraftProfile(product) {
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::Font737, product->identifierByte));
+    product->setFont(FontVariant::Font737);
 
     Dataref::getInstance()->monitorExistingDataref<float>("1-sim/cduL/brt", [product](float brightness) {
         uint8_t target = Dataref::getInstance()->get<bool>("1-sim/cduL/ok") ? brightness * 255.0f : 0;
@@ -175,7 +175,7 @@ void FlightFactor777FMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8
 }
 
 void FlightFactor777FMCProfile::updatePage(std::vector<std::vector<char>> &page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
 
     auto datarefManager = Dataref::getInstance();
     std::vector<unsigned char> symbols = datarefManager->getCached<std::vector<unsigned char>>("1-sim/cduL/display/symbols");
@@ -16,7 +16,7 @@
 IXEG733FMCProfile::IXEG733FMCProfile(ProductFMC *product) :
     FMCAircraftProfile(product) {
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::Font737, product->identifierByte));
+    product->setFont(FontVariant::Font737);
     Dataref::getInstance()->monitorExistingDataref<float>("ixeg/733/rheostats/light_fmc_pt_act", [product](float brightness) {
         uint8_t target = Dataref::getInstance()->get<bool>("sim/cockpit/electrical/avionics_on") ? brightness * 255.0f : 0;
         product->setLedBrightness(FMCLed::BACKLIGHT, target);
@@ -225,7 +225,7 @@ std::pair<std::string, std::vector<char>> IXEG733FMCProfile::processIxegText(con
 }
 
 void IXEG733FMCProfile::updatePage(std::vector<std::vector<char>> &page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
 
     auto datarefManager = Dataref::getInstance();
     for (const auto &ref : displayDatarefs()) {
@@ -10,7 +10,7 @@
 LaminarFMCProfile::LaminarFMCProfile(ProductFMC *product) :
     FMCAircraftProfile(product) {
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::FontAirbus, product->identifierByte));
+    product->setFont(FontVariant::FontAirbus);
 
     Dataref::getInstance()->monitorExistingDataref<std::vector<float>>("sim/cockpit2/electrical/instrument_brightness_ratio", [product](std::vector<float> brightness) {
         if (brightness.size() <= 6) {
@@ -199,7 +199,7 @@ void LaminarFMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8_t chara
 }
 
 void LaminarFMCProfile::updatePage(std::vector<std::vector<char>> &page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
 
     auto datarefManager = Dataref::getInstance();
     for (int lineNum = 0; lineNum < std::min(ProductFMC::PageLines, (unsigned int) 16); ++lineNum) {
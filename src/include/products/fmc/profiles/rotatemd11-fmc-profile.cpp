@@ -10,7 +10,7 @@ RotateMD11FMCProfile::RotateMD11FMCProfile(ProductFMC *product) :
     FMCAircraftProfile(product) {
     
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::FontMD11, product->identifierByte));
+    product->setFont(FontVariant::FontMD11);
 
     Dataref::getInstance()->monitorExistingDataref<float>("Rotate/aircraft/controls/mcdu_1_brt", [product](float brightness) {
         // Power is on if either AC bus 1 or emergency AC bus is powered
@@ -302,7 +302,7 @@ void RotateMD11FMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8_t ch
 }
 
 void RotateMD11FMCProfile::updatePage(std::vector<std::vector<char>> &page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
     
     auto datarefManager = Dataref::getInstance();
     
@@ -14,7 +14,7 @@ SSG748FMCProfile::SSG748FMCProfile(ProductFMC *product) :
     datarefRegex = std::regex("SSG/UFMC/LINE_([0-9]+)");
 
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::FontVGA1, product->identifierByte));
+    product->setFont(FontVariant::FontVGA1);
 
     Dataref::getInstance()->monitorExistingDataref<std::vector<float>>("ssg/LGT/mcdu_brt_sw", [product](std::vector<float> brightness) {
         if (brightness.size() < 27) {
@@ -171,7 +171,7 @@ void SSG748FMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8_t charac
 }
 
 void SSG748FMCProfile::updatePage(std::vector<std::vector<char>> &page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
 
     auto datarefManager = Dataref::getInstance();
     for (const auto &ref : displayDatarefs()) {
@@ -12,7 +12,7 @@ TolissFMCProfile::TolissFMCProfile(ProductFMC *product) :
     datarefRegex = std::regex("AirbusFBW/MCDU(1|2)([s]{0,1})([a-zA-Z]+)([0-6]{0,1})([L]{0,1})([a-z]{1})");
 
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::FontAirbus, product->identifierByte));
+    product->setFont(FontVariant::FontAirbus);
 
     Dataref::getInstance()->monitorExistingDataref<float>("AirbusFBW/PanelBrightnessLevel", [product](float brightness) {
         uint8_t target = Dataref::getInstance()->get<bool>("sim/cockpit/electrical/avionics_on") ? brightness * 255.0f : 0;
@@ -332,7 +332,7 @@ void TolissFMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8_t charac
 void TolissFMCProfile::updatePage(std::vector<std::vector<char>> &page) {
     std::array<int, ProductFMC::PageBytesPerLine> spw_line{};
     std::array<int, ProductFMC::PageBytesPerLine> spa_line{};
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
 
     auto datarefManager = Dataref::getInstance();
     for (const auto &ref : displayDatarefs()) {
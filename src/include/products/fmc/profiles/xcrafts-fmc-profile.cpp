@@ -18,7 +18,7 @@ XCraftsFMCProfile::XCraftsFMCProfile(ProductFMC *product) :
     datarefRegex = std::regex("XCrafts/FMS/CDU_1_([0-9]{2}|ScratchPad)");
 
     product->setAllLedsEnabled(false);
-    product->setFont(Font::GlyphData(FontVariant::FontXCrafts, product->identifierByte));
+    product->setFont(FontVariant::FontXCrafts);
 
     Dataref::getInstance()->monitorExistingDataref<float>("XCrafts/FMS/CDU1_brt", [product](float rawBrightness) {
         bool poweredOn = Dataref::getInstance()->getCached<bool>("XCrafts/FMS/power_stat");
@@ -190,7 +190,7 @@ void XCraftsFMCProfile::mapCharacter(std::vector<uint8_t> *buffer, uint8_t chara
 }
 
 void XCraftsFMCProfile::updatePage(std::vector<std::vector<char>> &page) {
-    page = std::vector<std::vector<char>>(ProductFMC::PageLines, std::vector<char>(ProductFMC::PageCharsPerLine * ProductFMC::PageBytesPerChar, ' '));
+    ProductFMC::ClearPage(page);
 
     auto datarefManager = Dataref::getInstance();
 
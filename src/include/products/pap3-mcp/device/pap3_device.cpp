@@ -6,6 +6,7 @@
 #include "../aircraft/pap3_aircraft.h"
 
 #include "inputs.h"
+#include "startup-profiler.h"
 #include "usbcontroller.h"
 
 #include <XPLMProcessing.h>
@@ -16,9 +17,7 @@
 #include <string>
 #include <vector>
 #include <mutex>
-#include <condition_variable>
 #include <chrono>
-#include <thread>
 #include <cmath>
 #include <algorithm>
 
@@ -41,10 +40,6 @@ constexpr std::array<EncDef, 6> kEncDefs{{
     {0x1D, "V/S"},
     {0x1F, "CRS FO"},
 }};
-inline const char* LookupEncoderName(std::uint8_t posOff) {
-    for (const auto& e : kEncDefs) if (e.posOff == posOff) return e.name;
-    return nullptr;
-}
 
 #ifndef PAP3_HAS_DEMO
 namespace pap3 { namespace device {
@@ -83,6 +78,9 @@ PAP3Device::PAP3Device(HIDDeviceHandle hidDevice,
 , _seq(5)
 {
     ensureWriterInstalled();
+    // The PAP3 loses frames sent less than 2 ms apart; the original I/O thread slept 2 ms
+    // between the LCD frames for that. 500 reports/s without burst keeps the same spacing.
+    setOutputBudget(500, 1);
 
     if (USBDevice::connect()) {
         runStartupSequence();
@@ -91,16 +89,7 @@ PAP3Device::PAP3Device(HIDDeviceHandle hidDevice,
 
 PAP3Device::~PAP3Device()
 {
-    _inputs.onEncoders    = nullptr;
-    _inputs.onButtons     = nullptr;
-    _inputs.onSwitchEdges = nullptr;
-    _inputs.onLightSensor = nullptr;
-    _inputs.onRaw         = nullptr;
-
-    if (_ioRunning.exchange(false)) {
-        _ioCv.notify_all();
-        if (_ioThread.joinable()) _ioThread.join();
-    }
+    IOWorker::getInstance()->remove(_ioClient);
     setDimming(0, 0);
     setDimming(1, 0);
     setDimming(2, 0);
@@ -126,12 +115,6 @@ void PAP3Device::allLedsOff() {
     for (auto id : kAllLedIds) qSetLed(id, false);
 }
 
-bool PAP3Device::waitForInitialSwitchSnapshot(std::chrono::milliseconds timeout)
-{
-    std::unique_lock<std::mutex> lk(_snapshotMx);
-    return _snapshotCv.wait_for(lk, timeout, [this]{ return _haveInitialReport; });
-}
-
 // -----------------------------------------------------------------------------
 // Startup sequence (lisible, cohérent)
 // -----------------------------------------------------------------------------
@@ -143,7 +126,7 @@ void PAP3Device::runStartupSequence()
     // 2) LCD init + clear
     sendLcdInit(static_cast<DevicePtr>(this), _seq);
     {
-        std::vector<std::uint8_t> lcd32(32, 0x00);
+        const std::array<std::uint8_t, 32> lcd32{};
         sendLcdPayload(static_cast<DevicePtr>(this), _seq, lcd32);
         sendLcdEmptyFrame(static_cast<DevicePtr>(this), _seq);
         sendLcdEmptyFrame(static_cast<DevicePtr>(this), _seq);
@@ -176,20 +159,28 @@ void PAP3Device::runStartupSequence()
         if (out.changed[2]) qSetDimming(2, out.raw[2]);
     }
 
-    // 5) Inputs : callbacks + worker I/O
-    setupInputCallbacks();
-    if (!_ioRunning.load()) {
-        _ioRunning.store(true);
-        _ioThread = std::thread([this]{ this->ioThreadMain(); });
-    }
+    // 5) Inputs : layout du coalesceur + worker I/O
+    setupInputLayout();
+    IOWorker::getInstance()->add(_ioClient, [this]() {
+        return ioPass();
+    });
 
-    // 6) Attendre une 1re photo des switches (snapshot HID brut)
-    const bool gotSnapshot = waitForInitialSwitchSnapshot(std::chrono::milliseconds(1000));
-    if (!gotSnapshot) {
-    }
+    // 6) Pas d'attente du snapshot des switches : les rapports HID ne sont traités que dans
+    //    update() sur le thread principal, donc l'attente expirait toujours. Le premier rapport
+    //    reçu aligne le sim via _pendingInitialHardwareSync (voir didReceiveData).
 
-    // 7) Détecter + démarrer le profil
-    _profile = ProfileFactory::detect();
+    // 7) Le profil lit des datarefs : démarré par update(), voir startProfile()
+}
+
+void PAP3Device::startProfile()
+{
+    _profileStarted = true;
+
+    // Détecter + démarrer le profil
+    {
+        StartupPhase phase("PAP3 profile detection");
+        _profile = ProfileFactory::detect();
+    }
     if (_profile) {
         profileReady = true;
         _profile->attachDevice(this);
@@ -231,7 +222,7 @@ void PAP3Device::runStartupSequence()
 // Public helpers (transport delegates)
 // -----------------------------------------------------------------------------
 bool PAP3Device::lcdInit() { return sendLcdInit(static_cast<DevicePtr>(this), _seq); }
-bool PAP3Device::lcdSendPayload(const std::vector<std::uint8_t>& lcd32) {
+bool PAP3Device::lcdSendPayload(std::span<const std::uint8_t> lcd32) {
     return sendLcdPayload(static_cast<DevicePtr>(this), _seq, lcd32);
 }
 bool PAP3Device::lcdSendEmpty() { return sendLcdEmptyFrame(static_cast<DevicePtr>(this), _seq); }
@@ -248,70 +239,55 @@ void PAP3Device::setAtHardwareIntent(bool wantsOn) {
     }
 }
 
-void PAP3Device::didReceiveData(int /*reportId*/, std::uint8_t* report, int reportLength) {
-    onHidInputReport(report, reportLength);
-}
-
-void PAP3Device::onHidInputReport(const std::uint8_t* report, int len)
+void PAP3Device::didReceiveData(const InputFrame& frame)
 {
-    // 1) Capture one-shot du snapshot initial (brut)
-    if (!_haveInitialReport && report && len > 0) {
-        std::vector<std::uint8_t> freshSnapshot(report, report + len);
-        {
-            std::lock_guard<std::mutex> lk(_snapshotMx);
-            _initialReport = std::move(freshSnapshot);
-            _haveInitialReport = true;
-        }
-        _snapshotCv.notify_all();
+    if (frame.reportId != Inputs::kHeader || !frame.report) return;
+
+    // 1) Snapshot initial (brut) : le dernier rapport contient déjà les fronts de cette frame,
+    //    le sim est aligné dessus et les fronts ne sont pas rejoués.
+    if (!_haveInitialReport) {
+        _initialReport.assign(frame.report, frame.report + frame.reportLength);
+        _haveInitialReport = true;
         if (_pendingInitialHardwareSync && _profile) {
             _profile->syncSimToHardwareFromRaw(_initialReport.data(),
                                                static_cast<int>(_initialReport.size()));
             _pendingInitialHardwareSync = false;
             _didStartupSync = true;
         }
+    } else if (_profile) {
+        // 2) Fronts des boutons/switches, dans l'ordre d'arrivée
+        for (const auto& edge : frame.buttonEdges) {
+            const std::uint8_t off  = static_cast<std::uint8_t>(Inputs::kBtnStart + edge.index / 8);
+            const std::uint8_t mask = static_cast<std::uint8_t>(1u << (edge.index % 8));
+            _profile->onButton(off, mask, edge.pressed);
+        }
     }
 
-    // 2) Décodage normal (edges)
-    _inputs.decode(report, len);
+    // 3) Encodeurs : delta net de la frame, découpé pour tenir dans un int8
+    if (!_profile) return;
+    for (std::size_t i = 0; i < kEncDefs.size() && i < frame.encoderDeltas.size(); ++i) {
+        int remaining = frame.encoderDeltas[i];
+        while (remaining != 0) {
+            const int step = std::clamp(remaining, -127, 127);
+            _profile->onEncoderDelta(kEncDefs[i].posOff, static_cast<std::int8_t>(step));
+            remaining -= step;
+        }
+    }
 }
 
 // -----------------------------------------------------------------------------
 // Inputs wiring
 // -----------------------------------------------------------------------------
-void PAP3Device::setupInputCallbacks()
+void PAP3Device::setupInputLayout()
 {
-    _inputs.setWatchedSwitchOffsets({0x01, 0x02, 0x03, 0x04, 0x05, 0x06});
-    _inputs.setLightSensorOffset(0x14);
-
-    _inputs.onEncoders = [this](const Inputs::EncodersFrame& e) {
-        struct Item { std::int8_t d; std::uint8_t off; };
-        const Item items[] = {
-            {e.d_crsC, 0x15}, {e.d_spd , 0x17}, {e.d_hdg , 0x19},
-            {e.d_alt , 0x1B}, {e.d_vvi , 0x1D}, {e.d_crsF, 0x1F},
-        };
-
-        for (const auto& it : items) {
-            if (it.d == 0) continue;
-
-            if (const char* name = LookupEncoderName(it.off)) {
-            } else {
-            }
-
-            if (_profile) _profile->onEncoderDelta(it.off, it.d);
-        }
-    };
-
-    _inputs.onLightSensor = [](std::uint8_t /*lux*/) {};
-
-    _inputs.onSwitchEdges = [this](std::uint8_t off, std::uint8_t changedSet, std::uint8_t changedClr) {
-        auto forward = [this, off](uint8_t bit, bool pressed){
-            if (_profile) _profile->onButton(off, bit, pressed);
-        };
-        for (std::uint8_t m = 1; m; m <<= 1) {
-            if (changedSet & m)  forward(m, true);
-            if (changedClr & m)  forward(m, false);
-        }
-    };
+    InputLayout layout;
+    layout.reportId = Inputs::kHeader;
+    layout.minimumLength = Inputs::kInputBytes;
+    layout.buttonOffset = Inputs::kBtnStart;
+    layout.buttonBytes = Inputs::kBtnCount;
+    layout.firstReportPressesButtons = false;
+    for (const auto& e : kEncDefs) layout.encoderOffsets.push_back(e.posOff);
+    setInputLayout(layout);
 }
 
 // -----------------------------------------------------------------------------
@@ -474,8 +450,7 @@ void PAP3Device::applyState(const aircraft::State& st)
         }
     }
     
-    std::vector<std::uint8_t> lcd32(payload.begin(), payload.end());
-    qLcdPayload(lcd32);
+    qLcdPayload(payload);
 
     // Convert [0..1] -> [0..100]
     const auto clampPct = [](float v)->int{
@@ -532,23 +507,36 @@ void PAP3Device::applyState(const aircraft::State& st)
 // Periodic update
 // -----------------------------------------------------------------------------
 void PAP3Device::update() {
+    if (!_profileStarted && connected) startProfile();
     this->USBDevice::update();
     if (_profile) _profile->tick();
 }
 
+bool PAP3Device::allowsDormantMode() {
+    return true;
+}
+
+void PAP3Device::didEnterDormantMode() {
+    // The profile callback re-applies the full state on the first tick after waking up
+    allLedsOff();
+    qLcdPayload(std::array<uint8_t, 32>{});
+}
+
+void PAP3Device::reportMemoryUsage(MemoryUsage& usage) {
+    USBDevice::reportMemoryUsage(usage);
+
+    usage.deviceBuffers += _initialReport.capacity();
+
+    std::lock_guard<std::mutex> lk(_ioMx);
+    usage.queues += _ioQueue.size() * sizeof(IoCmd);
+}
+
 // -----------------------------------------------------------------------------
-// Worker loop
+// Passe I/O, exécutée par l'IOWorker partagé
 // -----------------------------------------------------------------------------
-void PAP3Device::ioThreadMain() {
-    uint32_t pendLedBitmap = _sentLedBitmap;
-    uint8_t  pendDim[3] = {_sentDimming[0], _sentDimming[1], _sentDimming[2]};
-    bool     pendSol = _sentSolenoid;
-    std::vector<uint8_t> pendLcd32 = _sentLcd32;
-
-    auto drainQueue = [&](){
+IOWorker::Clock::time_point PAP3Device::ioPass() {
+    {
         std::unique_lock<std::mutex> lk(_ioMx);
-        _ioCv.wait_for(lk, std::chrono::milliseconds(5), [&]{ return !_ioQueue.empty() || !_ioRunning.load(); });
-        if (!_ioRunning.load()) return;
         while(!_ioQueue.empty()) {
             IoCmd c = std::move(_ioQueue.front());
             _ioQueue.pop_front();
@@ -558,83 +546,76 @@ void PAP3Device::ioThreadMain() {
                 case IoCmd::SetLed: {
                     const uint8_t idx = (c.a >= 0x03) ? (c.a - 0x03) : 0;
                     const uint32_t bit = (1u << idx);
-                    if (c.b) pendLedBitmap |= bit; else pendLedBitmap &= ~bit;
+                    if (c.b) _pendLedBitmap |= bit; else _pendLedBitmap &= ~bit;
                 } break;
                 case IoCmd::SetDimming: {
-                    if (c.a < 3) pendDim[c.a] = c.b;
+                    if (c.a < 3) _pendDimming[c.a] = c.b;
                 } break;
                 case IoCmd::SetATSolenoid: {
-                    pendSol = (c.b != 0);
+                    _pendSolenoid = (c.b != 0);
                 } break;
                 case IoCmd::LcdPayload: {
-                    pendLcd32 = std::move(c.payload);
+                    _pendLcd32 = c.payload;
+                    _havePendLcd32 = true;
                 } break;
             }
 
             lk.lock();
         }
-    };
+    }
 
-    using clock = std::chrono::steady_clock;
-    auto lastLcdTx = clock::now();
-
-    while(_ioRunning.load()) {
-        drainQueue();
-        if (!_ioRunning.load()) break;
-
-        // 1) LEDs diffs
-        uint32_t diff = pendLedBitmap ^ _sentLedBitmap;
-        if (diff) {
-            for (uint8_t i = 0; i < 32; ++i) {
-                uint32_t bit = (1u << i);
-                if (diff & bit) {
-                    uint8_t ledId = 0x03 + i;
-                    bool on = (pendLedBitmap & bit) != 0;
-                    transport::sendLed(static_cast<transport::DevicePtr>(this), ledId, on);
-                }
+    // 1) LEDs diffs
+    uint32_t diff = _pendLedBitmap ^ _sentLedBitmap;
+    if (diff) {
+        for (uint8_t i = 0; i < 32; ++i) {
+            uint32_t bit = (1u << i);
+            if (diff & bit) {
+                uint8_t ledId = 0x03 + i;
+                bool on = (_pendLedBitmap & bit) != 0;
+                transport::sendLed(static_cast<transport::DevicePtr>(this), ledId, on);
             }
-            _sentLedBitmap = pendLedBitmap;
         }
+        _sentLedBitmap = _pendLedBitmap;
+    }
 
-        // 2) Dimming
-        for (uint8_t ch = 0; ch < 3; ++ch) {
-            if (_sentDimming[ch] != pendDim[ch]) {
-                transport::sendDimming(static_cast<transport::DevicePtr>(this), ch, pendDim[ch]);
-                _sentDimming[ch] = pendDim[ch];
-            }
+    // 2) Dimming
+    for (uint8_t ch = 0; ch < 3; ++ch) {
+        if (_sentDimming[ch] != _pendDimming[ch]) {
+            transport::sendDimming(static_cast<transport::DevicePtr>(this), ch, _pendDimming[ch]);
+            _sentDimming[ch] = _pendDimming[ch];
         }
+    }
 
-        // 3) Solenoid
-        if (_sentSolenoid != pendSol) {
-            transport::sendATSolenoid(static_cast<transport::DevicePtr>(this), pendSol);
-            _sentSolenoid = pendSol;
-        }
+    // 3) Solenoid
+    if (_sentSolenoid != _pendSolenoid) {
+        transport::sendATSolenoid(static_cast<transport::DevicePtr>(this), _pendSolenoid);
+        _sentSolenoid = _pendSolenoid;
+    }
 
-        // 4) LCD coalescing + rate-limit
-        const auto minPeriod = std::chrono::duration<double>(_minLcdPeriod);
-        const auto now = clock::now();
-        const bool timeOk = ((now - lastLcdTx) >= minPeriod);
-        const bool havePend = !pendLcd32.empty();
-        const bool changed = havePend && (pendLcd32 != _sentLcd32);
-
-        if (changed && timeOk) {
-            auto* dev = static_cast<transport::DevicePtr>(this);
-            transport::sendLcdPayload(dev, _seq, pendLcd32);
-            std::this_thread::sleep_for(std::chrono::milliseconds(2));
-            transport::sendLcdEmptyFrame(dev, _seq);
-            std::this_thread::sleep_for(std::chrono::milliseconds(2));
-            transport::sendLcdEmptyFrame(dev, _seq);
-            std::this_thread::sleep_for(std::chrono::milliseconds(2));
-            transport::sendLcdCommit(dev, _seq);
-
-            _sentLcd32 = pendLcd32;
-            lastLcdTx = now;
-        } else if (!changed && havePend) {
-            // debug_force("[PAP3][LCD] I/O Thread: LCD unchanged, skipping\n");
-        } else if (!timeOk) {
-            // debug_force("[PAP3][LCD] I/O Thread: Rate limited, skipping\n");
-        }
+    // 4) LCD coalescing + rate-limit : une trame trop proche de la précédente attend
+    //    la fin de la période au lieu d'être réveillée toutes les 5 ms
+    const bool changed = _havePendLcd32 && (!_haveSentLcd32 || _pendLcd32 != _sentLcd32);
+    if (!changed) {
+        return IOWorker::Clock::time_point::max();
     }
+
+    const auto minPeriod = std::chrono::duration_cast<IOWorker::Clock::duration>(std::chrono::duration<double>(_minLcdPeriod));
+    const auto now = IOWorker::Clock::now();
+    if (now - _lastLcdTx < minPeriod) {
+        return _lastLcdTx + minPeriod;
+    }
+
+    auto* dev = static_cast<transport::DevicePtr>(this);
+    // L'espacement de 2 ms entre trames est assuré par le budget de sortie (ctor)
+    transport::sendLcdPayload(dev, _seq, _pendLcd32);
+    transport::sendLcdEmptyFrame(dev, _seq);
+    transport::sendLcdEmptyFrame(dev, _seq);
+    transport::sendLcdCommit(dev, _seq);
+
+    _sentLcd32 = _pendLcd32;
+    _haveSentLcd32 = true;
+    _lastLcdTx = now;
+    return IOWorker::Clock::time_point::max();
 }
 
 } // namespace pap3::device
\ No newline at end of file
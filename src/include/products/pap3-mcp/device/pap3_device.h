@@ -1,14 +1,13 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <span>
 #include <string>
 #include <vector>
 #include <memory>
-#include <thread>
 #include <deque>
 #include <mutex>
-#include <condition_variable>
-#include <atomic>
 #include <unordered_map>
 
 #include <XPLMProcessing.h>
@@ -16,6 +15,7 @@
 
 #include "inputs.h"
 #include "illumination.h"
+#include "ioworker.h"
 #include "transport.h" // for transport::DevicePtr
 #include "usbdevice.h" // base
 
@@ -39,7 +39,7 @@ public:
 
     // LCD ops
     bool lcdInit();
-    bool lcdSendPayload(const std::vector<std::uint8_t>& lcd32);
+    bool lcdSendPayload(std::span<const std::uint8_t> lcd32);
     bool lcdSendEmpty();
     bool lcdCommit();
 
@@ -53,10 +53,12 @@ public:
     std::uint8_t currentSeq() const noexcept { return _seq; }
 
     void update() override;
+    bool allowsDormantMode() override;
+    void didEnterDormantMode() override;
+    void reportMemoryUsage(MemoryUsage& usage) override;
 
-    // Optional entry if a lower layer receives HID reports
-    void onHidInputReport(const uint8_t* report, int len);
-    void didReceiveData(int reportId, uint8_t* report, int reportLength) override;
+    // Input reports coalesced per frame by USBDevice
+    void didReceiveData(const InputFrame& frame) override;
 
     // One-shot solenoid pulse: OFF now, ON after delay
     void pulseATSolenoid(unsigned millis = 50);
@@ -65,16 +67,17 @@ private:
     // Writer bridge
     void ensureWriterInstalled() const;
 
-    // Boot
+    // Boot : le matériel à la construction (éventuellement hors thread principal),
+    // le profil au premier update() sur le thread principal
     void runStartupSequence();
+    void startProfile();
     void allLedsOff();
 
     // Illumination & power
     void updatePower();
 
     // Inputs wiring
-    void setupInputCallbacks();
-    bool waitForInitialSwitchSnapshot(std::chrono::milliseconds timeout);
+    void setupInputLayout();
 
     // Worker queue
     struct IoCmd {
@@ -86,13 +89,13 @@ private:
         } type;
         uint8_t a = 0;
         uint8_t b = 0;
-        std::vector<uint8_t> payload;
+        std::array<uint8_t, 32> payload{};
     };
-    void ioThreadMain();
+    IOWorker::Clock::time_point ioPass();
 
     inline void qEnqueue(IoCmd&& c) {
         { std::lock_guard<std::mutex> lk(_ioMx); _ioQueue.emplace_back(std::move(c)); }
-        _ioCv.notify_one();
+        IOWorker::getInstance()->wake(_ioClient);
     }
     inline void qSetLed(uint8_t ledId, bool on) {
         IoCmd c; c.type = IoCmd::SetLed; c.a = ledId; c.b = on ? 1 : 0; qEnqueue(std::move(c));
@@ -103,7 +106,7 @@ private:
     inline void qSetSolenoid(bool on) {
         IoCmd c; c.type = IoCmd::SetATSolenoid; c.b = on ? 1 : 0; qEnqueue(std::move(c));
     }
-    inline void qLcdPayload(const std::vector<uint8_t>& lcd32) {
+    inline void qLcdPayload(const std::array<uint8_t, 32>& lcd32) {
         IoCmd c; c.type = IoCmd::LcdPayload; c.payload = lcd32; qEnqueue(std::move(c));
     }
 
@@ -118,32 +121,35 @@ private:
 
     // Profile bridge
     std::unique_ptr<pap3::aircraft::PAP3AircraftProfile> _profile;
-
-    // Input decoding
-    pap3::device::Inputs _inputs;
+    bool _profileStarted{false};
 
     // Snapshot boot
-    std::mutex _snapshotMx;
-    std::condition_variable _snapshotCv;
     std::vector<std::uint8_t> _initialReport;
     bool _haveInitialReport{false};
     bool _didStartupSync{false};
     bool _pendingInitialHardwareSync{false};
 
-    // I/O worker
-    std::thread              _ioThread;
-    std::atomic<bool>        _ioRunning{false};
+    // I/O worker (passes sur le worker partagé)
+    IOWorker::Client         _ioClient;
     std::mutex               _ioMx;
-    std::condition_variable  _ioCv;
     std::deque<IoCmd>        _ioQueue;
 
+    // État voulu, accumulé par les passes I/O (alignés sur les valeurs _sent* initiales)
+    uint32_t                 _pendLedBitmap = 0xFFFFFFFF;
+    uint8_t                  _pendDimming[3] = {255,255,255};
+    bool                     _pendSolenoid = false;
+    std::array<uint8_t, 32>  _pendLcd32{};
+    bool                     _havePendLcd32 = false;
+    IOWorker::Clock::time_point _lastLcdTx{};
+
     // Coalescing state actually sent to device
     // Initialize _sentLedBitmap to all-1s so that initial LED commands are actually sent
     // (otherwise allLedsOff() during startup won't send anything because diff is 0)
     uint32_t                 _sentLedBitmap = 0xFFFFFFFF;
     uint8_t                  _sentDimming[3] = {255,255,255};
     bool                     _sentSolenoid = false;
-    std::vector<uint8_t>     _sentLcd32;
+    std::array<uint8_t, 32>  _sentLcd32{};
+    bool                     _haveSentLcd32 = false;
 
     // LCD rate-limit
     float                    _minLcdPeriod = 1.f / 25.f; // ~25 Hz
@@ -50,8 +50,11 @@ static inline void bumpSeq(uint8_t& seq) noexcept
 bool writerUsbWriteData(DevicePtr dev, const uint8_t* data, std::size_t len)
 {
     if (!dev || !data || len == 0) return false;
-    std::vector<uint8_t> buffer(data, data + len);
-    return dev->writeData(std::move(buffer));
+
+    // Everything goes out in the order it was queued, on the ordered control lane: the LCD
+    // payload, empty frames and commit share sequence numbers and must not be split by LED
+    // or dimming frames, and the startup sequence relies on its order too.
+    return dev->writeData(std::span<const uint8_t>(data, len));
 }
 
 void setWriter(WriterFn fn) { s_writer = fn; }
@@ -216,7 +219,7 @@ inline void writePayloadPreamble(uint8_t* b)
     std::memcpy(b + HDR_NEXT, kPayloadPreamble, sizeof(kPayloadPreamble));
 }
 
-inline void writePayloadBytes(uint8_t* b, const std::vector<uint8_t>& payload)
+inline void writePayloadBytes(uint8_t* b, std::span<const uint8_t> payload)
 {
     const auto n = std::min(payload.size(), kPayloadMax);
     if (n > 0) {
@@ -236,7 +239,7 @@ inline void writeInitTail(uint8_t* b)
 ///   Common header
 ///   Payload preamble at 0x04
 ///   User data bytes at 0x19..0x38
-bool sendLcdPayload(DevicePtr dev, uint8_t& seq, const std::vector<uint8_t>& payload)
+bool sendLcdPayload(DevicePtr dev, uint8_t& seq, std::span<const uint8_t> payload)
 {
     if (!haveWriter()) return false;
 
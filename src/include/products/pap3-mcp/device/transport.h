@@ -3,7 +3,7 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <vector>
+#include <span>
 
 /*
     Transport layer for PAP3 MCP.
@@ -36,7 +36,7 @@ using WriterFn = bool(*)(DevicePtr, const uint8_t*, std::size_t);
 // Install the concrete writer (call once after the HID device is opened).
 void setWriter(WriterFn fn);
 
-// Default writer for macOS HID: prefixes Report ID (0x00 by default) and calls USBDevice::writeData(std::vector<uint8_t>).
+// Default writer for macOS HID: prefixes Report ID (0x00 by default) and calls USBDevice::writeData(std::span<const uint8_t>).
 bool writerUsbWriteData(DevicePtr dev, const uint8_t* data, std::size_t len);
 
 // -----------------------------------------------------------------------------
@@ -56,7 +56,7 @@ bool sendLed(DevicePtr dev, uint8_t ledId, bool on);
 // - Fixed preamble at [0x04..]
 // - 32-byte user payload copied to [0x19..0x38] inclusive
 // On success, increments 'seq' (kept non-zero).
-bool sendLcdPayload(DevicePtr dev, uint8_t& seq, const std::vector<uint8_t>& payloadAfter0x19);
+bool sendLcdPayload(DevicePtr dev, uint8_t& seq, std::span<const uint8_t> payloadAfter0x19);
 
 // LCD "empty" frame (opcode 0x38) with zeros after common header.
 // On success, increments 'seq'.
@@ -75,12 +75,26 @@ void ProductUrsaMinorJoystick::update() {
     }
 }
 
+bool ProductUrsaMinorJoystick::allowsDormantMode() {
+    return true;
+}
+
+void ProductUrsaMinorJoystick::didEnterDormantMode() {
+    if (lastVibration > 0) {
+        lastVibration = 0;
+        setVibration(0);
+    }
+}
+
 bool ProductUrsaMinorJoystick::setVibration(uint8_t vibration) {
-    return writeData({0x02, 7, 191, 0, 0, 3, 0x49, 0, vibration, 0, 0, 0, 0, 0});
+    // Only the newest level matters, a queued one is replaced
+    auto report = SetValueReport(0x07, 0xBF, 0, vibration);
+    return queueOutput(OutputLane::Haptics, 1, std::span<const uint8_t>(report));
 }
 
 bool ProductUrsaMinorJoystick::setLedBrightness(uint8_t brightness) {
-    return writeData({0x02, 0x20, 0xbb, 0, 0, 3, 0x49, 0, brightness, 0, 0, 0, 0, 0});
+    auto report = SetValueReport(0x20, 0xbb, 0, brightness);
+    return queueOutput(OutputLane::Brightness, 1, std::span<const uint8_t>(report));
 }
 
 void ProductUrsaMinorJoystick::initializeDatarefs() {
@@ -17,6 +17,8 @@ class ProductUrsaMinorJoystick : public USBDevice {
         bool connect() override;
         void disconnect() override;
         void update() override;
+        bool allowsDormantMode() override;
+        void didEnterDormantMode() override;
 
         bool setVibration(uint8_t vibration);
         bool setLedBrightness(uint8_t brightness);
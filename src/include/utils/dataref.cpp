@@ -271,6 +271,31 @@ void Dataref::clearCache() {
     cachedValues.clear();
 }
 
+size_t Dataref::cacheMemoryFootprint() {
+    // Rough per-node overhead of the unordered_map, on top of key and value.
+    constexpr size_t nodeOverhead = 2 * sizeof(void *);
+
+    size_t bytes = 0;
+    for (auto &[key, data] : cachedValues) {
+        bytes += nodeOverhead + sizeof(data) + key.capacity();
+        std::visit([&](auto &&value) {
+            using T = std::decay_t<decltype(value)>;
+            if constexpr (std::is_same_v<T, std::string>) {
+                bytes += value.capacity();
+            } else if constexpr (std::is_same_v<T, std::vector<int>> || std::is_same_v<T, std::vector<float>> || std::is_same_v<T, std::vector<unsigned char>>) {
+                bytes += value.capacity() * sizeof(value[0]);
+            }
+        },
+                   data.value);
+    }
+
+    for (auto &[key, ref] : refs) {
+        bytes += nodeOverhead + sizeof(ref) + key.capacity();
+    }
+
+    return bytes;
+}
+
 void Dataref::update() {
     for (auto &[key, data] : cachedValues) {
         std::visit([&](auto &&value) {
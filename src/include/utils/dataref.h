@@ -70,6 +70,7 @@ class Dataref {
         void executeCommand(const char *command, XPLMCommandPhase phase = -1);
 
         void clearCache();
+        size_t cacheMemoryFootprint();
 };
 
 #endif
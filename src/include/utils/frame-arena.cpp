@@ -0,0 +1,70 @@
+#include "frame-arena.h"
+
+#include <algorithm>
+#include <new>
+
+FrameArena::FrameArena(size_t capacity) :
+    capacity(capacity) {
+    buffer = static_cast<unsigned char *>(::operator new(capacity));
+    offset = 0;
+    highWaterMark = 0;
+    heapFallbacks = 0;
+}
+
+FrameArena::~FrameArena() {
+    ::operator delete(buffer);
+}
+
+FrameArena *FrameArena::forCurrentThread() {
+    thread_local FrameArena arena;
+    return &arena;
+}
+
+void *FrameArena::allocate(size_t bytes, size_t alignment) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(buffer);
+    uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t) (alignment - 1);
+    size_t end = (aligned - base) + bytes;
+
+    if (end > capacity) {
+        heapFallbacks++;
+        return ::operator new(bytes);
+    }
+
+    offset = end;
+    highWaterMark = std::max(highWaterMark, offset);
+    return reinterpret_cast<void *>(aligned);
+}
+
+void FrameArena::deallocate(void *pointer, size_t bytes) {
+    if (!owns(pointer)) {
+        ::operator delete(pointer);
+        return;
+    }
+
+    // Give the block back if it is the most recent one, so short-lived temporaries released
+    // in reverse order do not eat into the frame budget.
+    if (static_cast<unsigned char *>(pointer) + bytes == buffer + offset) {
+        offset -= bytes;
+    }
+}
+
+bool FrameArena::owns(const void *pointer) const {
+    auto *p = static_cast<const unsigned char *>(pointer);
+    return p >= buffer && p < buffer + capacity;
+}
+
+void FrameArena::reset() {
+    offset = 0;
+}
+
+size_t FrameArena::bytesInUse() const {
+    return offset;
+}
+
+size_t FrameArena::peakBytesInUse() const {
+    return highWaterMark;
+}
+
+uint64_t FrameArena::heapFallbackCount() const {
+    return heapFallbacks;
+}
@@ -0,0 +1,74 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Monotonic scratch memory for buffers that only live for one frame (main thread) or one
+// loop iteration (I/O threads). Every thread gets its own arena through forCurrentThread(),
+// so no locking is involved. Requests that do not fit fall back to the heap and are counted.
+class FrameArena {
+    private:
+        static constexpr size_t DefaultCapacity = 64 * 1024;
+
+        unsigned char *buffer;
+        size_t capacity;
+        size_t offset;
+        size_t highWaterMark;
+        uint64_t heapFallbacks;
+
+    public:
+        explicit FrameArena(size_t capacity = DefaultCapacity);
+        ~FrameArena();
+        FrameArena(const FrameArena &) = delete;
+        FrameArena &operator=(const FrameArena &) = delete;
+
+        static FrameArena *forCurrentThread();
+
+        void *allocate(size_t bytes, size_t alignment);
+        void deallocate(void *pointer, size_t bytes);
+        bool owns(const void *pointer) const;
+
+        // Releases everything allocated since the last reset. Containers using the arena must
+        // not outlive this call.
+        void reset();
+
+        size_t bytesInUse() const;
+        size_t peakBytesInUse() const;
+        uint64_t heapFallbackCount() const;
+};
+
+template<typename T>
+class FrameAllocator {
+    public:
+        using value_type = T;
+
+        FrameArena *arena;
+
+        FrameAllocator() noexcept :
+            arena(FrameArena::forCurrentThread()) {}
+        explicit FrameAllocator(FrameArena *arena) noexcept :
+            arena(arena) {}
+        template<typename U>
+        FrameAllocator(const FrameAllocator<U> &other) noexcept :
+            arena(other.arena) {}
+
+        T *allocate(size_t count) {
+            return static_cast<T *>(arena->allocate(count * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *pointer, size_t count) noexcept {
+            arena->deallocate(pointer, count * sizeof(T));
+        }
+
+        template<typename U>
+        bool operator==(const FrameAllocator<U> &other) const noexcept {
+            return arena == other.arena;
+        }
+};
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+#endif
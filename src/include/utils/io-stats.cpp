@@ -0,0 +1,302 @@
+#include "io-stats.h"
+
+#include "config.h"
+#include "usbcontroller.h"
+#include "usbdevice.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <XPLMGraphics.h>
+
+#if LIN
+#include "hidreactor.h"
+#endif
+
+struct IOStatsIntField {
+        const char *name;
+        int IODeviceSample::*field;
+};
+
+struct IOStatsFloatField {
+        const char *name;
+        float IODeviceSample::*field;
+};
+
+struct IOStatsReaderField {
+        const char *name;
+        float IOReaderSample::*field;
+};
+
+static const IOStatsIntField IntFields[] = {
+    {"winwing/usb/product_id", &IODeviceSample::productId},
+    {"winwing/usb/input_reports_dropped", &IODeviceSample::inputReportsDropped},
+    {"winwing/usb/input_reports_suppressed", &IODeviceSample::inputReportsSuppressed},
+    {"winwing/usb/output_queue_high_water", &IODeviceSample::outputQueueHighWater},
+    {"winwing/usb/output_messages_dropped", &IODeviceSample::outputMessagesDropped},
+    {"winwing/usb/output_messages_coalesced", &IODeviceSample::outputMessagesCoalesced},
+    {"winwing/usb/output_messages_deduplicated", &IODeviceSample::outputMessagesDeduplicated},
+    {"winwing/usb/output_writes_failed", &IODeviceSample::outputWritesFailed},
+    {"winwing/usb/output_short_writes", &IODeviceSample::outputShortWrites},
+    {"winwing/usb/output_writes_would_block", &IODeviceSample::outputWritesWouldBlock},
+    {"winwing/usb/output_write_calls", &IODeviceSample::outputWriteCalls},
+    {"winwing/usb/reconnects", &IODeviceSample::reconnects},
+};
+
+static const IOStatsFloatField FloatFields[] = {
+    {"winwing/usb/input_reports_per_second", &IODeviceSample::inputReportsPerSecond},
+    {"winwing/usb/output_writes_per_second", &IODeviceSample::outputWritesPerSecond},
+    {"winwing/usb/output_bytes_per_second", &IODeviceSample::outputBytesPerSecond},
+};
+
+// Close to one wakeup per dispatch means the reader only runs for reports
+static const IOStatsReaderField ReaderFields[] = {
+    {"winwing/usb/reader_wakeups_per_second", &IOReaderSample::wakeupsPerSecond},
+    {"winwing/usb/reader_dispatches_per_second", &IOReaderSample::dispatchesPerSecond},
+};
+
+// Fills values[0..max) from the element at offset on; without values, returns the length
+template <typename T, typename Value>
+static int CopyElements(int count, T *values, int offset, int max, Value value) {
+    if (!values) {
+        return count;
+    }
+
+    int copied = 0;
+    for (int i = std::max(offset, 0); i < count && copied < max; ++i) {
+        values[copied++] = value(i);
+    }
+    return copied;
+}
+
+static int ReadIntArray(void *refcon, int *values, int offset, int max) {
+    int IODeviceSample::*field = static_cast<const IOStatsIntField *>(refcon)->field;
+    const auto &samples = IOStats::getInstance()->sample();
+    return CopyElements((int) samples.size(), values, offset, max, [&](int i) {
+        return samples[i].*field;
+    });
+}
+
+static int ReadFloatArray(void *refcon, float *values, int offset, int max) {
+    float IODeviceSample::*field = static_cast<const IOStatsFloatField *>(refcon)->field;
+    const auto &samples = IOStats::getInstance()->sample();
+    return CopyElements((int) samples.size(), values, offset, max, [&](int i) {
+        return samples[i].*field;
+    });
+}
+
+static float ReadReaderRate(void *refcon) {
+    float IOReaderSample::*field = static_cast<const IOStatsReaderField *>(refcon)->field;
+    return IOStats::getInstance()->readerSample().*field;
+}
+
+// OutputWriteLatencyBuckets elements per device, in the order of winwing/usb/product_id
+static int ReadWriteLatency(void *refcon, int *values, int offset, int max) {
+    const auto &samples = IOStats::getInstance()->sample();
+    return CopyElements((int) (samples.size() * OutputWriteLatencyBuckets), values, offset, max, [&](int i) {
+        return samples[i / OutputWriteLatencyBuckets].writeLatency[i % OutputWriteLatencyBuckets];
+    });
+}
+
+static int ClampCount(uint64_t count) {
+    return (int) std::min<uint64_t>(count, INT_MAX);
+}
+
+IOStats::IOStats() {
+}
+
+IOStats::~IOStats() {
+}
+
+IOStats *IOStats::getInstance() {
+    static IOStats instance;
+    return &instance;
+}
+
+void IOStats::registerDatarefs() {
+    for (const auto &field : IntFields) {
+        datarefs.push_back(XPLMRegisterDataAccessor(field.name, xplmType_IntArray, 0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, ReadIntArray, nullptr, nullptr, nullptr, nullptr, nullptr, (void *) &field, nullptr));
+    }
+    for (const auto &field : FloatFields) {
+        datarefs.push_back(XPLMRegisterDataAccessor(field.name, xplmType_FloatArray, 0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, ReadFloatArray, nullptr, nullptr, nullptr, (void *) &field, nullptr));
+    }
+    for (const auto &field : ReaderFields) {
+        datarefs.push_back(XPLMRegisterDataAccessor(field.name, xplmType_Float, 0, nullptr, nullptr, ReadReaderRate, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, (void *) &field, nullptr));
+    }
+    datarefs.push_back(XPLMRegisterDataAccessor("winwing/usb/write_latency_histogram", xplmType_IntArray, 0, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, ReadWriteLatency, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr));
+}
+
+void IOStats::destroy() {
+    for (auto dataref : datarefs) {
+        XPLMUnregisterDataAccessor(dataref);
+    }
+    datarefs.clear();
+
+    if (window) {
+        XPLMDestroyWindow(window);
+        window = nullptr;
+    }
+    samples.clear();
+    reader = {};
+    sampledAt = {};
+}
+
+const std::vector<IODeviceSample> &IOStats::sample() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - sampledAt < std::chrono::seconds(IO_STATS_SAMPLE_INTERVAL_SECONDS)) {
+        return samples;
+    }
+
+    bool hasPrevious = sampledAt != std::chrono::steady_clock::time_point{};
+    float elapsed = std::chrono::duration<float>(now - sampledAt).count();
+    sampledAt = now;
+
+#if LIN
+    IOReaderSample readerBefore = reader;
+    reader.wakeups = HIDReactor::getInstance()->wakeupCount();
+    reader.dispatches = HIDReactor::getInstance()->dispatchCount();
+    if (hasPrevious && elapsed > 0) {
+        reader.wakeupsPerSecond = (reader.wakeups - readerBefore.wakeups) / elapsed;
+        reader.dispatchesPerSecond = (reader.dispatches - readerBefore.dispatches) / elapsed;
+    }
+#endif
+
+    std::vector<IODeviceSample> previous = std::move(samples);
+    samples.clear();
+    for (auto *device : USBController::getInstance()->devices) {
+        const OutputQueueStats &output = device->outputStats();
+        IODeviceSample sample;
+        sample.device = device;
+        sample.name = device->classIdentifier();
+        sample.productId = device->productId;
+        sample.inputReports = device->stats.reportsReceived.load(std::memory_order_relaxed);
+        sample.outputReports = output.reportsWritten.load(std::memory_order_relaxed);
+        sample.outputBytes = output.bytesWritten.load(std::memory_order_relaxed);
+        sample.inputReportsDropped = ClampCount(device->droppedInputReports());
+        sample.inputReportsSuppressed = ClampCount(device->stats.reportsSuppressed.load(std::memory_order_relaxed));
+        sample.outputQueueHighWater = ClampCount(output.depthHighWater.load(std::memory_order_relaxed));
+        sample.outputMessagesDropped = ClampCount(output.messagesDropped.load(std::memory_order_relaxed));
+        sample.outputMessagesCoalesced = ClampCount(output.messagesCoalesced.load(std::memory_order_relaxed));
+        sample.outputMessagesDeduplicated = ClampCount(output.messagesDeduplicated.load(std::memory_order_relaxed));
+        sample.outputWritesFailed = ClampCount(output.reportsFailed.load(std::memory_order_relaxed));
+        sample.outputShortWrites = ClampCount(device->stats.shortWrites.load(std::memory_order_relaxed));
+        sample.outputWritesWouldBlock = ClampCount(device->stats.writesWouldBlock.load(std::memory_order_relaxed));
+        sample.outputWriteCalls = ClampCount(device->stats.writeCalls.load(std::memory_order_relaxed));
+        sample.reconnects = ClampCount(device->stats.reconnects.load(std::memory_order_relaxed));
+        for (size_t bucket = 0; bucket < OutputWriteLatencyBuckets; ++bucket) {
+            sample.writeLatency[bucket] = ClampCount(output.writeLatency[bucket].load(std::memory_order_relaxed));
+        }
+
+        // A device object freed and another allocated at its address starts over from zero
+        auto before = std::find_if(previous.begin(), previous.end(), [&](const IODeviceSample &candidate) {
+            return candidate.device == device;
+        });
+        if (hasPrevious && elapsed > 0 && before != previous.end() && sample.inputReports >= before->inputReports && sample.outputReports >= before->outputReports) {
+            sample.inputReportsPerSecond = (sample.inputReports - before->inputReports) / elapsed;
+            sample.outputWritesPerSecond = (sample.outputReports - before->outputReports) / elapsed;
+            sample.outputBytesPerSecond = (sample.outputBytes - before->outputBytes) / elapsed;
+        }
+
+        samples.push_back(sample);
+    }
+
+    return samples;
+}
+
+const IOReaderSample &IOStats::readerSample() {
+    sample();
+    return reader;
+}
+
+void IOStats::toggleWindow() {
+    if (window) {
+        XPLMSetWindowIsVisible(window, !XPLMGetWindowIsVisible(window));
+        return;
+    }
+
+    int left, top, right, bottom;
+    XPLMGetScreenBoundsGlobal(&left, &top, &right, &bottom);
+
+    XPLMCreateWindow_t params = {};
+    params.structSize = sizeof(params);
+    params.left = left + 50;
+    params.top = top - 150;
+    params.right = left + 50 + 620;
+    params.bottom = top - 150 - 420;
+    params.visible = 1;
+    params.drawWindowFunc = [](XPLMWindowID window, void *refcon) {
+        static_cast<IOStats *>(refcon)->drawWindow();
+    };
+    params.handleMouseClickFunc = [](XPLMWindowID window, int x, int y, XPLMMouseStatus status, void *refcon) {
+        return 1;
+    };
+    params.handleRightClickFunc = params.handleMouseClickFunc;
+    params.handleKeyFunc = [](XPLMWindowID window, char key, XPLMKeyFlags flags, char virtualKey, void *refcon, int losingFocus) {
+    };
+    params.handleCursorFunc = [](XPLMWindowID window, int x, int y, void *refcon) -> XPLMCursorStatus {
+        return xplm_CursorDefault;
+    };
+    params.handleMouseWheelFunc = [](XPLMWindowID window, int x, int y, int wheel, int clicks, void *refcon) {
+        return 0;
+    };
+    params.refcon = this;
+    params.decorateAsFloatingWindow = xplm_WindowDecorationRoundRectangle;
+    params.layer = xplm_WindowLayerFloatingWindows;
+
+    window = XPLMCreateWindowEx(&params);
+    XPLMSetWindowTitle(window, FRIENDLY_NAME " USB statistics");
+}
+
+void IOStats::drawWindow() {
+    int left, top, right, bottom;
+    XPLMGetWindowGeometry(window, &left, &top, &right, &bottom);
+
+    float color[] = {1.0f, 1.0f, 1.0f};
+    char line[256];
+    int y = top - 20;
+    auto drawLine = [&](int indent) {
+        XPLMDrawString(color, left + 10 + indent, y, line, nullptr, xplmFont_Proportional);
+        y -= 14;
+    };
+
+    const auto &devices = sample();
+#if LIN
+    snprintf(line, sizeof(line), "Reader thread: %.0f wakeups/s, %.0f dispatches/s", reader.wakeupsPerSecond, reader.dispatchesPerSecond);
+    drawLine(0);
+    y -= 7;
+#endif
+    if (devices.empty()) {
+        snprintf(line, sizeof(line), "No devices connected");
+        drawLine(0);
+        return;
+    }
+
+    for (const auto &device : devices) {
+        snprintf(line, sizeof(line), "%s (%04x), reconnected %d times", device.name, device.productId, device.reconnects);
+        drawLine(0);
+        snprintf(line, sizeof(line), "In: %.0f reports/s, %d dropped, %d suppressed", device.inputReportsPerSecond, device.inputReportsDropped, device.inputReportsSuppressed);
+        drawLine(10);
+        snprintf(line, sizeof(line), "Out: %.0f writes/s, %.1f kB/s, queue peak %d, %d dropped, %d failed, %d short, %d EAGAIN", device.outputWritesPerSecond, device.outputBytesPerSecond / 1000.0f, device.outputQueueHighWater, device.outputMessagesDropped, device.outputWritesFailed, device.outputShortWrites, device.outputWritesWouldBlock);
+        drawLine(10);
+        snprintf(line, sizeof(line), "Not written: %d replaced by newer values, %d unchanged", device.outputMessagesCoalesced, device.outputMessagesDeduplicated);
+        drawLine(10);
+
+        size_t length = snprintf(line, sizeof(line), "Write latency:");
+        for (size_t bucket = 0; bucket < OutputWriteLatencyBuckets && length < sizeof(line); ++bucket) {
+            if (!device.writeLatency[bucket]) {
+                continue;
+            }
+
+            int bound = 64 << bucket;
+            if (bucket + 1 == OutputWriteLatencyBuckets) {
+                length += snprintf(line + length, sizeof(line) - length, "  slower %d", device.writeLatency[bucket]);
+            } else if (bound < 1000) {
+                length += snprintf(line + length, sizeof(line) - length, "  <%dus %d", bound, device.writeLatency[bucket]);
+            } else {
+                length += snprintf(line + length, sizeof(line) - length, "  <%.0fms %d", bound / 1000.0f, device.writeLatency[bucket]);
+            }
+        }
+        drawLine(10);
+        y -= 7;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include "outputqueue.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <XPLMDataAccess.h>
+#include <XPLMDisplay.h>
+
+class USBDevice;
+
+// One device's counters as of the last sample; rates are averaged since the sample before
+struct IODeviceSample {
+        const USBDevice *device = nullptr;
+        const char *name = "";
+        int productId = 0;
+        uint64_t inputReports = 0;
+        uint64_t outputReports = 0;
+        uint64_t outputBytes = 0;
+        float inputReportsPerSecond = 0;
+        float outputWritesPerSecond = 0;
+        float outputBytesPerSecond = 0;
+        int inputReportsDropped = 0;
+        int inputReportsSuppressed = 0;
+        int outputQueueHighWater = 0;
+        int outputMessagesDropped = 0;
+        int outputMessagesCoalesced = 0;    // Replaced by a newer one for the same target
+        int outputMessagesDeduplicated = 0; // Matched what the device shows already
+        int outputWritesFailed = 0;
+        int outputShortWrites = 0;
+        int outputWritesWouldBlock = 0;
+        int outputWriteCalls = 0;
+        int reconnects = 0;
+        std::array<int, OutputWriteLatencyBuckets> writeLatency{};
+};
+
+// The reader thread shared by all devices (HIDReactor, Linux only)
+struct IOReaderSample {
+        uint64_t wakeups = 0;
+        uint64_t dispatches = 0;
+        float wakeupsPerSecond = 0;
+        float dispatchesPerSecond = 0;
+};
+
+// Publishes the devices' I/O counters through the winwing/usb/* array datarefs, one element
+// per device in the order of winwing/usb/product_id, and the "USB statistics" window. The
+// devices count with relaxed atomics; sampling only happens when a dataref or the open
+// window is read, at most once per IO_STATS_SAMPLE_INTERVAL_SECONDS. The reader thread's
+// rates are plain winwing/usb/reader_* datarefs.
+class IOStats {
+    private:
+        IOStats();
+        ~IOStats();
+
+        std::vector<IODeviceSample> samples;
+        IOReaderSample reader;
+        std::chrono::steady_clock::time_point sampledAt{};
+        std::vector<XPLMDataRef> datarefs;
+        XPLMWindowID window = nullptr;
+
+        void drawWindow();
+
+    public:
+        static IOStats *getInstance();
+
+        void registerDatarefs();
+        // Unregisters the datarefs and closes the window
+        void destroy();
+
+        // Main thread
+        const std::vector<IODeviceSample> &sample();
+        const IOReaderSample &readerSample();
+        void toggleWindow();
+};
+
+#endif
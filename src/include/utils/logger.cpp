@@ -0,0 +1,104 @@
+#include "logger.h"
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <XPLMUtilities.h>
+
+bool LogThrottle::allow(int intervalMilliseconds, uint32_t &suppressedCount) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t allowedAt = nextAllowedAt.load(std::memory_order_relaxed);
+
+    if (now < allowedAt || !nextAllowedAt.compare_exchange_strong(allowedAt, now + intervalMilliseconds, std::memory_order_relaxed)) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    suppressedCount = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+Logger::Logger() {
+    for (size_t i = 0; i < Capacity; ++i) {
+        records[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    enqueuePosition.store(0, std::memory_order_relaxed);
+    dequeuePosition = 0;
+    droppedRecords.store(0, std::memory_order_relaxed);
+}
+
+Logger::~Logger() {
+}
+
+Logger *Logger::getInstance() {
+    static Logger instance;
+    return &instance;
+}
+
+Logger::Record *Logger::claim(size_t &position) {
+    position = enqueuePosition.load(std::memory_order_relaxed);
+
+    while (true) {
+        Record *record = &records[position & (Capacity - 1)];
+        size_t sequence = record->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                return record;
+            }
+        } else if (difference < 0) {
+            return nullptr;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::log(bool forwardToSimulator, const char *format, ...) {
+    size_t position;
+    Record *record = claim(position);
+    if (!record) {
+        droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->text, RecordLength, format, args);
+    va_end(args);
+
+    record->forwardToSimulator = forwardToSimulator;
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+size_t Logger::memoryFootprint() const {
+    return sizeof(records);
+}
+
+void Logger::drain() {
+    while (true) {
+        Record *record = &records[dequeuePosition & (Capacity - 1)];
+        if (record->sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+            break;
+        }
+
+        if (record->forwardToSimulator) {
+            XPLMDebugString(record->text);
+        }
+#if DEBUG
+        printf("%s", record->text);
+#endif
+
+        record->sequence.store(dequeuePosition + Capacity, std::memory_order_release);
+        dequeuePosition++;
+    }
+
+    uint32_t dropped = droppedRecords.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "[Winwing] Log buffer full, dropped %u messages\n", dropped);
+        XPLMDebugString(buffer);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOGGER_PRINTF_FORMAT(formatIndex, argsIndex) __attribute__((format(printf, formatIndex, argsIndex)))
+#else
+#define LOGGER_PRINTF_FORMAT(formatIndex, argsIndex)
+#endif
+
+// Rate limiter for log call sites that can fire on every report or frame.
+// One instance lives per call site (see debug_throttled in config.h).
+class LogThrottle {
+    private:
+        std::atomic<int64_t> nextAllowedAt{0};
+        std::atomic<uint32_t> suppressed{0};
+
+    public:
+        // Returns true if the call site may log now. suppressedCount receives the number of
+        // messages dropped since the last allowed one.
+        bool allow(int intervalMilliseconds, uint32_t &suppressedCount);
+};
+
+// Bounded multi-producer / single-consumer log ring. Any thread may log; records are
+// formatted straight into a ring slot and forwarded to XPLMDebugString by the main
+// thread once per frame. When the ring is full new records are dropped and counted.
+class Logger {
+    private:
+        static constexpr size_t Capacity = 256;
+        static constexpr size_t RecordLength = 1024;
+
+        struct Record {
+                std::atomic<size_t> sequence;
+                bool forwardToSimulator;
+                char text[RecordLength];
+        };
+
+        Logger();
+        ~Logger();
+
+        Record records[Capacity];
+        alignas(64) std::atomic<size_t> enqueuePosition;
+        alignas(64) size_t dequeuePosition;
+        std::atomic<uint32_t> droppedRecords;
+
+        Record *claim(size_t &position);
+
+    public:
+        // A function-local static: its construction is thread-safe, where a lazy `new` behind a
+        // null check would race. Every singleton reached off the main thread (I/O, bring-up and
+        // writer threads) is built this way.
+        static Logger *getInstance();
+
+        void log(bool forwardToSimulator, const char *format, ...) LOGGER_PRINTF_FORMAT(3, 4);
+
+        // Main thread only: writes out every record published so far.
+        void drain();
+
+        size_t memoryFootprint() const;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "memory-stats.h"
+
+#include "config.h"
+#include "dataref.h"
+#include "font.h"
+#include "logger.h"
+#include "usbcontroller.h"
+#include "usbdevice.h"
+
+#include <algorithm>
+#include <climits>
+
+MemoryStats *MemoryStats::instance = nullptr;
+
+void MemoryUsage::addSharedAsset(const void *asset, size_t bytes) {
+    if (!asset) {
+        return;
+    }
+
+    sharedAssets[asset] = bytes;
+    sharedAssetReferences += bytes;
+}
+
+size_t MemoryUsage::sharedAssetBytes() const {
+    size_t bytes = 0;
+    for (const auto &[asset, size] : sharedAssets) {
+        bytes += size;
+    }
+    return bytes;
+}
+
+size_t MemoryUsage::sharedAssetSavedBytes() const {
+    return sharedAssetReferences - sharedAssetBytes();
+}
+
+size_t MemoryUsage::StringSize(const std::string &string) {
+    const char *data = string.data();
+    const char *object = reinterpret_cast<const char *>(&string);
+    bool isInline = data >= object && data < object + sizeof(string);
+
+    return sizeof(string) + (isInline ? 0 : string.capacity() + 1);
+}
+
+size_t MemoryUsage::StringListSize(const std::vector<std::string> &strings) {
+    size_t bytes = sizeof(strings) + (strings.capacity() - strings.size()) * sizeof(std::string);
+    for (const auto &string : strings) {
+        bytes += StringSize(string);
+    }
+    return bytes;
+}
+
+size_t MemoryUsage::PageSize(const std::vector<std::vector<char>> &page) {
+    size_t bytes = sizeof(page) + page.capacity() * sizeof(page[0]);
+    for (const auto &line : page) {
+        bytes += line.capacity();
+    }
+    return bytes;
+}
+
+MemoryStats::MemoryStats() {
+    lastUpdate = {};
+    datarefCacheBytes = 0;
+    fontBytes = 0;
+    deviceBufferBytes = 0;
+    queueBytes = 0;
+    sharedAssetBytes = 0;
+    sharedAssetSavedBytes = 0;
+}
+
+MemoryStats::~MemoryStats() {
+    instance = nullptr;
+}
+
+MemoryStats *MemoryStats::getInstance() {
+    if (instance == nullptr) {
+        instance = new MemoryStats();
+    }
+
+    return instance;
+}
+
+void MemoryStats::registerDatarefs() {
+    auto datarefManager = Dataref::getInstance();
+    datarefManager->createDataref<int>("winwing/memory/dataref_cache_bytes", &datarefCacheBytes);
+    datarefManager->createDataref<int>("winwing/memory/font_bytes", &fontBytes);
+    datarefManager->createDataref<int>("winwing/memory/device_buffer_bytes", &deviceBufferBytes);
+    datarefManager->createDataref<int>("winwing/memory/queue_bytes", &queueBytes);
+    datarefManager->createDataref<int>("winwing/memory/shared_asset_bytes", &sharedAssetBytes);
+    datarefManager->createDataref<int>("winwing/memory/shared_asset_saved_bytes", &sharedAssetSavedBytes);
+}
+
+void MemoryStats::update() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastUpdate < std::chrono::seconds(MEMORY_STATS_INTERVAL_SECONDS)) {
+        return;
+    }
+    lastUpdate = now;
+
+    auto clamp = [](size_t bytes) {
+        return (int) std::min<size_t>(bytes, INT_MAX);
+    };
+
+    MemoryUsage usage = collect();
+    datarefCacheBytes = clamp(usage.datarefCache);
+    fontBytes = clamp(usage.fonts);
+    deviceBufferBytes = clamp(usage.deviceBuffers);
+    queueBytes = clamp(usage.queues);
+    sharedAssetBytes = clamp(usage.sharedAssetBytes());
+    sharedAssetSavedBytes = clamp(usage.sharedAssetSavedBytes());
+}
+
+MemoryUsage MemoryStats::collect() {
+    MemoryUsage usage;
+    usage.datarefCache = Dataref::getInstance()->cacheMemoryFootprint();
+    usage.fonts = Font::LoadedBytes();
+    usage.queues = Logger::getInstance()->memoryFootprint();
+
+    for (auto *device : USBController::getInstance()->devices) {
+        device->reportMemoryUsage(usage);
+    }
+
+    return usage;
+}
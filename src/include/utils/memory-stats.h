@@ -0,0 +1,57 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Approximate heap footprint of one accounting pass. Devices add their own buffers, queues
+// and the immutable assets (fonts, button maps, dataref name lists) they reference.
+class MemoryUsage {
+    private:
+        std::unordered_map<const void *, size_t> sharedAssets;
+        size_t sharedAssetReferences = 0;
+
+    public:
+        size_t datarefCache = 0;
+        size_t fonts = 0;
+        size_t deviceBuffers = 0;
+        size_t queues = 0;
+
+        // The same asset may be added by several devices; it is only held once.
+        void addSharedAsset(const void *asset, size_t bytes);
+        size_t sharedAssetBytes() const;
+        size_t sharedAssetSavedBytes() const;
+
+        static size_t StringSize(const std::string &string);
+        static size_t StringListSize(const std::vector<std::string> &strings);
+        static size_t PageSize(const std::vector<std::vector<char>> &page);
+};
+
+// Collects a MemoryUsage every few seconds on the main thread and publishes it through the
+// winwing/memory/* datarefs, in bytes.
+class MemoryStats {
+    private:
+        MemoryStats();
+        ~MemoryStats();
+        static MemoryStats *instance;
+
+        std::chrono::steady_clock::time_point lastUpdate;
+        int datarefCacheBytes;
+        int fontBytes;
+        int deviceBufferBytes;
+        int queueBytes;
+        int sharedAssetBytes;
+        int sharedAssetSavedBytes;
+
+    public:
+        static MemoryStats *getInstance();
+
+        void registerDatarefs();
+        void update();
+        MemoryUsage collect();
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "startup-profiler.h"
+
+#include "appstate.h"
+#include "config.h"
+#include "thread-registry.h"
+
+#include <cstdarg>
+#include <cstdio>
+
+static thread_local int startupPhaseDepth = 0;
+static thread_local bool isMainThread = false;
+
+StartupProfiler::StartupProfiler() {
+    phaseCount = 0;
+    active = false;
+}
+
+StartupProfiler::~StartupProfiler() {
+}
+
+StartupProfiler *StartupProfiler::getInstance() {
+    // Phases are also recorded from device I/O threads.
+    static StartupProfiler instance;
+    return &instance;
+}
+
+void StartupProfiler::begin() {
+    std::lock_guard<std::mutex> lock(mutex);
+    isMainThread = true;
+    origin = Clock::now();
+    phaseCount = 0;
+    active = true;
+}
+
+bool StartupProfiler::isActive() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return active;
+}
+
+void StartupProfiler::record(const char *name, Clock::time_point start, Clock::time_point end, int depth) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!active || phaseCount >= MaxPhases) {
+        return;
+    }
+
+    Phase &phase = phases[phaseCount++];
+    snprintf(phase.name, sizeof(phase.name), "%s", name);
+    phase.startMilliseconds = std::chrono::duration<double, std::milli>(start - origin).count();
+    phase.durationMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    phase.mainThread = isMainThread;
+    phase.depth = depth;
+}
+
+void StartupProfiler::finish(const char *milestone) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!active) {
+        return;
+    }
+    active = false;
+
+    double total = std::chrono::duration<double, std::milli>(Clock::now() - origin).count();
+    double mainThreadStall = 0;
+    for (size_t i = 0; i < phaseCount; ++i) {
+        if (phases[i].mainThread && phases[i].depth == 0) {
+            mainThreadStall += phases[i].durationMilliseconds;
+        }
+    }
+
+    debug_force("Startup: %s after %.1f ms, main thread blocked for %.1f ms\n", milestone, total, mainThreadStall);
+    for (size_t i = 0; i < phaseCount; ++i) {
+        const Phase &phase = phases[i];
+        debug_force("Startup:   +%8.1f ms %8.1f ms  %-6s %*s%s\n", phase.startMilliseconds, phase.durationMilliseconds, phase.mainThread ? "main" : "worker", phase.depth * 2, "", phase.name);
+    }
+
+    // The threads set up by then are the ones that stay for the session
+    ThreadRegistry::getInstance()->logThreads();
+}
+
+StartupPhase::StartupPhase(const char *format, ...) {
+    enabled = StartupProfiler::getInstance()->isActive();
+    depth = startupPhaseDepth++;
+    if (!enabled) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(name, sizeof(name), format, args);
+    va_end(args);
+
+    start = StartupProfiler::Clock::now();
+}
+
+StartupPhase::~StartupPhase() {
+    startupPhaseDepth--;
+    if (!enabled) {
+        return;
+    }
+
+    StartupProfiler::getInstance()->record(name, start, StartupProfiler::Clock::now(), depth);
+}
@@ -0,0 +1,62 @@
+#ifndef STARTUP_PROFILER_H
+#define STARTUP_PROFILER_H
+
+#include "logger.h"
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+// Records how long each phase of the cold start takes, from XPluginEnable until the first
+// frame in which every connected device has its profile loaded. The timeline is written to
+// the log once, together with the time the main thread spent blocked in top-level phases.
+class StartupProfiler {
+    private:
+        static constexpr size_t MaxPhases = 64;
+        static constexpr size_t MaxNameLength = 48;
+
+        struct Phase {
+                char name[MaxNameLength];
+                double startMilliseconds;
+                double durationMilliseconds;
+                bool mainThread;
+                int depth;
+        };
+
+        StartupProfiler();
+        ~StartupProfiler();
+
+        std::mutex mutex;
+        std::chrono::steady_clock::time_point origin;
+        Phase phases[MaxPhases];
+        size_t phaseCount;
+        bool active;
+
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static StartupProfiler *getInstance();
+
+        void begin();
+        void finish(const char *milestone);
+        bool isActive();
+
+        void record(const char *name, Clock::time_point start, Clock::time_point end, int depth);
+};
+
+// Times the enclosing scope as one startup phase. Nested phases are indented in the report.
+class StartupPhase {
+    private:
+        char name[48];
+        StartupProfiler::Clock::time_point start;
+        int depth;
+        bool enabled;
+
+    public:
+        explicit StartupPhase(const char *format, ...) LOGGER_PRINTF_FORMAT(2, 3);
+        ~StartupPhase();
+        StartupPhase(const StartupPhase &) = delete;
+        StartupPhase &operator=(const StartupPhase &) = delete;
+};
+
+#endif
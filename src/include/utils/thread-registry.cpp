@@ -0,0 +1,241 @@
+#include "thread-registry.h"
+
+#include "appstate.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if LIN
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif APL
+#include <pthread.h>
+#include <pthread/qos.h>
+#endif
+
+static const char *RoleNames[] = {"reactor", "writer", "io", "bringup", "monitor", "reader", "fake"};
+static_assert(sizeof(RoleNames) / sizeof(RoleNames[0]) == static_cast<size_t>(ThreadRole::Count));
+
+// "2-3+6" -> bits 2, 3 and 6
+static uint64_t ParseCpuList(const std::string &list) {
+    uint64_t mask = 0;
+    size_t position = 0;
+    while (position < list.size()) {
+        size_t end = list.find('+', position);
+        std::string range = list.substr(position, end == std::string::npos ? std::string::npos : end - position);
+        int first = atoi(range.c_str());
+        size_t dash = range.find('-');
+        int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last && cpu >= 0 && cpu < 64; cpu++) {
+            mask |= 1ULL << cpu;
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        position = end + 1;
+    }
+    return mask;
+}
+
+ThreadRegistry::ThreadRegistry() {
+    // Setup work may wait for the sim's own threads
+    policies[static_cast<size_t>(ThreadRole::BringUp)] = {ThreadClass::Batch, 5, 0};
+
+    const char *spec = getenv("WINWING_THREADS");
+    if (spec && *spec) {
+        configure(spec);
+    }
+}
+
+ThreadRegistry *ThreadRegistry::getInstance() {
+    static ThreadRegistry instance;
+    return &instance;
+}
+
+const char *ThreadRegistry::RoleName(ThreadRole role) {
+    return RoleNames[static_cast<size_t>(role)];
+}
+
+// "<role>:<key>=<value>,...;<role>:..." with the keys class (normal, batch, idle), nice and
+// cpus; several cores are joined with '+' since ',' separates the keys, e.g. cpus=0-1+4
+void ThreadRegistry::configure(const char *spec) {
+    std::string remaining = spec;
+    while (!remaining.empty()) {
+        size_t end = remaining.find(';');
+        std::string entry = remaining.substr(0, end);
+        remaining = end == std::string::npos ? "" : remaining.substr(end + 1);
+
+        size_t colon = entry.find(':');
+        std::string roleName = entry.substr(0, colon);
+        size_t role = 0;
+        while (role < static_cast<size_t>(ThreadRole::Count) && roleName != RoleNames[role]) {
+            role++;
+        }
+        if (role == static_cast<size_t>(ThreadRole::Count) || colon == std::string::npos) {
+            debug_force("WINWING_THREADS: ignoring \"%s\"\n", entry.c_str());
+            continue;
+        }
+
+        ThreadPolicy &policy = policies[role];
+        std::string settings = entry.substr(colon + 1);
+        while (!settings.empty()) {
+            size_t comma = settings.find(',');
+            std::string setting = settings.substr(0, comma);
+            settings = comma == std::string::npos ? "" : settings.substr(comma + 1);
+
+            size_t equals = setting.find('=');
+            std::string key = setting.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : setting.substr(equals + 1);
+            if (key == "class" && value == "normal") {
+                policy.threadClass = ThreadClass::Normal;
+            } else if (key == "class" && value == "batch") {
+                policy.threadClass = ThreadClass::Batch;
+            } else if (key == "class" && value == "idle") {
+                policy.threadClass = ThreadClass::Idle;
+            } else if (key == "nice" && !value.empty()) {
+                policy.nice = atoi(value.c_str());
+            } else if (key == "cpus") {
+                policy.cpus = ParseCpuList(value);
+            } else {
+                debug_force("WINWING_THREADS: ignoring \"%s\" for %s threads\n", setting.c_str(), RoleNames[role]);
+            }
+        }
+    }
+}
+
+void ThreadRegistry::apply(const ThreadPolicy &policy, const char *name) {
+#if LIN
+    pthread_setname_np(pthread_self(), name);
+
+    sched_param parameters = {};
+    int schedulingPolicy = policy.threadClass == ThreadClass::Batch ? SCHED_BATCH : policy.threadClass == ThreadClass::Idle ? SCHED_IDLE : SCHED_OTHER;
+    if (schedulingPolicy != SCHED_OTHER && pthread_setschedparam(pthread_self(), schedulingPolicy, &parameters) != 0) {
+        debug("Could not change the scheduling class of %s\n", name);
+    }
+
+    // The nice value is per thread on Linux
+    if (policy.nice != 0 && setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), policy.nice) != 0) {
+        debug("Could not set nice %d for %s\n", policy.nice, name);
+    }
+
+    if (policy.cpus) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < 64; cpu++) {
+            if (policy.cpus & (1ULL << cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            debug("Could not pin %s to its cores\n", name);
+        }
+    }
+#elif APL
+    pthread_setname_np(name);
+
+    // No per-thread nice or pinning on macOS: the class picks the QoS, nice lowers it further
+    qos_class_t qos = policy.threadClass == ThreadClass::Batch ? QOS_CLASS_UTILITY : policy.threadClass == ThreadClass::Idle ? QOS_CLASS_BACKGROUND : QOS_CLASS_DEFAULT;
+    int relativePriority = -std::min(std::max(policy.nice, 0), 15);
+    if ((qos != QOS_CLASS_DEFAULT || relativePriority != 0) && pthread_set_qos_class_self_np(qos, relativePriority) != 0) {
+        debug("Could not change the QoS class of %s\n", name);
+    }
+#elif IBM
+    // SetThreadDescription only exists since Windows 10 1607
+    typedef HRESULT(WINAPI * SetThreadDescriptionFunction)(HANDLE, PCWSTR);
+    static auto setThreadDescription = reinterpret_cast<SetThreadDescriptionFunction>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"));
+    if (setThreadDescription) {
+        wchar_t wideName[MaxNameLength];
+        MultiByteToWideChar(CP_UTF8, 0, name, -1, wideName, MaxNameLength);
+        setThreadDescription(GetCurrentThread(), wideName);
+    }
+
+    int priority = THREAD_PRIORITY_NORMAL;
+    if (policy.threadClass == ThreadClass::Idle) {
+        priority = THREAD_PRIORITY_IDLE;
+    } else if (policy.threadClass == ThreadClass::Batch || policy.nice > 0) {
+        priority = THREAD_PRIORITY_BELOW_NORMAL;
+    } else if (policy.nice < 0) {
+        priority = THREAD_PRIORITY_ABOVE_NORMAL;
+    }
+    if (priority != THREAD_PRIORITY_NORMAL) {
+        SetThreadPriority(GetCurrentThread(), priority);
+    }
+
+    if (policy.cpus) {
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(policy.cpus));
+    }
+#endif
+}
+
+int ThreadRegistry::enter(ThreadRole role, const char *name) {
+    apply(policy(role), name);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < MaxThreads; i++) {
+        if (!entries[i].used) {
+            Entry &entry = entries[i];
+            snprintf(entry.name, sizeof(entry.name), "%s", name);
+            entry.role = role;
+            entry.used = true;
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+void ThreadRegistry::leave(int slot) {
+    if (slot < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[slot].used = false;
+}
+
+const ThreadPolicy &ThreadRegistry::policy(ThreadRole role) const {
+    return policies[static_cast<size_t>(role)];
+}
+
+size_t ThreadRegistry::threadCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const Entry &entry : entries) {
+        count += entry.used ? 1 : 0;
+    }
+    return count;
+}
+
+void ThreadRegistry::logThreads() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = 0;
+    for (const Entry &entry : entries) {
+        if (entry.used) {
+            const ThreadPolicy &rolePolicy = policies[static_cast<size_t>(entry.role)];
+            debug_force("Thread %-15s %-8s class %d nice %d cpus 0x%llx\n", entry.name, RoleNames[static_cast<size_t>(entry.role)], static_cast<int>(rolePolicy.threadClass), rolePolicy.nice, (unsigned long long) rolePolicy.cpus);
+            count++;
+        }
+    }
+    debug_force("%zu plugin threads running\n", count);
+}
+
+ThreadScope::ThreadScope(ThreadRole role, const char *format, ...) {
+    char name[16];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(name, sizeof(name), format, args);
+    va_end(args);
+
+    slot = ThreadRegistry::getInstance()->enter(role, name);
+}
+
+ThreadScope::~ThreadScope() {
+    ThreadRegistry::getInstance()->leave(slot);
+}
@@ -0,0 +1,84 @@
+#ifndef THREAD_REGISTRY_H
+#define THREAD_REGISTRY_H
+
+#include "logger.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// What a thread does; each role has its own scheduling policy
+enum class ThreadRole : uint8_t {
+    Reactor = 0, // HID input and hot-plug events
+    Writer,      // A device's output queue
+    IOWorker,    // Products' I/O passes, shared by all devices
+    BringUp,     // Opens and initializes one device
+    Monitor,     // Device change polling (Windows)
+    Reader,      // A device's blocking reads (Windows)
+    Fake,        // Fake HID devices
+    Count
+};
+
+enum class ThreadClass : uint8_t {
+    Normal,
+    Batch, // Throughput work the scheduler may delay
+    Idle   // Only runs when a core is otherwise idle
+};
+
+struct ThreadPolicy {
+        ThreadClass threadClass = ThreadClass::Normal;
+        int nice = 0;      // -20..19, negative values usually need privileges
+        uint64_t cpus = 0; // Bit per core the thread may run on, 0 for any
+};
+
+// Names every plugin thread so perf, htop and crash dumps show what it is, and applies the
+// scheduling policy of its role. Policies can be changed through WINWING_THREADS, e.g.
+//   WINWING_THREADS="writer:class=batch,nice=5;io:cpus=2-3"
+// with the roles reactor, writer, io, bringup, monitor, reader and fake.
+class ThreadRegistry {
+    private:
+        static constexpr size_t MaxThreads = 64;
+        static constexpr size_t MaxNameLength = 16; // Including the terminator, as on Linux
+
+        struct Entry {
+                char name[MaxNameLength];
+                ThreadRole role;
+                bool used;
+        };
+
+        ThreadRegistry();
+
+        std::mutex mutex;
+        ThreadPolicy policies[static_cast<size_t>(ThreadRole::Count)];
+        Entry entries[MaxThreads] = {};
+
+        void configure(const char *spec);
+        void apply(const ThreadPolicy &policy, const char *name);
+
+    public:
+        static ThreadRegistry *getInstance();
+
+        // Called first thing on a new thread, see ThreadScope
+        int enter(ThreadRole role, const char *name);
+        void leave(int slot);
+
+        const ThreadPolicy &policy(ThreadRole role) const;
+        size_t threadCount();
+        void logThreads();
+
+        static const char *RoleName(ThreadRole role);
+};
+
+// Registers the current thread for the enclosing scope, normally a thread's whole body
+class ThreadScope {
+    private:
+        int slot;
+
+    public:
+        ThreadScope(ThreadRole role, const char *format, ...) LOGGER_PRINTF_FORMAT(3, 4);
+        ~ThreadScope();
+        ThreadScope(const ThreadScope &) = delete;
+        ThreadScope &operator=(const ThreadScope &) = delete;
+};
+
+#endif
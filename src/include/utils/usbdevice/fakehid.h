@@ -0,0 +1,101 @@
+#ifndef FAKEHID_H
+#define FAKEHID_H
+
+#if LIN
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A Winwing product the fake backend can pose as
+struct FakeHIDModel {
+        const char *key; // As used in WINWING_FAKE_DEVICES
+        uint16_t productId;
+        const char *productName;
+        uint8_t inputReportLength; // 0 for products without input reports
+};
+
+struct FakeHIDStats {
+        std::atomic<uint64_t> inputsSent{0};
+        std::atomic<uint64_t> outputsCaptured{0};
+        std::atomic<uint64_t> outputsRejected{0};
+        std::atomic<uint64_t> capturesDropped{0};
+};
+
+// Hardware-free stand-in for a Winwing device, for benchmarks and for working on the stack
+// without the panels. The device end is either one side of a socketpair, handed straight to
+// USBDevice::Device(), or a /dev/uhid device the kernel exposes as a real hidraw node that
+// the controller discovers through udev like any other. A thread plays the input script at
+// the configured rate and captures every output report the plugin writes.
+class FakeHIDDevice {
+    public:
+        enum class Transport {
+            Socketpair,
+            UHID
+        };
+
+        typedef std::function<bool(std::span<const uint8_t> report)> OutputValidator;
+
+        static constexpr size_t CaptureLimit = 4096;
+
+    private:
+        const FakeHIDModel &model;
+        Transport transport;
+        uint16_t vendorId;
+        int peerFd = -1; // Our end: the socketpair peer or /dev/uhid, owned by the thread
+        int pendingPeerFd = -1; // Socketpair peer waiting to replace peerFd
+        int wakeFd = -1;
+        std::thread thread;
+        std::atomic<bool> running{false};
+
+        std::mutex mutex;
+        std::vector<std::vector<uint8_t>> script;
+        double reportsPerSecond = 0;
+        bool timestampInputs = false;
+        OutputValidator validator;
+        std::vector<std::vector<uint8_t>> captured;
+
+        bool createUHID();
+        void run();
+        void sendInput(const std::vector<uint8_t> &report);
+        void capture(std::span<const uint8_t> report);
+        bool readOutputs();
+
+    public:
+        FakeHIDStats stats;
+
+        FakeHIDDevice(const FakeHIDModel &model, Transport transport);
+        ~FakeHIDDevice();
+
+        static const FakeHIDModel *Model(const std::string &key);
+
+        const FakeHIDModel &getModel() const;
+        Transport getTransport() const;
+        // UHID, before start(): the vendor the kernel device reports, Winwing's by default.
+        // Others make foreign nodes for enumeration benchmarks.
+        void setVendorId(uint16_t vendorId);
+
+        // UHID: creates the kernel device. Socketpair: nothing is connected until openDeviceFd().
+        bool start();
+        void stop();
+
+        // Socketpair only: a fresh pair whose device end is owned by the caller (the USBDevice)
+        int openDeviceFd();
+
+        // Reports are sent in order and repeated. The default script varies a byte past every
+        // product's input layout, so reports pass the duplicate filter without pressing anything.
+        void setScript(std::vector<std::vector<uint8_t>> reports, double reportsPerSecond);
+        void setInputRate(double reportsPerSecond);
+        // Input reports carry the steady_clock nanoseconds they were sent at in their last 8
+        // bytes, for latency measurements
+        void setTimestampedInputs(bool timestamped);
+        void setOutputValidator(OutputValidator validator);
+        std::vector<std::vector<uint8_t>> takeCapturedOutputs();
+};
+#endif
+
+#endif
@@ -0,0 +1,377 @@
+#if LIN
+#include "fakehid.h"
+
+#include "appstate.h"
+#include "config.h"
+#include "thread-registry.h"
+#include "usbdevice.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uhid.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const FakeHIDModel FakeModels[] = {
+    {"fmc", 0xBB36, "WINWING MCDU-32-CAPTAIN", 25},
+    {"fcu-efis", 0xBA01, "WINWING FCU-EFIS-L-R", 41},
+    {"pap3", 0xBF0F, "WINWING PAP3-MCP", 0x20},
+    {"ursa-minor", 0xBC27, "WINWING URSA MINOR AIRLINE JOYSTICK L", 0},
+};
+
+// Vendor-defined collection with a 63 byte input report (ID 1) and a 63 byte output report (ID 2),
+// enough for hidraw to pass every report the products use through unchanged
+static const uint8_t FakeReportDescriptor[] = {
+    0x06, 0x00, 0xFF, // Usage Page (Vendor Defined 0xFF00)
+    0x09, 0x01,       // Usage (0x01)
+    0xA1, 0x01,       // Collection (Application)
+    0x15, 0x00,       //   Logical Minimum (0)
+    0x26, 0xFF, 0x00, //   Logical Maximum (255)
+    0x75, 0x08,       //   Report Size (8)
+    0x85, 0x01,       //   Report ID (1)
+    0x95, 0x3F,       //   Report Count (63)
+    0x09, 0x01,       //   Usage (0x01)
+    0x81, 0x02,       //   Input (Data, Var, Abs)
+    0x85, 0x02,       //   Report ID (2)
+    0x95, 0x3F,       //   Report Count (63)
+    0x09, 0x01,       //   Usage (0x01)
+    0x91, 0x02,       //   Output (Data, Var, Abs)
+    0xC0              // End Collection
+};
+
+static constexpr size_t FakeMaxReportSize = 64;
+
+FakeHIDDevice::FakeHIDDevice(const FakeHIDModel &aModel, Transport aTransport) :
+    model(aModel), transport(aTransport), vendorId(WINWING_VENDOR_ID) {
+    if (model.inputReportLength > 0) {
+        // Idle reports with a changing byte past the button and axis layout
+        std::vector<uint8_t> report(model.inputReportLength, 0);
+        report[0] = 0x01;
+        for (uint8_t i = 0; i < 2; i++) {
+            report.back() = i;
+            script.push_back(report);
+        }
+    }
+}
+
+FakeHIDDevice::~FakeHIDDevice() {
+    stop();
+}
+
+const FakeHIDModel *FakeHIDDevice::Model(const std::string &key) {
+    for (const auto &model : FakeModels) {
+        if (key == model.key) {
+            return &model;
+        }
+    }
+    return nullptr;
+}
+
+const FakeHIDModel &FakeHIDDevice::getModel() const {
+    return model;
+}
+
+FakeHIDDevice::Transport FakeHIDDevice::getTransport() const {
+    return transport;
+}
+
+void FakeHIDDevice::setVendorId(uint16_t aVendorId) {
+    vendorId = aVendorId;
+}
+
+bool FakeHIDDevice::start() {
+    if (running) {
+        return true;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        return false;
+    }
+
+    if (transport == Transport::UHID && !createUHID()) {
+        close(wakeFd);
+        wakeFd = -1;
+        return false;
+    }
+
+    running = true;
+    thread = std::thread(&FakeHIDDevice::run, this);
+    return true;
+}
+
+void FakeHIDDevice::stop() {
+    if (!running) {
+        return;
+    }
+
+    running = false;
+    uint64_t one = 1;
+    (void) !write(wakeFd, &one, sizeof(one));
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pendingPeerFd >= 0) {
+        close(pendingPeerFd);
+        pendingPeerFd = -1;
+    }
+    if (peerFd >= 0) {
+        if (transport == Transport::UHID) {
+            struct uhid_event event = {};
+            event.type = UHID_DESTROY;
+            (void) !write(peerFd, &event, sizeof(event));
+        }
+        close(peerFd);
+        peerFd = -1;
+    }
+
+    close(wakeFd);
+    wakeFd = -1;
+}
+
+bool FakeHIDDevice::createUHID() {
+    int fd = open("/dev/uhid", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        debug_force("[FakeHID] Could not open /dev/uhid: %s\n", strerror(errno));
+        return false;
+    }
+
+    struct uhid_event event = {};
+    event.type = UHID_CREATE2;
+    strncpy(reinterpret_cast<char *>(event.u.create2.name), model.productName, sizeof(event.u.create2.name) - 1);
+    strncpy(reinterpret_cast<char *>(event.u.create2.phys), "winwing-fake", sizeof(event.u.create2.phys) - 1);
+    event.u.create2.rd_size = sizeof(FakeReportDescriptor);
+    event.u.create2.bus = BUS_USB;
+    event.u.create2.vendor = vendorId;
+    event.u.create2.product = model.productId;
+    memcpy(event.u.create2.rd_data, FakeReportDescriptor, sizeof(FakeReportDescriptor));
+
+    if (write(fd, &event, sizeof(event)) != sizeof(event)) {
+        debug_force("[FakeHID] Could not create uhid device %s: %s\n", model.key, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    peerFd = fd;
+    return true;
+}
+
+int FakeHIDDevice::openDeviceFd() {
+    if (transport != Transport::Socketpair) {
+        return -1;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        debug_force("[FakeHID] socketpair failed: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    {
+        // A reconnect replaces the previous pair; the old device end belongs to its USBDevice
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pendingPeerFd >= 0) {
+            close(pendingPeerFd);
+        }
+        pendingPeerFd = fds[1];
+    }
+
+    uint64_t one = 1;
+    (void) !write(wakeFd, &one, sizeof(one));
+    return fds[0];
+}
+
+void FakeHIDDevice::setScript(std::vector<std::vector<uint8_t>> reports, double aReportsPerSecond) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        script = std::move(reports);
+        reportsPerSecond = aReportsPerSecond;
+    }
+
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        (void) !write(wakeFd, &one, sizeof(one));
+    }
+}
+
+void FakeHIDDevice::setInputRate(double aReportsPerSecond) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reportsPerSecond = aReportsPerSecond;
+    }
+
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        (void) !write(wakeFd, &one, sizeof(one));
+    }
+}
+
+void FakeHIDDevice::setTimestampedInputs(bool timestamped) {
+    std::lock_guard<std::mutex> lock(mutex);
+    timestampInputs = timestamped;
+}
+
+void FakeHIDDevice::setOutputValidator(OutputValidator aValidator) {
+    std::lock_guard<std::mutex> lock(mutex);
+    validator = std::move(aValidator);
+}
+
+std::vector<std::vector<uint8_t>> FakeHIDDevice::takeCapturedOutputs() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::vector<uint8_t>> result;
+    result.swap(captured);
+    return result;
+}
+
+void FakeHIDDevice::run() {
+    ThreadScope scope(ThreadRole::Fake, "ww-fake-%04x", model.productId);
+
+    using clock = std::chrono::steady_clock;
+    size_t scriptIndex = 0;
+    clock::time_point nextInput = clock::now();
+
+    while (running) {
+        std::vector<uint8_t> nextReport;
+        std::chrono::nanoseconds interval{0};
+        bool timestamped = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pendingPeerFd >= 0) {
+                if (peerFd >= 0) {
+                    close(peerFd);
+                }
+                peerFd = pendingPeerFd;
+                pendingPeerFd = -1;
+            }
+            if (!script.empty() && reportsPerSecond > 0) {
+                scriptIndex %= script.size();
+                nextReport = script[scriptIndex];
+                interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 / reportsPerSecond));
+                timestamped = timestampInputs && nextReport.size() > sizeof(int64_t);
+            }
+        }
+
+        int fd = peerFd;
+        int timeoutMs = -1;
+        if (fd >= 0 && !nextReport.empty()) {
+            auto now = clock::now();
+            if (now >= nextInput) {
+                if (timestamped) {
+                    int64_t sentAt = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+                    memcpy(nextReport.data() + nextReport.size() - sizeof(sentAt), &sentAt, sizeof(sentAt));
+                }
+                sendInput(nextReport);
+                scriptIndex++;
+                // Fall behind rather than burst when the plugin side stalls
+                nextInput = std::max(nextInput + interval, now - interval);
+                continue;
+            }
+            timeoutMs = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(nextInput - now).count());
+        }
+
+        struct pollfd fds[2] = {{wakeFd, POLLIN, 0}, {fd, POLLIN, 0}};
+        int count = poll(fds, fd >= 0 ? 2 : 1, timeoutMs);
+        if (count < 0 && errno != EINTR) {
+            debug_force("[FakeHID] poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        if (count > 0 && (fds[0].revents & POLLIN)) {
+            uint64_t value;
+            (void) !read(wakeFd, &value, sizeof(value));
+        }
+
+        if (count > 0 && fd >= 0 && fds[1].revents) {
+            if (!readOutputs()) {
+                // The plugin closed its end; wait for the next openDeviceFd()
+                close(peerFd);
+                peerFd = -1;
+            }
+        }
+    }
+}
+
+void FakeHIDDevice::sendInput(const std::vector<uint8_t> &report) {
+    int fd = peerFd;
+    ssize_t result;
+    if (transport == Transport::UHID) {
+        struct uhid_event event = {};
+        event.type = UHID_INPUT2;
+        event.u.input2.size = std::min(report.size(), sizeof(event.u.input2.data));
+        memcpy(event.u.input2.data, report.data(), event.u.input2.size);
+        result = write(fd, &event, sizeof(event));
+    } else {
+        result = send(fd, report.data(), report.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    if (result > 0) {
+        stats.inputsSent.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool FakeHIDDevice::readOutputs() {
+    int fd = peerFd;
+    if (transport == Transport::UHID) {
+        struct uhid_event event;
+        while (read(fd, &event, sizeof(event)) > 0) {
+            if (event.type == UHID_OUTPUT) {
+                capture(std::span<const uint8_t>(event.u.output.data, std::min<size_t>(event.u.output.size, sizeof(event.u.output.data))));
+            } else if (event.type == UHID_GET_REPORT) {
+                // Nothing to report; answer so hidraw does not wait for the kernel timeout
+                struct uhid_event reply = {};
+                reply.type = UHID_GET_REPORT_REPLY;
+                reply.u.get_report_reply.id = event.u.get_report.id;
+                reply.u.get_report_reply.err = EIO;
+                (void) !write(fd, &reply, sizeof(reply));
+            } else if (event.type == UHID_SET_REPORT) {
+                capture(std::span<const uint8_t>(event.u.set_report.data, std::min<size_t>(event.u.set_report.size, sizeof(event.u.set_report.data))));
+                struct uhid_event reply = {};
+                reply.type = UHID_SET_REPORT_REPLY;
+                reply.u.set_report_reply.id = event.u.set_report.id;
+                (void) !write(fd, &reply, sizeof(reply));
+            }
+        }
+        return errno == EAGAIN || errno == EINTR;
+    }
+
+    uint8_t buffer[FakeMaxReportSize * 2];
+    while (true) {
+        ssize_t length = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (length > 0) {
+            capture(std::span<const uint8_t>(buffer, length));
+        } else if (length == 0) {
+            return false;
+        } else {
+            return errno == EAGAIN || errno == EINTR;
+        }
+    }
+}
+
+void FakeHIDDevice::capture(std::span<const uint8_t> report) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.outputsCaptured.fetch_add(1, std::memory_order_relaxed);
+
+    bool valid = report.size() <= FakeMaxReportSize && !report.empty();
+    if (valid && validator) {
+        valid = validator(report);
+    }
+    if (!valid) {
+        stats.outputsRejected.fetch_add(1, std::memory_order_relaxed);
+        debug_throttled(1000, "[FakeHID] %s rejected a %zu byte output report (id 0x%02X)\n", model.key, report.size(), report.empty() ? 0 : report[0]);
+    }
+
+    if (captured.size() >= CaptureLimit) {
+        stats.capturesDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    captured.emplace_back(report.begin(), report.end());
+}
+#endif
@@ -0,0 +1,170 @@
+#include "hidcapture.h"
+
+#include "appstate.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char CaptureMagic[8] = {'W', 'W', 'H', 'I', 'D', 'C', 'A', 'P'};
+static constexpr size_t RecordHeaderLength = 15;
+
+HIDCapture::HIDCapture() {
+}
+
+HIDCapture::~HIDCapture() {
+    stop();
+}
+
+HIDCapture *HIDCapture::getInstance() {
+    static HIDCapture instance;
+    return &instance;
+}
+
+bool HIDCapture::start(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (writer.isOpen()) {
+        return true;
+    }
+
+    if (!writer.open(path)) {
+        debug_force("Could not open HID capture file %s\n", path.c_str());
+        return false;
+    }
+
+    startedAt = std::chrono::steady_clock::now();
+    recordCount = 0;
+    capturing = true;
+    debug_force("Capturing HID traffic to %s\n", path.c_str());
+    return true;
+}
+
+void HIDCapture::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!writer.isOpen()) {
+        return;
+    }
+
+    capturing = false;
+    writer.close();
+    debug_force("HID capture stopped after %llu reports\n", (unsigned long long) recordCount);
+}
+
+bool HIDCapture::isCapturing() const {
+    return capturing.load(std::memory_order_relaxed);
+}
+
+void HIDCapture::record(HIDCaptureDirection direction, uint16_t vendorId, uint16_t productId, std::span<const uint8_t> report) {
+    if (!capturing.load(std::memory_order_relaxed) || report.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!writer.isOpen()) {
+        return;
+    }
+
+    uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startedAt).count();
+    writer.write(timestamp, direction, vendorId, productId, report);
+    recordCount++;
+}
+
+HIDCaptureWriter::~HIDCaptureWriter() {
+    close();
+}
+
+bool HIDCaptureWriter::open(const std::string &path) {
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    uint8_t header[12] = {};
+    memcpy(header, CaptureMagic, sizeof(CaptureMagic));
+    header[8] = HIDCaptureVersion & 0xFF;
+    header[9] = HIDCaptureVersion >> 8;
+    fwrite(header, 1, sizeof(header), file);
+    return true;
+}
+
+void HIDCaptureWriter::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool HIDCaptureWriter::isOpen() const {
+    return file != nullptr;
+}
+
+void HIDCaptureWriter::write(uint64_t timestamp, HIDCaptureDirection direction, uint16_t vendorId, uint16_t productId, std::span<const uint8_t> report) {
+    if (!file || report.empty()) {
+        return;
+    }
+
+    uint16_t length = static_cast<uint16_t>(std::min<size_t>(report.size(), UINT16_MAX));
+    uint8_t header[RecordHeaderLength];
+    for (int i = 0; i < 8; i++) {
+        header[i] = static_cast<uint8_t>(timestamp >> (8 * i));
+    }
+    header[8] = vendorId & 0xFF;
+    header[9] = vendorId >> 8;
+    header[10] = productId & 0xFF;
+    header[11] = productId >> 8;
+    header[12] = static_cast<uint8_t>(direction);
+    header[13] = length & 0xFF;
+    header[14] = length >> 8;
+
+    // Buffered by stdio, so the I/O threads rarely reach the disk themselves
+    fwrite(header, 1, sizeof(header), file);
+    fwrite(report.data(), 1, length, file);
+}
+
+HIDCaptureReader::~HIDCaptureReader() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool HIDCaptureReader::open(const std::string &path) {
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    uint8_t header[12];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, CaptureMagic, sizeof(CaptureMagic)) != 0) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    uint16_t version = header[8] | (header[9] << 8);
+    if (version != HIDCaptureVersion) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+bool HIDCaptureReader::next(HIDCaptureRecord &record) {
+    uint8_t header[RecordHeaderLength];
+    if (!file || fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        return false;
+    }
+
+    record.timestamp = 0;
+    for (int i = 0; i < 8; i++) {
+        record.timestamp |= static_cast<uint64_t>(header[i]) << (8 * i);
+    }
+    record.vendorId = header[8] | (header[9] << 8);
+    record.productId = header[10] | (header[11] << 8);
+    record.direction = static_cast<HIDCaptureDirection>(header[12]);
+
+    uint16_t length = header[13] | (header[14] << 8);
+    record.data.resize(length);
+    return fread(record.data.data(), 1, length, file) == length;
+}
@@ -0,0 +1,81 @@
+#ifndef HIDCAPTURE_H
+#define HIDCAPTURE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+// Capture file layout, little endian:
+//   header: "WWHIDCAP" u16 version u16 reserved
+//   record: u64 nanoseconds since start, u16 vendor ID, u16 product ID, u8 direction,
+//           u16 length, <length> report bytes (report ID first)
+static constexpr uint16_t HIDCaptureVersion = 1;
+
+enum class HIDCaptureDirection : uint8_t {
+    Input = 0,
+    Output = 1
+};
+
+struct HIDCaptureRecord {
+        uint64_t timestamp; // Nanoseconds since the capture started
+        uint16_t vendorId;
+        uint16_t productId;
+        HIDCaptureDirection direction;
+        std::vector<uint8_t> data;
+};
+
+class HIDCaptureWriter {
+    private:
+        FILE *file = nullptr;
+
+    public:
+        ~HIDCaptureWriter();
+
+        bool open(const std::string &path);
+        void close();
+        bool isOpen() const;
+        void write(uint64_t timestamp, HIDCaptureDirection direction, uint16_t vendorId, uint16_t productId, std::span<const uint8_t> report);
+};
+
+// Records every raw input report and every output report actually written, from all devices,
+// into one file. Off unless started; record() is then a single relaxed load.
+class HIDCapture {
+    private:
+        HIDCapture();
+        ~HIDCapture();
+
+        std::atomic<bool> capturing{false};
+        std::mutex mutex;
+        HIDCaptureWriter writer;
+        std::chrono::steady_clock::time_point startedAt;
+        uint64_t recordCount = 0;
+
+    public:
+        static HIDCapture *getInstance();
+
+        bool start(const std::string &path);
+        void stop();
+        bool isCapturing() const;
+
+        // Called from the reader and writer threads
+        void record(HIDCaptureDirection direction, uint16_t vendorId, uint16_t productId, std::span<const uint8_t> report);
+};
+
+class HIDCaptureReader {
+    private:
+        FILE *file = nullptr;
+
+    public:
+        ~HIDCaptureReader();
+
+        bool open(const std::string &path);
+        // Reuses record's buffer; false at the end of the file or on a truncated record
+        bool next(HIDCaptureRecord &record);
+};
+
+#endif
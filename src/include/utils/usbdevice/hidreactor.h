@@ -0,0 +1,55 @@
+#ifndef HIDREACTOR_H
+#define HIDREACTOR_H
+
+#if LIN
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Single epoll thread that serves every hidraw fd and the udev monitor fd. The thread only
+// wakes up when a registered fd is readable; its callback is expected to drain everything
+// that is pending (fds should be non-blocking) and return false once the fd is dead, which
+// unregisters it.
+class HIDReactor {
+    public:
+        using ReadableCallback = std::function<bool()>;
+
+    private:
+        HIDReactor();
+        ~HIDReactor();
+
+        int epollFd;
+        int wakeFd;
+        std::thread thread;
+        std::atomic<bool> running;
+
+        // Held while a callback runs, so remove() returning means the callback is done.
+        // Recursive because callbacks may remove other fds.
+        std::recursive_mutex sourcesMutex;
+        std::unordered_map<int, ReadableCallback> sources;
+        int dispatchingFd;
+        bool dispatchingFdRemoved;
+
+        std::atomic<uint64_t> wakeups;
+        std::atomic<uint64_t> dispatches;
+
+        void start();
+        void run();
+        void dispatch(int fd);
+
+    public:
+        static HIDReactor *getInstance();
+
+        bool add(int fd, ReadableCallback callback);
+        void remove(int fd);
+        void shutdown();
+
+        uint64_t wakeupCount() const;
+        uint64_t dispatchCount() const;
+};
+#endif
+
+#endif
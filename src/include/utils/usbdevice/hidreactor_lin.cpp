@@ -0,0 +1,174 @@
+#if LIN
+#include "hidreactor.h"
+
+#include "appstate.h"
+#include "config.h"
+#include "thread-registry.h"
+
+#include <cstring>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+HIDReactor::HIDReactor() {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    running = false;
+    dispatchingFd = -1;
+    dispatchingFdRemoved = false;
+    wakeups = 0;
+    dispatches = 0;
+
+    if (epollFd >= 0 && wakeFd >= 0) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = wakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    }
+}
+
+HIDReactor::~HIDReactor() {
+    shutdown();
+
+    if (wakeFd >= 0) {
+        close(wakeFd);
+    }
+
+    if (epollFd >= 0) {
+        close(epollFd);
+    }
+}
+
+HIDReactor *HIDReactor::getInstance() {
+    static HIDReactor instance;
+    return &instance;
+}
+
+bool HIDReactor::add(int fd, ReadableCallback callback) {
+    if (epollFd < 0 || fd < 0) {
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(sourcesMutex);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        debug("Could not watch fd %d: %s\n", fd, strerror(errno));
+        return false;
+    }
+
+    sources[fd] = std::move(callback);
+    start();
+    return true;
+}
+
+void HIDReactor::remove(int fd) {
+    std::lock_guard<std::recursive_mutex> lock(sourcesMutex);
+
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+
+    // A callback is removing its own fd: erase it once the callback has returned
+    if (fd == dispatchingFd) {
+        dispatchingFdRemoved = true;
+        return;
+    }
+
+    sources.erase(fd);
+}
+
+void HIDReactor::start() {
+    if (running.load()) {
+        return;
+    }
+
+    running = true;
+    thread = std::thread([this]() {
+        run();
+    });
+}
+
+void HIDReactor::shutdown() {
+    if (!running.exchange(false)) {
+        return;
+    }
+
+    uint64_t one = 1;
+    ssize_t written = write(wakeFd, &one, sizeof(one));
+    (void) written;
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(sourcesMutex);
+    for (auto &[fd, callback] : sources) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    sources.clear();
+}
+
+void HIDReactor::run() {
+    ThreadScope scope(ThreadRole::Reactor, "ww-hid-reactor");
+
+    static constexpr int MaxEvents = 16;
+    epoll_event events[MaxEvents];
+
+    while (running.load()) {
+        int count = epoll_wait(epollFd, events, MaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            debug_force("HID reactor stopped, epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        wakeups.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < count && running.load(); ++i) {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd) {
+                uint64_t value;
+                ssize_t bytesRead = read(wakeFd, &value, sizeof(value));
+                (void) bytesRead;
+                continue;
+            }
+
+            dispatch(fd);
+        }
+    }
+
+    debug("HID reactor thread is exiting\n");
+}
+
+void HIDReactor::dispatch(int fd) {
+    std::lock_guard<std::recursive_mutex> lock(sourcesMutex);
+
+    auto it = sources.find(fd);
+    if (it == sources.end()) {
+        return;
+    }
+
+    dispatchingFd = fd;
+    dispatchingFdRemoved = false;
+    bool keep = it->second();
+    dispatchingFd = -1;
+    dispatches.fetch_add(1, std::memory_order_relaxed);
+
+    if (!keep || dispatchingFdRemoved) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        sources.erase(fd);
+    }
+}
+
+uint64_t HIDReactor::wakeupCount() const {
+    return wakeups.load(std::memory_order_relaxed);
+}
+
+uint64_t HIDReactor::dispatchCount() const {
+    return dispatches.load(std::memory_order_relaxed);
+}
+#endif
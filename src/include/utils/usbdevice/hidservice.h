@@ -0,0 +1,111 @@
+#ifndef HIDSERVICE_H
+#define HIDSERVICE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Shared memory layout between the plugin and winwing-hid-helper, the optional process that
+// owns the hidraw nodes so a hung device or driver can only stall the helper, never the sim.
+//
+// The plugin connects to the helper's abstract unix socket (HIDServiceSocketName plus the user
+// id) and receives three descriptors: a memfd holding one HIDServiceRegion and one eventfd per
+// direction. The socket then only signals that the other side went away. Each ring has a single
+// producer and a single consumer; a consumer announces that it is about to sleep, and only then
+// does the producer write the eventfd, so busy traffic costs no system calls.
+
+#define HIDServiceSocketName "winwing-hid-"
+
+static constexpr uint32_t HIDServiceMagic = 0x53485757; // "WWHS"
+static constexpr uint32_t HIDServiceVersion = 1;
+static constexpr size_t HIDServiceRingSlots = 1024;
+static constexpr size_t HIDServicePayloadSize = 128;
+
+enum class HIDServiceMessage : uint16_t {
+    DeviceAdded = 1, // Helper: device, VID/PID, product name as payload
+    DeviceRemoved,   // Helper: device
+    Input,           // Helper: one input report of device
+    Output,          // Plugin: one output report for device
+    Ping,            // Either side, answered with a Pong carrying the same timestamp
+    Pong
+};
+
+struct HIDServiceRecord {
+        HIDServiceMessage type;
+        uint16_t device; // Helper-assigned, stable while the device stays plugged in
+        uint16_t length;
+        uint16_t vendorId;
+        uint16_t productId;
+        uint16_t reserved[3];
+        uint64_t timestamp; // steady_clock nanoseconds when the record was produced
+        uint8_t data[HIDServicePayloadSize];
+};
+
+struct HIDServiceRing {
+        alignas(64) std::atomic<uint32_t> head{0}; // Next slot the producer fills
+        alignas(64) std::atomic<uint32_t> tail{0}; // Next slot the consumer reads
+        alignas(64) std::atomic<uint32_t> consumerSleeping{1}; // Until the consumer first drained
+        std::atomic<uint64_t> dropped{0}; // Records refused because the ring was full
+        HIDServiceRecord slots[HIDServiceRingSlots];
+
+        bool push(const HIDServiceRecord &record) {
+            uint32_t position = head.load(std::memory_order_relaxed);
+            if (position - tail.load(std::memory_order_acquire) >= HIDServiceRingSlots) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            slots[position % HIDServiceRingSlots] = record;
+            head.store(position + 1, std::memory_order_seq_cst);
+            return true;
+        }
+
+        bool pop(HIDServiceRecord &record) {
+            uint32_t position = tail.load(std::memory_order_relaxed);
+            if (position == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            record = slots[position % HIDServiceRingSlots];
+            tail.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Producer, after push(): true if the consumer went to sleep and needs the eventfd
+        bool takeWakeup() {
+            return consumerSleeping.load(std::memory_order_seq_cst) && consumerSleeping.exchange(0);
+        }
+
+        // Consumer, after draining: false if a record arrived meanwhile and it must drain again
+        bool prepareSleep() {
+            consumerSleeping.store(1, std::memory_order_seq_cst);
+            if (tail.load(std::memory_order_relaxed) != head.load(std::memory_order_seq_cst)) {
+                consumerSleeping.store(0, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+};
+
+struct HIDServiceRegion {
+        uint32_t magic = HIDServiceMagic;
+        uint32_t version = HIDServiceVersion;
+        HIDServiceRing toHelper;
+        HIDServiceRing toPlugin;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free, "The rings are shared between processes");
+
+inline HIDServiceRecord HIDServiceMakeRecord(HIDServiceMessage type, uint16_t device, const uint8_t *data, size_t length) {
+    HIDServiceRecord record = {};
+    record.type = type;
+    record.device = device;
+    record.length = static_cast<uint16_t>(length < HIDServicePayloadSize ? length : HIDServicePayloadSize);
+    if (record.length) {
+        memcpy(record.data, data, record.length);
+    }
+    return record;
+}
+
+#endif
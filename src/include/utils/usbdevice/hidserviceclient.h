@@ -0,0 +1,94 @@
+#ifndef HIDSERVICECLIENT_H
+#define HIDSERVICECLIENT_H
+
+#if LIN
+#include "hidservice.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct HIDServiceStats {
+        std::atomic<uint64_t> inputsReceived{0};
+        std::atomic<uint64_t> outputsSent{0};
+        std::atomic<uint64_t> outputsDropped{0}; // The ring to the helper was full
+};
+
+// Plugin side of winwing-hid-helper, used instead of opening hidraw nodes when
+// WINWING_HID_SERVICE is set. The helper announces the devices it has open; each one the
+// plugin uses gets a handle, an otherwise idle eventfd, so USBDevice keeps a real descriptor to
+// check and close. Input arrives on the reactor thread; output never blocks: with the ring
+// full the report fails like a failed write.
+class HIDServiceClient {
+    public:
+        typedef std::function<void(uint8_t *report, int length)> InputCallback;
+
+        struct Device {
+                uint16_t id;
+                uint16_t vendorId;
+                uint16_t productId;
+                std::string productName;
+        };
+
+    private:
+        struct Handle {
+                uint16_t device;
+                InputCallback callback;
+        };
+
+        HIDServiceClient();
+        ~HIDServiceClient();
+
+        int socketFd = -1;
+        int toHelperFd = -1;
+        int toPluginFd = -1;
+        HIDServiceRegion *region = nullptr;
+        std::atomic<bool> active{false};
+        std::function<void()> devicesChanged;
+
+        // Held while input callbacks run, so close() returning means none runs anymore
+        std::mutex mutex;
+        std::vector<Device> devices;
+        std::unordered_map<int, Handle> handles;
+
+        // The writer threads of all devices share the ring to the helper
+        std::mutex writeMutex;
+
+        bool connectToHelper(const char *socketName);
+        bool receive();
+        void lost();
+        bool send(const HIDServiceRecord &record);
+
+    public:
+        HIDServiceStats stats;
+
+        static HIDServiceClient *getInstance();
+
+        // Connects when WINWING_HID_SERVICE is set ("1" for the default socket, or a socket
+        // name). devicesChanged runs on the reactor thread whenever the helper's device list
+        // changed, including when the helper went away.
+        bool start(std::function<void()> devicesChanged);
+        void stop();
+        bool isActive() const;
+
+        std::vector<Device> availableDevices();
+        // A new handle for the helper's device, -1 if it is gone
+        int open(uint16_t device);
+        // The helper's device behind handle, -1 if handle is not one of ours
+        int deviceId(int handle);
+        bool watch(int handle, InputCallback callback);
+        void unwatch(int handle);
+        // Unwatches and closes the handle; the helper keeps the device open
+        void close(int handle);
+
+        // Writer threads: hands the report to the helper without waiting for the device
+        bool write(uint16_t device, std::span<const uint8_t> report);
+};
+#endif
+
+#endif
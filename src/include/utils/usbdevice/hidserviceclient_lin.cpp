@@ -0,0 +1,309 @@
+#if LIN
+#include "hidserviceclient.h"
+
+#include "appstate.h"
+#include "config.h"
+#include "hidreactor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static uint64_t TimestampNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+HIDServiceClient::HIDServiceClient() {
+}
+
+HIDServiceClient::~HIDServiceClient() {
+}
+
+HIDServiceClient *HIDServiceClient::getInstance() {
+    static HIDServiceClient instance;
+    return &instance;
+}
+
+bool HIDServiceClient::start(std::function<void()> changed) {
+    const char *service = getenv("WINWING_HID_SERVICE");
+    if (!service || !*service || strcmp(service, "0") == 0) {
+        return false;
+    }
+
+    std::string socketName = strcmp(service, "1") == 0 ? HIDServiceSocketName + std::to_string(getuid()) : std::string(service);
+    devicesChanged = std::move(changed);
+    if (!connectToHelper(socketName.c_str())) {
+        debug_force("[HIDService] No helper listening on @%s, opening the devices directly\n", socketName.c_str());
+        stop();
+        return false;
+    }
+
+    debug_force("[HIDService] Device I/O runs in winwing-hid-helper (@%s)\n", socketName.c_str());
+    return true;
+}
+
+bool HIDServiceClient::connectToHelper(const char *socketName) {
+    socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (socketFd < 0) {
+        return false;
+    }
+
+    // Abstract address: no file to clean up, gone with the helper
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    size_t nameLength = std::min(strlen(socketName), sizeof(address.sun_path) - 1);
+    memcpy(address.sun_path + 1, socketName, nameLength);
+    socklen_t addressLength = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + nameLength);
+    if (connect(socketFd, reinterpret_cast<sockaddr *>(&address), addressLength) < 0) {
+        return false;
+    }
+
+    // The handshake runs on the main thread during startup, a stuck helper must not hold it
+    timeval timeout = {1, 0};
+    setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint32_t hello[2] = {};
+    char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    iovec vector = {hello, sizeof(hello)};
+    msghdr message = {};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC) != sizeof(hello)) {
+        return false;
+    }
+
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return false;
+    }
+    int descriptors[3];
+    memcpy(descriptors, CMSG_DATA(header), sizeof(descriptors));
+    toHelperFd = descriptors[1];
+    toPluginFd = descriptors[2];
+
+    void *mapping = mmap(nullptr, sizeof(HIDServiceRegion), PROT_READ | PROT_WRITE, MAP_SHARED, descriptors[0], 0);
+    ::close(descriptors[0]);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    region = static_cast<HIDServiceRegion *>(mapping);
+
+    if (hello[0] != HIDServiceMagic || hello[1] != HIDServiceVersion || region->magic != HIDServiceMagic || region->version != HIDServiceVersion) {
+        debug_force("[HIDService] Helper speaks protocol %u, the plugin %u\n", hello[1], HIDServiceVersion);
+        return false;
+    }
+
+    active = true;
+    int flags = fcntl(socketFd, F_GETFL, 0);
+    fcntl(socketFd, F_SETFL, flags | O_NONBLOCK);
+
+    // The socket carries no data after the handshake, readable means the helper is gone
+    HIDReactor::getInstance()->add(socketFd, [this]() {
+        char byte;
+        ssize_t received = recv(socketFd, &byte, sizeof(byte), 0);
+        if (received < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return true;
+        }
+
+        lost();
+        return false;
+    });
+
+    return HIDReactor::getInstance()->add(toPluginFd, [this]() {
+        return receive();
+    });
+}
+
+void HIDServiceClient::lost() {
+    if (!active.exchange(false)) {
+        return;
+    }
+
+    debug_force("[HIDService] winwing-hid-helper went away, its devices are gone until the plugin restarts\n");
+    HIDReactor::getInstance()->remove(toPluginFd);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        devices.clear();
+    }
+
+    if (devicesChanged) {
+        devicesChanged();
+    }
+}
+
+void HIDServiceClient::stop() {
+    active = false;
+    if (socketFd >= 0) {
+        HIDReactor::getInstance()->remove(socketFd);
+        ::close(socketFd);
+        socketFd = -1;
+    }
+    if (toPluginFd >= 0) {
+        HIDReactor::getInstance()->remove(toPluginFd);
+        ::close(toPluginFd);
+        toPluginFd = -1;
+    }
+    if (toHelperFd >= 0) {
+        ::close(toHelperFd);
+        toHelperFd = -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[handle, entry] : handles) {
+        ::close(handle);
+    }
+    handles.clear();
+    devices.clear();
+
+    // Only the controller calls this, after its devices and their writer threads are gone
+    if (region) {
+        munmap(region, sizeof(HIDServiceRegion));
+        region = nullptr;
+    }
+}
+
+bool HIDServiceClient::isActive() const {
+    return active;
+}
+
+bool HIDServiceClient::receive() {
+    uint64_t count;
+    (void) !read(toPluginFd, &count, sizeof(count));
+
+    HIDServiceRing &ring = region->toPlugin;
+    HIDServiceRecord record;
+    bool changed = false;
+    do {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (ring.pop(record)) {
+            switch (record.type) {
+                case HIDServiceMessage::Input: {
+                    stats.inputsReceived.fetch_add(1, std::memory_order_relaxed);
+                    for (auto &[handle, entry] : handles) {
+                        if (entry.device == record.device && entry.callback) {
+                            entry.callback(record.data, record.length);
+                        }
+                    }
+                } break;
+                case HIDServiceMessage::DeviceAdded: {
+                    devices.push_back({record.device, record.vendorId, record.productId, std::string(reinterpret_cast<const char *>(record.data), record.length)});
+                    changed = true;
+                } break;
+                case HIDServiceMessage::DeviceRemoved: {
+                    devices.erase(std::remove_if(devices.begin(), devices.end(), [&](const Device &device) {
+                        return device.id == record.device;
+                    }),
+                        devices.end());
+                    changed = true;
+                } break;
+                case HIDServiceMessage::Ping: {
+                    HIDServiceRecord pong = record;
+                    pong.type = HIDServiceMessage::Pong;
+                    std::lock_guard<std::mutex> writeLock(writeMutex);
+                    send(pong);
+                } break;
+                default:
+                    break;
+            }
+        }
+    } while (!ring.prepareSleep());
+
+    if (changed && devicesChanged) {
+        devicesChanged();
+    }
+    return true;
+}
+
+bool HIDServiceClient::send(const HIDServiceRecord &record) {
+    if (!region->toHelper.push(record)) {
+        stats.outputsDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (region->toHelper.takeWakeup()) {
+        uint64_t one = 1;
+        (void) !::write(toHelperFd, &one, sizeof(one));
+    }
+    return true;
+}
+
+std::vector<HIDServiceClient::Device> HIDServiceClient::availableDevices() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return devices;
+}
+
+int HIDServiceClient::open(uint16_t device) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool available = std::any_of(devices.begin(), devices.end(), [&](const Device &candidate) {
+        return candidate.id == device;
+    });
+    if (!available) {
+        return -1;
+    }
+
+    int handle = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (handle >= 0) {
+        handles[handle] = {device, nullptr};
+    }
+    return handle;
+}
+
+int HIDServiceClient::deviceId(int handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = handles.find(handle);
+    return found == handles.end() ? -1 : found->second.device;
+}
+
+bool HIDServiceClient::watch(int handle, InputCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = handles.find(handle);
+    if (found == handles.end() || !active) {
+        return false;
+    }
+
+    found->second.callback = std::move(callback);
+    return true;
+}
+
+void HIDServiceClient::unwatch(int handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = handles.find(handle);
+    if (found != handles.end()) {
+        found->second.callback = nullptr;
+    }
+}
+
+void HIDServiceClient::close(int handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (handles.erase(handle)) {
+        ::close(handle);
+    }
+}
+
+bool HIDServiceClient::write(uint16_t device, std::span<const uint8_t> report) {
+    if (!active || report.size() > HIDServicePayloadSize) {
+        return false;
+    }
+
+    HIDServiceRecord record = HIDServiceMakeRecord(HIDServiceMessage::Output, device, report.data(), report.size());
+    record.timestamp = TimestampNow();
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!send(record)) {
+        return false;
+    }
+    stats.outputsSent.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+#endif
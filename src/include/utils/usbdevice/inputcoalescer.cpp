@@ -0,0 +1,102 @@
+#include "inputcoalescer.h"
+
+#include <cstring>
+
+InputCoalescer::InputCoalescer() {
+    std::memset(latest, 0, sizeof(latest));
+    std::memset(singleReport, 0, sizeof(singleReport));
+}
+
+void InputCoalescer::configure(const InputLayout &aLayout) {
+    layout = aLayout;
+    pending.buttonEdges.reserve(layout.buttonBytes * 8);
+    reset();
+}
+
+void InputCoalescer::reset() {
+    previousButtons.assign(layout.buttonBytes, 0);
+    previousEncoders.assign(layout.encoderOffsets.size(), 0);
+    hasBaseline = false;
+    clearFrame();
+}
+
+bool InputCoalescer::add(const InputReport &report) {
+    if (report.length <= 0 || report.data[0] != layout.reportId) {
+        return false;
+    }
+
+    if (report.length < layout.minimumLength || report.length < layout.buttonOffset + layout.buttonBytes) {
+        return true;
+    }
+
+    bool baseline = !hasBaseline;
+    if (baseline) {
+        pending.initial = true;
+        for (size_t i = 0; i < layout.encoderOffsets.size(); ++i) {
+            previousEncoders[i] = layout.encoderOffsets[i] < report.length ? report.data[layout.encoderOffsets[i]] : 0;
+        }
+
+        if (!layout.firstReportPressesButtons) {
+            std::memcpy(previousButtons.data(), report.data + layout.buttonOffset, layout.buttonBytes);
+        }
+        hasBaseline = true;
+    }
+
+    for (int byte = 0; byte < layout.buttonBytes; ++byte) {
+        uint8_t now = report.data[layout.buttonOffset + byte];
+        uint8_t changed = now ^ previousButtons[byte];
+        for (int bit = 0; changed; ++bit, changed >>= 1) {
+            if (changed & 1) {
+                pending.buttonEdges.push_back({static_cast<uint16_t>(byte * 8 + bit), ((now >> bit) & 1) != 0});
+            }
+        }
+        previousButtons[byte] = now;
+    }
+
+    if (!baseline) {
+        for (size_t i = 0; i < layout.encoderOffsets.size(); ++i) {
+            uint8_t offset = layout.encoderOffsets[i];
+            if (offset >= report.length) {
+                continue;
+            }
+
+            // Counters wrap around, the shortest distance is the step count
+            pending.encoderDeltas[i] += static_cast<int8_t>(report.data[offset] - previousEncoders[i]);
+            previousEncoders[i] = report.data[offset];
+        }
+    }
+
+    std::memcpy(latest, report.data, report.length);
+    pending.reportId = report.data[0];
+    pending.report = latest;
+    pending.reportLength = report.length;
+    pending.reportCount++;
+    return true;
+}
+
+const InputFrame &InputCoalescer::passthrough(const InputReport &report) {
+    std::memcpy(singleReport, report.data, report.length);
+    single.reportId = report.length > 0 ? report.data[0] : 0;
+    single.report = singleReport;
+    single.reportLength = report.length;
+    single.reportCount = 1;
+    return single;
+}
+
+bool InputCoalescer::hasFrame() const {
+    return pending.reportCount > 0;
+}
+
+const InputFrame &InputCoalescer::frame() const {
+    return pending;
+}
+
+void InputCoalescer::clearFrame() {
+    pending.reportId = layout.reportId;
+    pending.report = nullptr;
+    pending.reportLength = 0;
+    pending.reportCount = 0;
+    pending.initial = false;
+    pending.buttonEdges.clear();
+    pending.encoderDeltas.assign(layout.encoderOffsets.size(), 0);
+}
@@ -0,0 +1,64 @@
+#ifndef INPUTCOALESCER_H
+#define INPUTCOALESCER_H
+
+#include "inputring.h"
+
+#include <cstdint>
+#include <vector>
+
+// Where a device keeps its state inside its main input report
+struct InputLayout {
+        uint8_t reportId = 1;
+        int minimumLength = 0;
+        uint8_t buttonOffset = 0; // First byte of the button bitmap, bit 0 of it is button 0
+        uint8_t buttonBytes = 0;
+        bool firstReportPressesButtons = true; // Otherwise the first report only sets the baseline
+        std::vector<uint8_t> encoderOffsets;   // 8-bit wrap-around position counters
+};
+
+struct InputButtonEdge {
+        uint16_t index;
+        bool pressed;
+};
+
+// Everything a device reported on one report ID since the previous frame
+struct InputFrame {
+        int reportId = 0;
+        const uint8_t *report = nullptr; // Latest report, axes and other levels are read from here
+        int reportLength = 0;
+        int reportCount = 0;
+        bool initial = false; // The first report of this frame set the baseline (connect or resync)
+        std::vector<InputButtonEdge> buttonEdges; // In arrival order, a press and release within one frame are both kept
+        std::vector<int> encoderDeltas;           // Net steps, indexed like InputLayout::encoderOffsets
+};
+
+// Folds all input reports drained in one update into a single InputFrame, so devices run
+// one state transition per frame no matter how many reports piled up during a hitch.
+// Main thread only.
+class InputCoalescer {
+    private:
+        InputLayout layout;
+        InputFrame pending;
+        InputFrame single;
+        uint8_t latest[sizeof(InputReport::data)];
+        uint8_t singleReport[sizeof(InputReport::data)];
+        std::vector<uint8_t> previousButtons;
+        std::vector<uint8_t> previousEncoders;
+        bool hasBaseline = false;
+
+    public:
+        InputCoalescer();
+
+        void configure(const InputLayout &layout);
+        void reset();
+
+        // Returns false for reports with another report ID, use passthrough() for those
+        bool add(const InputReport &report);
+        const InputFrame &passthrough(const InputReport &report);
+
+        bool hasFrame() const;
+        const InputFrame &frame() const;
+        void clearFrame();
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "inputring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+void InputRing::push(const uint8_t *data, int length) {
+    uint64_t position = tail.load(std::memory_order_relaxed);
+
+    // Full: take the oldest report away from the consumer. If the CAS fails the consumer
+    // just popped it, which frees the slot as well.
+    uint64_t oldest = head.load(std::memory_order_acquire);
+    while (position - oldest >= Capacity) {
+        if (head.compare_exchange_weak(oldest, oldest + 1, std::memory_order_acq_rel)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    Slot &slot = slots[position & (Capacity - 1)];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    int copied = std::clamp(length, 0, (int) sizeof(slot.report.data));
+    slot.report.sequence = position;
+    slot.report.receivedAtNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    slot.report.length = copied;
+    memcpy(slot.report.data, data, copied);
+
+    slot.sequence.store(position + 1, std::memory_order_release);
+    tail.store(position + 1, std::memory_order_release);
+}
+
+bool InputRing::pop(InputReport &report) {
+    while (true) {
+        uint64_t position = head.load(std::memory_order_acquire);
+        if (position == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        // The slot may be overwritten while it is copied if the producer laps us. The sequence
+        // check catches a torn copy, the CAS catches a report that was dropped in the meantime.
+        Slot &slot = slots[position & (Capacity - 1)];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence != position + 1) {
+            continue;
+        }
+
+        memcpy(&report, &slot.report, sizeof(report));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+
+        if (head.compare_exchange_strong(position, position + 1, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+}
+
+bool InputRing::empty() const {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+void InputRing::clear() {
+    head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+uint64_t InputRing::droppedCount() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t InputRing::pushedCount() const {
+    return tail.load(std::memory_order_relaxed);
+}
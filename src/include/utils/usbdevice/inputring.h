@@ -0,0 +1,47 @@
+#ifndef INPUTRING_H
+#define INPUTRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct InputReport {
+        uint64_t sequence;           // Position in the device's report stream, gaps mean dropped reports
+        int64_t receivedAtNanoseconds; // steady_clock time when the reader got the report
+        int length;
+        uint8_t data[65];
+};
+
+// Bounded single-producer / single-consumer queue of input reports with fixed slots. The
+// reader thread pushes, the main thread pops; neither blocks nor allocates. When the ring is
+// full the oldest report is dropped and counted, so the consumer always sees the newest ones.
+class InputRing {
+    private:
+        static constexpr size_t Capacity = 128;
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        struct Slot {
+                // position + 1 once the slot holds the report at that position, 0 while it is written
+                std::atomic<uint64_t> sequence{0};
+                InputReport report;
+        };
+
+        Slot slots[Capacity];
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+
+    public:
+        // Producer side
+        void push(const uint8_t *data, int length);
+
+        // Consumer side
+        bool pop(InputReport &report);
+        bool empty() const;
+        void clear();
+
+        uint64_t droppedCount() const;
+        uint64_t pushedCount() const;
+};
+
+#endif
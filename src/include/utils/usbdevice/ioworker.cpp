@@ -0,0 +1,129 @@
+#include "ioworker.h"
+
+#include "frame-arena.h"
+#include "thread-registry.h"
+
+#include <algorithm>
+
+IOWorker::IOWorker() {
+}
+
+IOWorker::~IOWorker() {
+    std::thread worker;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        worker = std::move(thread);
+    }
+    condition.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+IOWorker *IOWorker::getInstance() {
+    static IOWorker instance;
+    return &instance;
+}
+
+void IOWorker::add(Client &client, Pass pass) {
+    std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (client.registered) {
+        return;
+    }
+
+    client.pass = std::move(pass);
+    client.registered = true;
+    // Commands queued before the client was added are picked up right away
+    client.woken = true;
+    clients.push_back(&client);
+    condition.notify_one();
+
+    if (!thread.joinable()) {
+        stopping = false;
+        thread = std::thread(&IOWorker::run, this);
+    }
+}
+
+void IOWorker::remove(Client &client) {
+    std::lock_guard<std::mutex> lifecycle(lifecycleMutex);
+    std::thread worker;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!client.registered) {
+            return;
+        }
+
+        passFinished.wait(lock, [&]() {
+            return running != &client;
+        });
+        clients.erase(std::remove(clients.begin(), clients.end(), &client), clients.end());
+        client.registered = false;
+        client.woken = false;
+        client.due = Clock::time_point::max();
+        client.pass = nullptr;
+
+        if (clients.empty()) {
+            stopping = true;
+            worker = std::move(thread);
+        }
+    }
+
+    if (worker.joinable()) {
+        condition.notify_all();
+        worker.join();
+    }
+}
+
+void IOWorker::wake(Client &client) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        client.woken = true;
+    }
+    condition.notify_one();
+}
+
+void IOWorker::run() {
+    ThreadScope scope(ThreadRole::IOWorker, "ww-io");
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        auto now = Clock::now();
+        auto earliest = Clock::time_point::max();
+        auto next = clients.end();
+        for (auto it = clients.begin(); it != clients.end(); ++it) {
+            if ((*it)->woken || (*it)->due <= now) {
+                next = it;
+                break;
+            }
+            earliest = std::min(earliest, (*it)->due);
+        }
+
+        if (next == clients.end()) {
+            if (earliest == Clock::time_point::max()) {
+                condition.wait(lock);
+            } else {
+                condition.wait_until(lock, earliest);
+            }
+            continue;
+        }
+
+        // Served clients go to the back, so a busy one cannot starve the others
+        Client *client = *next;
+        clients.erase(next);
+        clients.push_back(client);
+        client->woken = false;
+        running = client;
+        lock.unlock();
+
+        Clock::time_point due = client->pass();
+        // Scratch buffers of a pass do not outlive it
+        FrameArena::forCurrentThread()->reset();
+
+        lock.lock();
+        running = nullptr;
+        client->due = due;
+        passFinished.notify_all();
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef IOWORKER_H
+#define IOWORKER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// One thread running the I/O passes of every product that needs one (FMC page rendering, PAP3
+// LED and LCD diffing), instead of a thread per device. A pass must not block: it hands its
+// reports to the device's output queue and says when it wants to run again. Passes of one
+// client never overlap and see its commands in order; clients take turns.
+class IOWorker {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        // Returns when the pass wants to run again unless woken earlier, or Clock::time_point::max()
+        typedef std::function<Clock::time_point()> Pass;
+
+        // Owned by the device, registered while it is connected
+        class Client {
+                friend class IOWorker;
+
+            private:
+                Pass pass;
+                bool registered = false;
+                bool woken = false;
+                Clock::time_point due = Clock::time_point::max();
+        };
+
+    private:
+        IOWorker();
+        ~IOWorker();
+
+        std::mutex lifecycleMutex; // Serializes add() and remove(), which start and join the thread
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::condition_variable passFinished;
+        std::vector<Client *> clients;
+        Client *running = nullptr;
+        std::thread thread;
+        bool stopping = false;
+
+        void run();
+
+    public:
+        static IOWorker *getInstance();
+
+        // The thread starts with the first client and stops when the last one is removed
+        void add(Client &client, Pass pass);
+        // Returns once no pass of the client runs anymore
+        void remove(Client &client);
+        // Any thread: runs the client's next pass as soon as possible
+        void wake(Client &client);
+};
+
+#endif
@@ -0,0 +1,529 @@
+#include "outputqueue.h"
+
+#include "outputscheduler.h"
+#include "thread-registry.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+static uint64_t ShadowKey(OutputLane lane, uint32_t target) {
+    return (static_cast<uint64_t>(lane) << 32) | target;
+}
+
+// FNV-1a over the report lengths and bytes
+static uint64_t HashReport(uint64_t hash, std::span<const uint8_t> report) {
+    hash = (hash ^ report.size()) * 0x100000001b3ULL;
+    for (uint8_t byte : report) {
+        hash = (hash ^ byte) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static constexpr uint64_t HashSeed = 0xcbf29ce484222325ULL;
+
+OutputQueue::OutputQueue() :
+    budget(OutputScheduler::DeviceBudget()) {
+    reports.resize(ReportCapacity);
+    for (uint16_t i = 0; i < ReportCapacity; ++i) {
+        reports[i].next = i + 1 < ReportCapacity ? i + 1 : None;
+    }
+    freeReports = 0;
+
+    messages.resize(MessageCapacity);
+    for (uint16_t i = 0; i < MessageCapacity; ++i) {
+        messages[i].next = i + 1 < MessageCapacity ? i + 1 : None;
+    }
+    freeMessages = 0;
+}
+
+OutputQueue::~OutputQueue() {
+    stop(std::chrono::milliseconds(0));
+}
+
+void OutputQueue::start(Writer writer, std::string name, BatchWriter batchWriter) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (thread.joinable() || stopping) {
+        return;
+    }
+
+    thread = std::thread(&OutputQueue::run, this, std::move(writer), std::move(batchWriter), std::move(name));
+    running.store(true, std::memory_order_release);
+}
+
+void OutputQueue::stop(std::chrono::milliseconds flushFor) {
+    std::thread writerThread;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable()) {
+            return;
+        }
+
+        // Runs on the main thread: only what sets the device's final state (LEDs and backlight
+        // off, control messages) is worth waiting for, and a failing device gets nothing
+        bool everything = failing.load(std::memory_order_relaxed);
+        dropQueued([&](const Message &message) {
+            return everything || message.lane == OutputLane::Display || message.borrowed;
+        });
+
+        running.store(false, std::memory_order_release);
+        stopping = true;
+        flushUntil.store((std::chrono::steady_clock::now() + flushFor).time_since_epoch().count(), std::memory_order_relaxed);
+        writerThread = std::move(thread);
+    }
+
+    condition.notify_all();
+    writerThread.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = false;
+    flushUntil.store(0, std::memory_order_relaxed);
+}
+
+bool OutputQueue::isRunning() const {
+    return running.load(std::memory_order_acquire);
+}
+
+bool OutputQueue::isFlushing() const {
+    return flushUntil.load(std::memory_order_relaxed) != 0;
+}
+
+bool OutputQueue::pastFlushDeadline() const {
+    auto until = flushUntil.load(std::memory_order_relaxed);
+    return until != 0 && std::chrono::steady_clock::now().time_since_epoch().count() >= until;
+}
+
+bool OutputQueue::push(OutputLane lane, uint32_t target, std::span<const uint8_t> report) {
+    if (report.empty() || report.size() > sizeof(OutputReportBuffer)) {
+        return false;
+    }
+
+    uint64_t hash = HashReport(HashSeed, report);
+    std::unique_lock<std::mutex> lock(mutex);
+    if (isShadowed(lane, target, hash)) {
+        return true;
+    }
+
+    uint16_t first = None;
+    uint16_t last = None;
+    if (!appendReport(lane, first, last, report) && reclaim(lane, target)) {
+        appendReport(lane, first, last, report);
+    }
+    bool queued = enqueue(lane, target, first, nullptr);
+    lock.unlock();
+
+    if (queued) {
+        condition.notify_one();
+    }
+    return queued;
+}
+
+bool OutputQueue::push(OutputLane lane, uint32_t target, std::span<const OutputReportBuffer> buffers) {
+    if (buffers.empty()) {
+        return false;
+    }
+
+    uint64_t hash = HashSeed;
+    for (const auto &buffer : buffers) {
+        hash = HashReport(hash, buffer);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (isShadowed(lane, target, hash)) {
+        return true;
+    }
+
+    uint16_t first = None;
+    uint16_t last = None;
+    auto copy = [&]() {
+        for (const auto &buffer : buffers) {
+            if (!appendReport(lane, first, last, buffer)) {
+                releaseReports(first);
+                first = None;
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!copy() && reclaim(lane, target)) {
+        copy();
+    }
+
+    bool queued = enqueue(lane, target, first, nullptr);
+    lock.unlock();
+
+    if (queued) {
+        condition.notify_one();
+    }
+    return queued;
+}
+
+bool OutputQueue::pushBorrowed(OutputLane lane, uint32_t target, const std::vector<std::vector<uint8_t>> &borrowed) {
+    if (borrowed.empty()) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (isShadowed(lane, target, reinterpret_cast<uintptr_t>(&borrowed))) {
+        return true;
+    }
+
+    bool queued = enqueue(lane, target, None, &borrowed);
+    lock.unlock();
+
+    if (queued) {
+        condition.notify_one();
+    }
+    return queued;
+}
+
+bool OutputQueue::isShadowed(OutputLane lane, uint32_t target, uint64_t hash) {
+    stats.messagesQueued.fetch_add(1, std::memory_order_relaxed);
+    if (target == 0) {
+        return false;
+    }
+
+    // Only the first message for a target allocates its entry
+    auto &shadow = shadows[ShadowKey(lane, target)];
+    if (shadow.generation == shadowGeneration && shadow.hash == hash) {
+        stats.messagesDeduplicated.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    shadow.hash = hash;
+    shadow.generation = shadowGeneration;
+    return false;
+}
+
+bool OutputQueue::appendReport(OutputLane lane, uint16_t &first, uint16_t &last, std::span<const uint8_t> report) {
+    if (freeReports == None || (lane == OutputLane::Display && freeReportCount <= ReservedReports)) {
+        return false;
+    }
+
+    uint16_t index = freeReports;
+    Report &slot = reports[index];
+    freeReports = slot.next;
+    freeReportCount--;
+
+    slot.next = None;
+    slot.length = static_cast<uint8_t>(std::min(report.size(), slot.bytes.size()));
+    std::memcpy(slot.bytes.data(), report.data(), slot.length);
+
+    if (first == None) {
+        first = index;
+    } else {
+        reports[last].next = index;
+    }
+    last = index;
+    return true;
+}
+
+bool OutputQueue::enqueue(OutputLane lane, uint32_t target, uint16_t firstReport, const std::vector<std::vector<uint8_t>> *borrowed) {
+    if (firstReport == None && !borrowed) {
+        // Out of report slots
+        stats.messagesDropped.fetch_add(1, std::memory_order_relaxed);
+        if (target != 0) {
+            shadows[ShadowKey(lane, target)].generation = 0;
+        }
+        return false;
+    }
+
+    Lane &queue = lanes[static_cast<int>(lane)];
+    if (target != 0 && lane != OutputLane::Control) {
+        for (uint16_t index = queue.head; index != None; index = messages[index].next) {
+            Message &message = messages[index];
+            if (message.target == target) {
+                releaseReports(message.firstReport);
+                message.firstReport = firstReport;
+                message.borrowed = borrowed;
+                stats.messagesCoalesced.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    if (freeMessages == None || (lane == OutputLane::Display && freeMessageCount <= ReservedMessages)) {
+        releaseReports(firstReport);
+        stats.messagesDropped.fetch_add(1, std::memory_order_relaxed);
+        if (target != 0) {
+            shadows[ShadowKey(lane, target)].generation = 0;
+        }
+        return false;
+    }
+
+    uint16_t index = freeMessages;
+    Message &message = messages[index];
+    freeMessages = message.next;
+    freeMessageCount--;
+
+    message.next = None;
+    message.lane = lane;
+    message.target = target;
+    message.firstReport = firstReport;
+    message.borrowed = borrowed;
+
+    if (queue.tail == None) {
+        queue.head = index;
+    } else {
+        messages[queue.tail].next = index;
+    }
+    queue.tail = index;
+    if (pending == 0 && !writing) {
+        progressAt.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    pending++;
+    if (pending > stats.depthHighWater.load(std::memory_order_relaxed)) {
+        stats.depthHighWater.store(pending, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void OutputQueue::releaseReports(uint16_t first) {
+    while (first != None) {
+        uint16_t next = reports[first].next;
+        reports[first].next = freeReports;
+        freeReports = first;
+        freeReportCount++;
+        first = next;
+    }
+}
+
+void OutputQueue::releaseMessage(uint16_t index) {
+    Message &message = messages[index];
+    releaseReports(message.firstReport);
+    message.firstReport = None;
+    message.borrowed = nullptr;
+    message.next = freeMessages;
+    freeMessages = index;
+    freeMessageCount++;
+}
+
+bool OutputQueue::reclaim(OutputLane lane, uint32_t target) {
+    if (target == 0 || lane == OutputLane::Control) {
+        return false;
+    }
+
+    Lane &queue = lanes[static_cast<int>(lane)];
+    uint16_t previous = None;
+    for (uint16_t index = queue.head; index != None; previous = index, index = messages[index].next) {
+        if (messages[index].target != target) {
+            continue;
+        }
+
+        if (previous == None) {
+            queue.head = messages[index].next;
+        } else {
+            messages[previous].next = messages[index].next;
+        }
+        if (queue.tail == index) {
+            queue.tail = previous;
+        }
+        releaseMessage(index);
+        pending--;
+        stats.messagesCoalesced.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    return false;
+}
+
+template <typename Predicate>
+void OutputQueue::dropQueued(Predicate matches) {
+    for (auto &queue : lanes) {
+        uint16_t previous = None;
+        for (uint16_t index = queue.head; index != None;) {
+            uint16_t next = messages[index].next;
+            if (!matches(messages[index])) {
+                previous = index;
+                index = next;
+                continue;
+            }
+
+            if (previous == None) {
+                queue.head = next;
+            } else {
+                messages[previous].next = next;
+            }
+            if (queue.tail == index) {
+                queue.tail = previous;
+            }
+
+            // The device never got the value, the next identical one must go out
+            if (messages[index].target != 0) {
+                shadows[ShadowKey(messages[index].lane, messages[index].target)].generation = 0;
+            }
+            releaseMessage(index);
+            pending--;
+            stats.messagesDropped.fetch_add(1, std::memory_order_relaxed);
+            index = next;
+        }
+    }
+}
+
+void OutputQueue::discard() {
+    std::lock_guard<std::mutex> lock(mutex);
+    dropQueued([](const Message &) {
+        return true;
+    });
+}
+
+void OutputQueue::invalidateShadows() {
+    std::lock_guard<std::mutex> lock(mutex);
+    shadowGeneration++;
+}
+
+OutputShadowSnapshot OutputQueue::snapshotShadows() {
+    std::lock_guard<std::mutex> lock(mutex);
+    OutputShadowSnapshot snapshot;
+    snapshot.reserve(shadows.size());
+    for (const auto &[key, shadow] : shadows) {
+        if (shadow.generation == shadowGeneration) {
+            snapshot.emplace_back(key, shadow.hash);
+        }
+    }
+    return snapshot;
+}
+
+void OutputQueue::restoreShadows(const OutputShadowSnapshot &snapshot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    shadowGeneration++;
+    for (const auto &[key, hash] : snapshot) {
+        shadows[key] = {hash, shadowGeneration};
+    }
+}
+
+void OutputQueue::setBudget(double reportsPerSecond, double burst) {
+    OutputScheduler::getInstance()->configure(budget, reportsPerSecond, burst);
+}
+
+size_t OutputQueue::pendingCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+bool OutputQueue::isIdle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending == 0 && !writing;
+}
+
+std::chrono::steady_clock::duration OutputQueue::stalledFor() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pending == 0 && !writing && !failing.load(std::memory_order_relaxed)) {
+        return {};
+    }
+
+    auto since = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(progressAt.load(std::memory_order_relaxed)));
+    return std::chrono::steady_clock::now() - since;
+}
+
+size_t OutputQueue::memoryFootprint() const {
+    return sizeof(*this) + reports.capacity() * sizeof(Report) + messages.capacity() * sizeof(Message) + shadows.size() * (sizeof(uint64_t) + sizeof(Shadow) + 2 * sizeof(void *));
+}
+
+uint16_t OutputQueue::takeNext() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]() {
+        return pending > 0 || stopping;
+    });
+
+    // Stopping ends the thread once everything left went out, or the flush ran out of time
+    if (stopping && pastFlushDeadline()) {
+        dropQueued([](const Message &) {
+            return true;
+        });
+    }
+    for (auto &queue : lanes) {
+        if (queue.head != None) {
+            uint16_t index = queue.head;
+            queue.head = messages[index].next;
+            if (queue.head == None) {
+                queue.tail = None;
+            }
+            pending--;
+            writing = true;
+            return index;
+        }
+    }
+
+    return None;
+}
+
+void OutputQueue::run(Writer writer, BatchWriter batchWriter, std::string name) {
+    ThreadScope scope(ThreadRole::Writer, "%s", name.c_str());
+
+    // The current message's reports, gathered so runs of them go out in one call. Borrowed
+    // tables (fonts) can be longer than the slab, they are gathered a slab's worth at a time so
+    // the batch never grows past what is reserved here.
+    std::vector<std::span<const uint8_t>> batch;
+    batch.reserve(ReportCapacity);
+
+    uint16_t index;
+    while ((index = takeNext()) != None) {
+        // The message is off its lane, nothing else touches it or its reports until released
+        const Message &message = messages[index];
+        size_t borrowedCount = message.borrowed ? message.borrowed->size() : 0;
+        size_t gathered = 0;
+        bool failed = false;
+        bool abandoned = false;
+        do {
+            batch.clear();
+            if (message.borrowed) {
+                size_t end = std::min<size_t>(borrowedCount, gathered + ReportCapacity);
+                for (; gathered < end; ++gathered) {
+                    batch.emplace_back((*message.borrowed)[gathered]);
+                }
+            }
+            for (uint16_t report = message.firstReport; report != None; report = reports[report].next) {
+                batch.emplace_back(reports[report].bytes.data(), reports[report].length);
+            }
+
+            size_t next = 0;
+            while (next < batch.size()) {
+                if (pastFlushDeadline()) {
+                    stats.reportsFailed.fetch_add(1, std::memory_order_relaxed);
+                    failed = true;
+                    abandoned = true;
+                    break;
+                }
+
+                // A flush on disconnect holds up the main thread, it does not wait for the budgets
+                uint32_t wanted = batchWriter ? static_cast<uint32_t>(batch.size() - next) : 1;
+                uint32_t granted = isFlushing() ? wanted : OutputScheduler::getInstance()->acquire(budget, message.lane, wanted);
+                std::span<const std::span<const uint8_t>> group(batch.data() + next, granted);
+
+                auto startedAt = std::chrono::steady_clock::now();
+                size_t written = granted > 1 ? batchWriter(group) : (writer(group[0]) ? 1 : 0);
+                auto finishedAt = std::chrono::steady_clock::now();
+                uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(finishedAt - startedAt).count() / granted;
+                stats.writeLatency[std::min<size_t>(std::bit_width(micros >> 6), OutputWriteLatencyBuckets - 1)].fetch_add(granted, std::memory_order_relaxed);
+
+                if (written > 0) {
+                    size_t bytes = 0;
+                    for (size_t i = 0; i < written; ++i) {
+                        bytes += group[i].size();
+                    }
+                    progressAt.store(finishedAt.time_since_epoch().count(), std::memory_order_relaxed);
+                    failing.store(false, std::memory_order_relaxed);
+                    stats.reportsWritten.fetch_add(written, std::memory_order_relaxed);
+                    stats.bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+                }
+                if (written < granted) {
+                    // The report after the written ones failed; the rest of the message still goes out
+                    stats.reportsFailed.fetch_add(1, std::memory_order_relaxed);
+                    failing.store(true, std::memory_order_relaxed);
+                    failed = true;
+                    written++;
+                }
+                next += written;
+            }
+        } while (!abandoned && gathered < borrowedCount);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // The device may not show the value, let the next identical one through
+        if (failed && message.target != 0) {
+            shadows[ShadowKey(message.lane, message.target)].generation = 0;
+        }
+        releaseMessage(index);
+        writing = false;
+    }
+}
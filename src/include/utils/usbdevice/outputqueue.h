@@ -0,0 +1,194 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Lanes in the order the writer serves them, which is also their priority on the shared bus
+// (see OutputScheduler)
+enum class OutputLane : uint8_t {
+    Haptics = 0, // Direct feedback to the pilot's input
+    Indicators,  // Annunciator LEDs
+    Control,     // Init sequences and font uploads, strictly ordered and never coalesced;
+                 // a target only skips an upload the device already has
+    Display,     // Display frames
+    Brightness,  // Backlight, screen and LED group brightness
+    Count
+};
+
+// Largest report the queue stores inline; display frames are sent as runs of these
+typedef std::array<uint8_t, 64> OutputReportBuffer;
+
+// Last value per lane and target, (lane << 32 | target, hash), see OutputShadowStore
+typedef std::vector<std::pair<uint64_t, uint64_t>> OutputShadowSnapshot;
+
+// Token bucket limiting a writer, only touched with the OutputScheduler's lock held
+struct OutputBudget {
+        double reportsPerSecond;
+        double burst;
+        double tokens;
+        std::chrono::steady_clock::time_point refilledAt{};
+};
+
+// Write latency buckets: under 64 us, under 128 us and so on, the last one counts everything slower
+static constexpr size_t OutputWriteLatencyBuckets = 12;
+
+struct OutputQueueStats {
+        std::atomic<uint64_t> messagesQueued{0};
+        std::atomic<uint64_t> messagesCoalesced{0};
+        std::atomic<uint64_t> messagesDeduplicated{0};
+        std::atomic<uint64_t> messagesDropped{0};
+        std::atomic<uint64_t> reportsWritten{0};
+        std::atomic<uint64_t> reportsFailed{0};
+        std::atomic<uint64_t> bytesWritten{0};
+        std::atomic<uint64_t> depthHighWater{0}; // Most messages queued at once
+        std::array<std::atomic<uint64_t>, OutputWriteLatencyBuckets> writeLatency{};
+};
+
+// Per-device output writer. Callers only enqueue; a dedicated thread performs the blocking
+// HID writes, so a slow or stalled endpoint never holds up a sim frame. A message is one or
+// more reports written back to back. Messages queued with the same non-zero target on a lane
+// replace each other until the writer picks them up, so only the latest value goes out, and
+// are dropped entirely while they match the last value handed over for that target.
+//
+// Reports are copied into a slab allocated once, so queueing never touches the heap. When the
+// slab is full (the endpoint stalled) a message that would replace a queued one takes over the
+// queued one's slots first; otherwise new messages are dropped and counted. Display frames never
+// take the last slots, which stay free for LED, brightness, haptics and control messages, so a
+// backlog of frames cannot push out state changes.
+class OutputQueue {
+    public:
+        static constexpr uint16_t ReportCapacity = 256;
+        static constexpr uint16_t MessageCapacity = 128;
+
+        typedef std::function<bool(std::span<const uint8_t> report)> Writer;
+        // Writes the reports in order with as few system calls as the device allows, returns how
+        // many went out before the first one that failed
+        typedef std::function<size_t(std::span<const std::span<const uint8_t>> reports)> BatchWriter;
+
+    private:
+        static constexpr uint16_t None = 0xFFFF;
+        static constexpr uint16_t ReservedReports = 64;
+        static constexpr uint16_t ReservedMessages = 32;
+
+        struct Report {
+                uint16_t next = None;
+                uint8_t length = 0;
+                OutputReportBuffer bytes;
+        };
+
+        struct Message {
+                uint16_t next = None;
+                OutputLane lane = OutputLane::Control;
+                uint32_t target = 0;
+                uint16_t firstReport = None;
+                const std::vector<std::vector<uint8_t>> *borrowed = nullptr;
+        };
+
+        struct Lane {
+                uint16_t head = None;
+                uint16_t tail = None;
+        };
+
+        struct Shadow {
+                uint64_t hash = 0;
+                uint64_t generation = 0;
+        };
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::vector<Report> reports;
+        std::vector<Message> messages;
+        uint16_t freeReports = None;
+        uint16_t freeMessages = None;
+        uint16_t freeReportCount = ReportCapacity;
+        uint16_t freeMessageCount = MessageCapacity;
+        Lane lanes[static_cast<int>(OutputLane::Count)];
+        std::thread thread;
+        bool stopping = false;
+        std::atomic<bool> running{false}; // Between start() and stop(), read without the lock
+        OutputBudget budget;
+        size_t pending = 0;
+        bool writing = false; // A message is off its lane and being written
+        // When a report last went out, or the queue last became busy, and whether the last
+        // write failed
+        std::atomic<std::chrono::steady_clock::rep> progressAt{0};
+        std::atomic<bool> failing{false};
+        // While stop() flushes: when it gives up on what is left, zero otherwise
+        std::atomic<std::chrono::steady_clock::rep> flushUntil{0};
+
+        // Hash of the last value queued per lane and target, i.e. what the device shows once the
+        // queue drained. Invalidation bumps the generation instead of freeing the entries.
+        std::unordered_map<uint64_t, Shadow> shadows;
+        uint64_t shadowGeneration = 1;
+
+        void run(Writer writer, BatchWriter batchWriter, std::string name);
+        uint16_t takeNext();
+        void releaseReports(uint16_t first);
+        void releaseMessage(uint16_t index);
+        // Unlinks and drops the queued messages matching the predicate, counted as dropped
+        template <typename Predicate>
+        void dropQueued(Predicate matches);
+        bool pastFlushDeadline() const;
+        bool isShadowed(OutputLane lane, uint32_t target, uint64_t hash);
+        bool appendReport(OutputLane lane, uint16_t &first, uint16_t &last, std::span<const uint8_t> report);
+        // Drops the message queued for target that a new one replaces, so its slots can be reused
+        bool reclaim(OutputLane lane, uint32_t target);
+        bool enqueue(OutputLane lane, uint32_t target, uint16_t firstReport, const std::vector<std::vector<uint8_t>> *borrowed);
+
+    public:
+        OutputQueueStats stats;
+
+        OutputQueue();
+        ~OutputQueue();
+
+        // Starts the writer thread if it is not running yet, name shows in the thread list. With
+        // a batchWriter, the reports of a message the budgets let through together (a display
+        // page) are handed over in one call.
+        void start(Writer writer, std::string name, BatchWriter batchWriter = nullptr);
+        // Writes the final state still queued, then joins the writer thread. Display frames and
+        // borrowed uploads (fonts) are dropped first, everything if the last write failed, and
+        // whatever did not go out within flushFor is dropped too; writes that would wait for
+        // the endpoint fail right away meanwhile (see isFlushing).
+        void stop(std::chrono::milliseconds flushFor);
+        bool isFlushing() const;
+        // Messages are only accepted while the writer runs
+        bool isRunning() const;
+
+        bool push(OutputLane lane, uint32_t target, std::span<const uint8_t> report);
+        bool push(OutputLane lane, uint32_t target, std::span<const OutputReportBuffer> reports);
+        // The reports are written straight from the caller's storage, which must outlive the
+        // queue (static tables such as fonts). The table's address identifies it for the shadow.
+        bool pushBorrowed(OutputLane lane, uint32_t target, const std::vector<std::vector<uint8_t>> &reports);
+
+        size_t pendingCount();
+        // Nothing queued and nothing being written
+        bool isIdle();
+        // How long output has been waiting without a report going out, or since the last
+        // report that went out if writes failed after it; zero while idle and healthy
+        std::chrono::steady_clock::duration stalledFor();
+        // Drops everything queued, for a device that is given up on
+        void discard();
+        size_t memoryFootprint() const;
+
+        // Rate the device accepts reports at, see OutputScheduler
+        void setBudget(double reportsPerSecond, double burst);
+
+        // Forgets what the device shows, e.g. after a reconnect, so the next values go out again
+        void invalidateShadows();
+        // What the device shows once everything queued went out, and restoring that into a
+        // new connection to the same device; call both while the writer is stopped
+        OutputShadowSnapshot snapshotShadows();
+        void restoreShadows(const OutputShadowSnapshot &snapshot);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "outputscheduler.h"
+
+#include <algorithm>
+
+static void Refill(OutputBudget &budget, std::chrono::steady_clock::time_point now) {
+    if (budget.refilledAt == std::chrono::steady_clock::time_point{}) {
+        budget.refilledAt = now;
+        return;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - budget.refilledAt).count();
+    budget.tokens = std::min(budget.burst, budget.tokens + elapsed * budget.reportsPerSecond);
+    budget.refilledAt = now;
+}
+
+static std::chrono::steady_clock::duration TimeUntilToken(const OutputBudget &budget) {
+    double seconds = std::max(0.0, 1.0 - budget.tokens) / budget.reportsPerSecond;
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)) + std::chrono::microseconds(50);
+}
+
+OutputScheduler::OutputScheduler() {
+    bus = DeviceBudget(BusReportsPerSecond, BusBurst);
+}
+
+OutputScheduler *OutputScheduler::getInstance() {
+    static OutputScheduler instance;
+    return &instance;
+}
+
+OutputBudget OutputScheduler::DeviceBudget(double reportsPerSecond, double burst) {
+    return {reportsPerSecond, burst, burst};
+}
+
+void OutputScheduler::configure(OutputBudget &budget, double reportsPerSecond, double burst) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget.reportsPerSecond = reportsPerSecond;
+    budget.burst = burst;
+    budget.tokens = std::min(budget.tokens, burst);
+}
+
+bool OutputScheduler::hasMoreUrgentContender(OutputLane lane) const {
+    for (size_t i = 0; i < static_cast<size_t>(lane); i++) {
+        if (contenders[i] > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t OutputScheduler::acquire(OutputBudget &device, OutputLane lane, uint32_t wanted) {
+    std::unique_lock<std::mutex> lock(mutex);
+    uint32_t &laneContenders = contenders[static_cast<size_t>(lane)];
+    bool contending = false;
+
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        Refill(device, now);
+        Refill(bus, now);
+
+        // Only writers their own device would let through compete for the bus
+        if (device.tokens < 1) {
+            if (contending) {
+                laneContenders--;
+                contending = false;
+                condition.notify_all();
+            }
+            stats.deviceWaits.fetch_add(1, std::memory_order_relaxed);
+            condition.wait_for(lock, TimeUntilToken(device));
+            continue;
+        }
+
+        if (!contending) {
+            laneContenders++;
+            contending = true;
+        }
+
+        if (hasMoreUrgentContender(lane)) {
+            stats.priorityWaits.fetch_add(1, std::memory_order_relaxed);
+            condition.wait_for(lock, TimeUntilToken(bus));
+            continue;
+        }
+
+        if (bus.tokens >= 1) {
+            uint32_t granted = static_cast<uint32_t>(std::max(1.0, std::min({(double) wanted, device.tokens, bus.tokens})));
+            device.tokens -= granted;
+            bus.tokens -= granted;
+            laneContenders--;
+            stats.reportsScheduled.fetch_add(granted, std::memory_order_relaxed);
+            if (std::any_of(contenders.begin(), contenders.end(), [](uint32_t count) { return count > 0; })) {
+                condition.notify_all();
+            }
+            return granted;
+        }
+
+        stats.busWaits.fetch_add(1, std::memory_order_relaxed);
+        condition.wait_for(lock, TimeUntilToken(bus));
+    }
+}
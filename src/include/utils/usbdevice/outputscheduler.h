@@ -0,0 +1,54 @@
+#ifndef OUTPUTSCHEDULER_H
+#define OUTPUTSCHEDULER_H
+
+#include "outputqueue.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+struct OutputSchedulerStats {
+        std::atomic<uint64_t> reportsScheduled{0};
+        std::atomic<uint64_t> deviceWaits{0};   // A device exceeded its own budget
+        std::atomic<uint64_t> busWaits{0};      // The bus budget was used up
+        std::atomic<uint64_t> priorityWaits{0}; // A more urgent lane of another device went first
+};
+
+// Shares the USB bus between the output writers of all devices. Every report takes a token from
+// its device's budget and from the bus budget, so the combined rate stays bounded and a burst
+// from one device (a full FMC page) cannot starve the others. While writers wait for the bus,
+// the most urgent lane goes first across devices, in OutputLane order.
+class OutputScheduler {
+    public:
+        static constexpr double BusReportsPerSecond = 2000;
+        static constexpr double BusBurst = 64;
+        static constexpr double DeviceReportsPerSecond = 1000; // One report per full-speed frame
+        static constexpr double DeviceBurst = 32;
+
+    private:
+        OutputScheduler();
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        OutputBudget bus;
+        std::array<uint32_t, static_cast<size_t>(OutputLane::Count)> contenders{};
+
+        bool hasMoreUrgentContender(OutputLane lane) const;
+
+    public:
+        OutputSchedulerStats stats;
+
+        static OutputScheduler *getInstance();
+
+        static OutputBudget DeviceBudget(double reportsPerSecond = DeviceReportsPerSecond, double burst = DeviceBurst);
+        void configure(OutputBudget &budget, double reportsPerSecond, double burst);
+
+        // Writer threads only: blocks until a report from this device and lane may go out, then
+        // grants up to wanted reports at once, as many as both budgets hold
+        uint32_t acquire(OutputBudget &device, OutputLane lane, uint32_t wanted = 1);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#include "outputshadowstore.h"
+
+OutputShadowStore::OutputShadowStore() {
+}
+
+OutputShadowStore *OutputShadowStore::getInstance() {
+    static OutputShadowStore instance;
+    return &instance;
+}
+
+uint32_t OutputShadowStore::Key(uint16_t vendorId, uint16_t productId) {
+    return (static_cast<uint32_t>(vendorId) << 16) | productId;
+}
+
+void OutputShadowStore::save(uint16_t vendorId, uint16_t productId, OutputShadowSnapshot snapshot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry &entry = entries[Key(vendorId, productId)];
+    entry.snapshot = std::move(snapshot);
+    entry.devices++;
+}
+
+void OutputShadowStore::forget(uint16_t vendorId, uint16_t productId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.erase(Key(vendorId, productId));
+}
+
+bool OutputShadowStore::take(uint16_t vendorId, uint16_t productId, OutputShadowSnapshot &snapshot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = entries.find(Key(vendorId, productId));
+    if (found == entries.end()) {
+        return false;
+    }
+
+    bool unique = found->second.devices == 1;
+    if (unique) {
+        snapshot = std::move(found->second.snapshot);
+    }
+    entries.erase(found);
+    return unique;
+}
@@ -0,0 +1,38 @@
+#ifndef OUTPUTSHADOWSTORE_H
+#define OUTPUTSHADOWSTORE_H
+
+#include "outputqueue.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// Keeps what each device showed when the plugin closed it (aircraft change, "Reload devices"),
+// so the next connection of the same model only sends what differs: LEDs, brightness levels,
+// display frames and the loaded FMC font. A device that was unplugged reset itself, its state
+// is forgotten and the next connection refreshes everything.
+class OutputShadowStore {
+    private:
+        struct Entry {
+                OutputShadowSnapshot snapshot;
+                uint32_t devices = 0; // Units of this model saved since the last take()
+        };
+
+        OutputShadowStore();
+
+        std::mutex mutex; // Devices connect on bring-up threads
+        std::unordered_map<uint32_t, Entry> entries;
+
+        static uint32_t Key(uint16_t vendorId, uint16_t productId);
+
+    public:
+        static OutputShadowStore *getInstance();
+
+        void save(uint16_t vendorId, uint16_t productId, OutputShadowSnapshot snapshot);
+        void forget(uint16_t vendorId, uint16_t productId);
+        // Removes the saved state; false if there is none, or several units of the model
+        // were saved and it is unknown which one connects.
+        bool take(uint16_t vendorId, uint16_t productId, OutputShadowSnapshot &snapshot);
+};
+
+#endif
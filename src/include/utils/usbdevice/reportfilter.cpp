@@ -0,0 +1,50 @@
+#include "reportfilter.h"
+
+#include <cstring>
+
+bool ReportFilter::accept(const uint8_t *report, int length) {
+    if (!report || length <= 0 || length > (int) sizeof(LastReport::data)) {
+        return true;
+    }
+
+    if (resyncRequested.exchange(false, std::memory_order_acquire)) {
+        reset();
+    }
+
+    LastReport *slot = nullptr;
+    for (auto &lastReport : lastReports) {
+        if (lastReport.valid && lastReport.reportId == report[0]) {
+            slot = &lastReport;
+            break;
+        }
+
+        if (!lastReport.valid && !slot) {
+            slot = &lastReport;
+        }
+    }
+
+    // More report IDs than we track: deliver everything for the extra ones
+    if (!slot) {
+        return true;
+    }
+
+    if (slot->valid && slot->length == length && memcmp(slot->data, report, length) == 0) {
+        return false;
+    }
+
+    slot->valid = true;
+    slot->reportId = report[0];
+    slot->length = length;
+    memcpy(slot->data, report, length);
+    return true;
+}
+
+void ReportFilter::resync() {
+    resyncRequested.store(true, std::memory_order_release);
+}
+
+void ReportFilter::reset() {
+    for (auto &lastReport : lastReports) {
+        lastReport.valid = false;
+    }
+}
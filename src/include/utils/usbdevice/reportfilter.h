@@ -0,0 +1,34 @@
+#ifndef REPORTFILTER_H
+#define REPORTFILTER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Reader-side filter that drops input reports byte-identical to the last report delivered
+// with the same report ID. Any change in a button bitmask or axis byte gets through, so no
+// press or release edge is lost. Only touched by the reader thread, except resync().
+class ReportFilter {
+    private:
+        static constexpr int MaxReportIds = 4;
+
+        struct LastReport {
+                bool valid = false;
+                uint8_t reportId = 0;
+                int length = 0;
+                uint8_t data[65];
+        };
+
+        LastReport lastReports[MaxReportIds];
+        std::atomic<bool> resyncRequested{false};
+
+    public:
+        // Returns true if the report should be delivered
+        bool accept(const uint8_t *report, int length);
+
+        // Lets the next report of every ID through even if it is unchanged, for consumers
+        // that reset their decoded state. Safe to call from any thread.
+        void resync();
+        void reset();
+};
+
+#endif
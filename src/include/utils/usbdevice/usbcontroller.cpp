@@ -1,8 +1,22 @@
 #include "usbcontroller.h"
 
 #include "appstate.h"
+#include "startup-profiler.h"
+#include "thread-registry.h"
 
 bool USBController::allProfilesReady() {
+    {
+        std::lock_guard<std::mutex> lock(bringUpMutex);
+        if (!bringUps.empty()) {
+            return false;
+        }
+    }
+#if LIN
+    if (isRetiring()) {
+        return false;
+    }
+#endif
+
     for (auto &device : devices) {
         if (!device->profileReady) {
             return false;
@@ -12,15 +26,135 @@ bool USBController::allProfilesReady() {
     return true;
 }
 
+void USBController::checkDeviceHealth() {
+    std::vector<USBDevice *> stalled;
+    for (auto *device : devices) {
+        if (device->isOutputStalled()) {
+            stalled.push_back(device);
+        }
+    }
+
+    for (auto *device : stalled) {
+#if LIN
+        debug_force("[%s] No output went out for %d s, reconnecting\n", device->classIdentifier(), OUTPUT_STALL_TIMEOUT_SECONDS);
+        reconnectDevice(device);
+#else
+        debug_throttled(10000, "[%s] No output went out for %d s\n", device->classIdentifier(), OUTPUT_STALL_TIMEOUT_SECONDS);
+#endif
+    }
+}
+
 void USBController::connectAllDevices() {
     AppState::getInstance()->executeAfter(0, [this]() {
+        StartupPhase phase("enumerate devices");
         enumerateDevices();
     });
 }
 
 void USBController::disconnectAllDevices() {
+#if LIN
+    // Closing on purpose (reload) is no reconnect, the units keep their counts
+    for (auto &[key, device] : devicesByPath) {
+        reconnectsByKey.emplace(key, device->stats.reconnects.load());
+    }
+#endif
     for (auto ptr : devices) {
         delete ptr;
     }
     devices.clear();
+#if LIN
+    devicesByPath.clear();
+#endif
+}
+
+void USBController::bringUpDevice(const std::string &key, std::function<USBDevice *()> open, std::function<void(USBDevice *)> registered) {
+    std::lock_guard<std::mutex> lock(bringUpMutex);
+    BringUp &bringUp = bringUps.emplace_back();
+    bringUp.key = key;
+    bringUp.registered = std::move(registered);
+    bringUp.thread = std::thread([this, &bringUp, open = std::move(open)]() {
+        ThreadScope scope(ThreadRole::BringUp, "ww-bringup");
+        USBDevice *device = open();
+
+        {
+            std::lock_guard<std::mutex> lock(bringUpMutex);
+            bringUp.device = device;
+            bringUp.finished = true;
+        }
+
+        AppState::getInstance()->executeAfter(0, [this]() {
+            registerBroughtUpDevices();
+        });
+    });
+}
+
+bool USBController::isBringingUp(const std::string &key) {
+    std::lock_guard<std::mutex> lock(bringUpMutex);
+    for (auto &bringUp : bringUps) {
+        if (bringUp.key == key && !bringUp.cancelled) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void USBController::cancelBringUp(const std::string &key) {
+    std::lock_guard<std::mutex> lock(bringUpMutex);
+    for (auto &bringUp : bringUps) {
+        if (bringUp.key == key) {
+            bringUp.cancelled = true;
+        }
+    }
+}
+
+void USBController::registerBroughtUpDevices() {
+    std::list<BringUp> finished;
+    {
+        std::lock_guard<std::mutex> lock(bringUpMutex);
+        for (auto it = bringUps.begin(); it != bringUps.end();) {
+            auto next = std::next(it);
+            if (it->finished) {
+                finished.splice(finished.end(), bringUps, it);
+            }
+            it = next;
+        }
+    }
+
+    for (auto &bringUp : finished) {
+        // The thread only has to return after handing over the device
+        bringUp.thread.join();
+
+        USBDevice *device = bringUp.device;
+        if (device && (bringUp.cancelled || shouldShutdown)) {
+            if (bringUp.cancelled) {
+                // Unplugged while coming up
+                device->markUnplugged();
+            }
+            delete device;
+            device = nullptr;
+        }
+
+        if (device) {
+            devices.push_back(device);
+        }
+
+        if (bringUp.registered) {
+            bringUp.registered(device);
+        }
+    }
+}
+
+void USBController::abandonBringUps() {
+    std::list<BringUp> pending;
+    {
+        std::lock_guard<std::mutex> lock(bringUpMutex);
+        pending.splice(pending.end(), bringUps);
+    }
+
+    // Spliced nodes keep their addresses, threads still finishing write into them
+    for (auto &bringUp : pending) {
+        bringUp.thread.join();
+        delete bringUp.device;
+    }
 }
@@ -3,8 +3,15 @@
 
 #include "usbdevice.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #if APL
@@ -24,12 +31,26 @@ typedef HANDLE HIDDeviceHandle;
 #include <libudev.h>
 typedef struct udev_monitor *HIDManagerHandle;
 typedef int HIDDeviceHandle;
+class FakeHIDDevice;
 #endif
 
 class USBController {
     private:
-        HIDManagerHandle hidManager;
-        bool shouldShutdown = false;
+        HIDManagerHandle hidManager = nullptr;
+        std::atomic<bool> shouldShutdown{false};
+
+        // A device being opened and initialized on its own thread
+        struct BringUp {
+                std::string key;
+                std::thread thread;
+                USBDevice *device = nullptr;
+                bool finished = false;
+                bool cancelled = false;
+                std::function<void(USBDevice *)> registered;
+        };
+
+        std::mutex bringUpMutex;
+        std::list<BringUp> bringUps;
 
         USBController();
         ~USBController();
@@ -37,11 +58,26 @@ class USBController {
 
         void enumerateDevices();
 
+        // Runs open() (open, identification and the handshake writes in the product's
+        // constructor) on a new thread, so several devices come up in parallel and the sim never
+        // waits on them. The finished device is added to devices on the main thread, then
+        // registered() runs there with it, or with nullptr if opening failed or was cancelled.
+        void bringUpDevice(const std::string &key, std::function<USBDevice *()> open, std::function<void(USBDevice *)> registered);
+        bool isBringingUp(const std::string &key);
+        void cancelBringUp(const std::string &key);
+        void registerBroughtUpDevices();
+        // Waits for all bring-up threads and deletes the devices they opened
+        void abandonBringUps();
+
 #if APL
         static void DeviceAddedCallback(void *context, IOReturn result, void *sender, IOHIDDeviceRef device);
         static void DeviceRemovedCallback(void *context, IOReturn result, void *sender, IOHIDDeviceRef device);
         bool deviceExistsWithHIDDevice(IOHIDDeviceRef device);
 #elif IBM
+        std::thread monitorThread;
+        std::mutex monitorMutex;
+        std::condition_variable monitorCondition;
+
         void checkForDeviceChanges();
         void enumerateHidDevices(std::function<void(HANDLE, const std::string &)> deviceHandler);
         USBDevice *createDeviceFromHandle(HANDLE hidDevice, const std::string &devicePath);
@@ -52,10 +88,64 @@ class USBController {
 #elif LIN
         static void DeviceAddedCallback(void *context, struct udev_device *device);
         static void DeviceRemovedCallback(void *context, struct udev_device *device);
-        void monitorDevices();
+        bool receiveMonitorEvents();
         USBDevice *createDeviceFromPath(const std::string &devicePath);
-        bool deviceExistsAtPath(const std::string &devicePath);
+        // Main thread: brings the node up unless it is open or coming up already
         void addDeviceFromPath(const std::string &devicePath);
+
+        // Net effect of a node's udev events since the batch started
+        struct HotplugEvent {
+                std::string devicePath;
+                bool removed = false; // A device open on the node is gone
+                bool present = false; // The last event was an add
+        };
+
+        // Events are collected on the reactor thread until none arrived for
+        // HOTPLUG_BATCH_MILLISECONDS, then applied on the main thread in one pass
+        std::mutex hotplugMutex;
+        std::vector<HotplugEvent> hotplugEvents;
+        void queueHotplugEvent(const std::string &devicePath, bool added);
+        void applyHotplugEvents();
+
+        // Device node of every open device, main thread only
+        std::unordered_map<std::string, USBDevice *> devicesByPath;
+        // Reconnect counts of units that are gone or being reopened, by devicesByPath key
+        std::unordered_map<std::string, uint32_t> reconnectsByKey;
+        // Records a device opened on key and carries over the count of the unit open there before
+        void trackDevice(const std::string &key, USBDevice *device);
+        // The unit on key was unplugged or closed for a stall, it counts a reconnect once back
+        void didLoseDevice(const std::string &key, USBDevice *device);
+
+        // Hardware-free devices requested through WINWING_FAKE_DEVICES, see FakeHIDDevice
+        std::vector<std::unique_ptr<FakeHIDDevice>> fakeDevices;
+        void createFakeDevices();
+        void addFakeDevices();
+
+        // Devices winwing-hid-helper has open, when it owns the hidraw nodes (WINWING_HID_SERVICE)
+        void syncServiceDevices();
+
+        // A stalled device being retired: its writer is joined on its own thread, since the
+        // write in progress may take until the driver's timeout, then the main thread deletes
+        // the device and opens its key again
+        struct Retirement {
+                std::string key;
+                std::thread thread;
+                USBDevice *device = nullptr;
+                bool finished = false;
+        };
+
+        std::mutex retireMutex;
+        std::list<Retirement> retirements;
+        void finishRetirements();
+        // Waits for all retire threads and deletes their devices
+        void abandonRetirements();
+        bool isRetiring();
+
+        // Closes a device whose output stalled and opens its node again
+        void reconnectDevice(USBDevice *device);
+        // Main thread: opens the device behind a devicesByPath key unless it is open already
+        void reopenDevice(const std::string &key);
+        void addFakeDevice(FakeHIDDevice *fake);
 #endif
 
     public:
@@ -64,6 +154,8 @@ class USBController {
         void destroy();
 
         bool allProfilesReady();
+        // Main thread: reconnects devices whose output stalled (Linux), see USBDevice::isOutputStalled
+        void checkDeviceHealth();
         void connectAllDevices();
         void disconnectAllDevices();
 };
@@ -1,29 +1,61 @@
 #if LIN
 #include "appstate.h"
 #include "config.h"
+#include "fakehid.h"
+#include "hidreactor.h"
+#include "hidserviceclient.h"
+#include "thread-registry.h"
 #include "usbcontroller.h"
 #include "usbdevice.h"
 
-#include <atomic>
-#include <chrono>
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
-#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <libudev.h>
 #include <linux/hidraw.h>
+#include <sstream>
 #include <sys/ioctl.h>
-#include <sys/select.h>
 #include <sys/stat.h>
-#include <thread>
 #include <unistd.h>
 #include <XPLMUtilities.h>
 
 USBController *USBController::instance = nullptr;
-static std::atomic<bool> shouldStopMonitoring{false};
+
+// Reads the vendor from the USB device the hidraw node belongs to, so other devices are never opened
+static bool IsWinwingDevice(struct udev_device *device) {
+    struct udev_device *usbDevice = udev_device_get_parent_with_subsystem_devtype(device, "usb", "usb_device");
+    if (!usbDevice) {
+        // Virtual (uhid) devices only have the HID parent, whose HID_ID is "bus:vendor:product"
+        struct udev_device *hidDevice = udev_device_get_parent_with_subsystem_devtype(device, "hid", nullptr);
+        const char *hidId = hidDevice ? udev_device_get_property_value(hidDevice, "HID_ID") : nullptr;
+        const char *vendorId = hidId ? strchr(hidId, ':') : nullptr;
+        return vendorId && strtoul(vendorId + 1, nullptr, 16) == WINWING_VENDOR_ID;
+    }
+
+    const char *vendorId = udev_device_get_sysattr_value(usbDevice, "idVendor");
+    if (!vendorId) {
+        vendorId = udev_device_get_property_value(usbDevice, "ID_VENDOR_ID");
+    }
+
+    return vendorId && strtoul(vendorId, nullptr, 16) == WINWING_VENDOR_ID;
+}
 
 USBController::USBController() {
+    createFakeDevices();
+
+    // The helper process opens the nodes and watches for hot-plug, udev is not needed here
+    bool service = HIDServiceClient::getInstance()->start([this]() {
+        AppState::getInstance()->executeAfter(0, [this]() {
+            syncServiceDevices();
+        });
+    });
+    if (service) {
+        return;
+    }
+
     struct udev *udev = udev_new();
     if (!udev) {
         return;
@@ -38,11 +70,9 @@ USBController::USBController() {
     udev_monitor_filter_add_match_subsystem_devtype(hidManager, "hidraw", nullptr);
     udev_monitor_enable_receiving(hidManager);
 
-    shouldStopMonitoring = false;
-    std::thread monitorThread([this]() {
-        monitorDevices();
+    HIDReactor::getInstance()->add(udev_monitor_get_fd(hidManager), [this]() {
+        return receiveMonitorEvents();
     });
-    monitorThread.detach();
 }
 
 USBController::~USBController() {
@@ -57,15 +87,23 @@ USBController *USBController::getInstance() {
 }
 
 void USBController::destroy() {
-    shouldStopMonitoring = true;
+    shouldShutdown = true;
+    if (hidManager) {
+        HIDReactor::getInstance()->remove(udev_monitor_get_fd(hidManager));
+    }
 
-    // Give the monitoring thread time to exit gracefully
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    abandonBringUps();
+    abandonRetirements();
 
     for (auto ptr : devices) {
         delete ptr;
     }
     devices.clear();
+    devicesByPath.clear();
+    fakeDevices.clear();
+
+    HIDServiceClient::getInstance()->stop();
+    HIDReactor::getInstance()->shutdown();
 
     if (hidManager) {
         struct udev *udev = udev_monitor_get_udev(hidManager);
@@ -78,7 +116,8 @@ void USBController::destroy() {
 }
 
 USBDevice *USBController::createDeviceFromPath(const std::string &devicePath) {
-    int fd = open(devicePath.c_str(), O_RDWR);
+    // Non-blocking: neither an open nor a read may hang on a device that stopped answering
+    int fd = open(devicePath.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
         return nullptr;
     }
@@ -95,38 +134,41 @@ USBDevice *USBController::createDeviceFromPath(const std::string &devicePath) {
         return nullptr;
     }
 
-    return USBDevice::Device(fd, info.vendor, info.product, "Winwing", std::string(name));
-}
-
-bool USBController::deviceExistsAtPath(const std::string &devicePath) {
-    for (auto *dev : devices) {
-        if (dev->hidDevice >= 0) {
-            char existingPath[256];
-            snprintf(existingPath, sizeof(existingPath), "/proc/self/fd/%d", dev->hidDevice);
-            char linkTarget[256];
-            ssize_t len = readlink(existingPath, linkTarget, sizeof(linkTarget) - 1);
-            if (len > 0) {
-                linkTarget[len] = '\0';
-                if (strcmp(linkTarget, devicePath.c_str()) == 0) {
-                    return true;
-                }
-            }
-        }
+    USBDevice *device = USBDevice::Device(fd, info.vendor, info.product, "Winwing", std::string(name));
+    if (!device) {
+        close(fd);
     }
-    return false;
+    return device;
 }
 
 void USBController::addDeviceFromPath(const std::string &devicePath) {
-    AppState::getInstance()->executeAfter(0, [this, devicePath]() {
-        if (deviceExistsAtPath(devicePath)) {
-            return;
-        }
+    if (devicesByPath.count(devicePath) || isBringingUp(devicePath)) {
+        return;
+    }
 
-        USBDevice *device = createDeviceFromPath(devicePath);
+    auto open = [this, devicePath]() {
+        return createDeviceFromPath(devicePath);
+    };
+    auto registered = [this, devicePath](USBDevice *device) {
         if (device) {
-            devices.push_back(device);
+            trackDevice(devicePath, device);
         }
-    });
+    };
+    bringUpDevice(devicePath, open, registered);
+}
+
+void USBController::trackDevice(const std::string &key, USBDevice *device) {
+    devicesByPath[key] = device;
+
+    auto found = reconnectsByKey.find(key);
+    if (found != reconnectsByKey.end()) {
+        device->stats.reconnects = found->second;
+        reconnectsByKey.erase(found);
+    }
+}
+
+void USBController::didLoseDevice(const std::string &key, USBDevice *device) {
+    reconnectsByKey[key] = device->stats.reconnects + 1;
 }
 
 void USBController::enumerateDevices() {
@@ -134,60 +176,299 @@ void USBController::enumerateDevices() {
         return;
     }
 
-    DIR *dir = opendir("/dev");
-    if (!dir) {
+    addFakeDevices();
+    syncServiceDevices();
+
+    if (!hidManager) {
+        return;
+    }
+
+    struct udev *udev = udev_monitor_get_udev(hidManager);
+    struct udev_enumerate *enumerate = udev_enumerate_new(udev);
+    if (!enumerate) {
         return;
     }
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (strncmp(entry->d_name, "hidraw", 6) == 0) {
-            std::string devicePath = "/dev/" + std::string(entry->d_name);
-            addDeviceFromPath(devicePath);
+    // Only sysfs is read here; nodes are opened for Winwing interfaces alone
+    udev_enumerate_add_match_subsystem(enumerate, "hidraw");
+    udev_enumerate_scan_devices(enumerate);
+
+    int nodeCount = 0;
+    int winwingCount = 0;
+    struct udev_list_entry *entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+        struct udev_device *device = udev_device_new_from_syspath(udev, udev_list_entry_get_name(entry));
+        if (!device) {
+            continue;
+        }
+
+        nodeCount++;
+        const char *devicePath = udev_device_get_devnode(device);
+        if (devicePath && IsWinwingDevice(device)) {
+            winwingCount++;
+            addDeviceFromPath(std::string(devicePath));
         }
+        udev_device_unref(device);
     }
-    closedir(dir);
+    udev_enumerate_unref(enumerate);
+
+    debug("Found %d Winwing interfaces among %d hidraw nodes\n", winwingCount, nodeCount);
 }
 
-void USBController::monitorDevices() {
-    if (!AppState::getInstance()->pluginInitialized || shouldStopMonitoring) {
+void USBController::createFakeDevices() {
+    // Comma separated models with an optional input rate, e.g. "fmc,pap3@500". uhid devices need
+    // write access to /dev/uhid and are then found through udev like real ones.
+    const char *models = getenv("WINWING_FAKE_DEVICES");
+    if (!models || !*models) {
         return;
     }
 
-    int fd = udev_monitor_get_fd(hidManager);
-    while (!shouldStopMonitoring) {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
+    const char *transportName = getenv("WINWING_FAKE_HID_TRANSPORT");
+    auto transport = transportName && strcmp(transportName, "uhid") == 0 ? FakeHIDDevice::Transport::UHID : FakeHIDDevice::Transport::Socketpair;
+
+    std::stringstream stream(models);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        double reportsPerSecond = 125;
+        size_t at = item.find('@');
+        if (at != std::string::npos) {
+            reportsPerSecond = atof(item.c_str() + at + 1);
+            item.resize(at);
+        }
+
+        const FakeHIDModel *model = FakeHIDDevice::Model(item);
+        if (!model) {
+            debug_force("[FakeHID] Unknown model '%s'\n", item.c_str());
+            continue;
+        }
+
+        auto fake = std::make_unique<FakeHIDDevice>(*model, transport);
+        fake->setInputRate(reportsPerSecond);
+        if (!fake->start()) {
+            continue;
+        }
+
+        debug_force("[FakeHID] Emulating %s at %.0f input reports/s\n", model->productName, reportsPerSecond);
+        fakeDevices.push_back(std::move(fake));
+    }
+}
 
-        struct timeval timeout = {1, 0};
-        int ret = select(fd + 1, &fds, nullptr, nullptr, &timeout);
+void USBController::addFakeDevices() {
+    for (auto &fake : fakeDevices) {
+        addFakeDevice(fake.get());
+    }
+}
 
-        if (ret > 0 && FD_ISSET(fd, &fds) && !shouldStopMonitoring) {
-            struct udev_device *device = udev_monitor_receive_device(hidManager);
+void USBController::addFakeDevice(FakeHIDDevice *fake) {
+    if (fake->getTransport() != FakeHIDDevice::Transport::Socketpair) {
+        return;
+    }
+
+    std::string key = std::string("fake:") + fake->getModel().key;
+    if (devicesByPath.count(key) || isBringingUp(key)) {
+        return;
+    }
+
+    auto open = [fake]() -> USBDevice * {
+        int fd = fake->openDeviceFd();
+        if (fd < 0) {
+            return nullptr;
+        }
+
+        const FakeHIDModel &model = fake->getModel();
+        USBDevice *result = USBDevice::Device(fd, WINWING_VENDOR_ID, model.productId, "Winwing", model.productName);
+        if (!result) {
+            close(fd);
+        }
+        return result;
+    };
+    auto registered = [this, key](USBDevice *device) {
+        if (device) {
+            trackDevice(key, device);
+        }
+    };
+    bringUpDevice(key, open, registered);
+}
+
+void USBController::syncServiceDevices() {
+    HIDServiceClient *service = HIDServiceClient::getInstance();
+    std::vector<HIDServiceClient::Device> available = service->availableDevices();
+    auto KeyOf = [](uint16_t id) {
+        return std::string("service:") + std::to_string(id);
+    };
+    auto IsGone = [&](const std::string &key) {
+        return key.rfind("service:", 0) == 0 && std::none_of(available.begin(), available.end(), [&](const HIDServiceClient::Device &candidate) {
+            return KeyOf(candidate.id) == key;
+        });
+    };
+
+    // Gone from the helper: unplugged, or the helper itself went away
+    {
+        std::lock_guard<std::mutex> lock(bringUpMutex);
+        for (auto &bringUp : bringUps) {
+            if (IsGone(bringUp.key)) {
+                bringUp.cancelled = true;
+            }
+        }
+    }
+    std::vector<std::string> removed;
+    for (auto &[key, device] : devicesByPath) {
+        if (IsGone(key)) {
+            removed.push_back(key);
+        }
+    }
+    for (const std::string &key : removed) {
+        USBDevice *device = devicesByPath[key];
+        didLoseDevice(key, device);
+        devicesByPath.erase(key);
+        devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end());
+        device->markUnplugged();
+        delete device;
+    }
+
+    for (const HIDServiceClient::Device &offered : available) {
+        std::string key = KeyOf(offered.id);
+        if (devicesByPath.count(key) || isBringingUp(key)) {
+            continue;
+        }
+
+        auto open = [service, offered]() -> USBDevice * {
+            int handle = service->open(offered.id);
+            if (handle < 0) {
+                return nullptr;
+            }
+
+            USBDevice *result = USBDevice::Device(handle, offered.vendorId, offered.productId, "Winwing", offered.productName);
+            if (!result) {
+                service->close(handle);
+            }
+            return result;
+        };
+        auto registered = [this, key](USBDevice *device) {
             if (device) {
-                const char *action = udev_device_get_action(device);
-                if (strcmp(action, "add") == 0) {
-                    DeviceAddedCallback(this, device);
-                } else if (strcmp(action, "remove") == 0) {
-                    DeviceRemovedCallback(this, device);
-                }
-                udev_device_unref(device);
+                trackDevice(key, device);
             }
+        };
+        bringUpDevice(key, open, registered);
+    }
+}
+
+void USBController::reconnectDevice(USBDevice *device) {
+    std::string key;
+    for (auto it = devicesByPath.begin(); it != devicesByPath.end(); ++it) {
+        if (it->second == device) {
+            key = it->first;
+            didLoseDevice(key, device);
+            devicesByPath.erase(it);
+            break;
         }
     }
-    debug("Monitoring thread is exiting\n");
+    devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end());
+    device->markUnhealthy();
+
+    std::lock_guard<std::mutex> lock(retireMutex);
+    Retirement &retirement = retirements.emplace_back();
+    retirement.key = key;
+    retirement.device = device;
+    retirement.thread = std::thread([this, &retirement, device]() {
+        ThreadScope scope(ThreadRole::BringUp, "ww-retire");
+        device->stopOutput();
+
+        {
+            std::lock_guard<std::mutex> lock(retireMutex);
+            retirement.finished = true;
+        }
+
+        AppState::getInstance()->executeAfter(0, [this]() {
+            finishRetirements();
+        });
+    });
+}
+
+void USBController::finishRetirements() {
+    std::list<Retirement> finished;
+    {
+        std::lock_guard<std::mutex> lock(retireMutex);
+        for (auto it = retirements.begin(); it != retirements.end();) {
+            auto next = std::next(it);
+            if (it->finished) {
+                finished.splice(finished.end(), retirements, it);
+            }
+            it = next;
+        }
+    }
+
+    for (auto &retirement : finished) {
+        retirement.thread.join();
+
+        // What the device shows is unknown after the stall, the new connection sends everything
+        retirement.device->markUnplugged();
+        delete retirement.device;
+
+        if (!shouldShutdown && !retirement.key.empty()) {
+            reopenDevice(retirement.key);
+        }
+    }
+}
+
+void USBController::abandonRetirements() {
+    std::list<Retirement> pending;
+    {
+        std::lock_guard<std::mutex> lock(retireMutex);
+        pending.splice(pending.end(), retirements);
+    }
+
+    for (auto &retirement : pending) {
+        retirement.thread.join();
+        delete retirement.device;
+    }
+}
+
+bool USBController::isRetiring() {
+    std::lock_guard<std::mutex> lock(retireMutex);
+    return !retirements.empty();
+}
+
+void USBController::reopenDevice(const std::string &key) {
+    if (key.rfind("service:", 0) == 0) {
+        syncServiceDevices();
+    } else if (key.rfind("fake:", 0) == 0) {
+        auto fake = std::find_if(fakeDevices.begin(), fakeDevices.end(), [&](const std::unique_ptr<FakeHIDDevice> &candidate) {
+            return key == std::string("fake:") + candidate->getModel().key;
+        });
+        if (fake != fakeDevices.end()) {
+            addFakeDevice(fake->get());
+        }
+    } else {
+        addDeviceFromPath(key);
+    }
+}
+
+bool USBController::receiveMonitorEvents() {
+    // Called on the reactor thread whenever the monitor fd is readable
+    struct udev_device *device;
+    while ((device = udev_monitor_receive_device(hidManager)) != nullptr) {
+        const char *action = udev_device_get_action(device);
+        if (action && strcmp(action, "add") == 0) {
+            DeviceAddedCallback(this, device);
+        } else if (action && strcmp(action, "remove") == 0) {
+            DeviceRemovedCallback(this, device);
+        }
+        udev_device_unref(device);
+    }
+
+    return true;
 }
 
 void USBController::DeviceAddedCallback(void *context, struct udev_device *device) {
     auto *self = static_cast<USBController *>(context);
 
     const char *devicePath = udev_device_get_devnode(device);
-    if (!devicePath) {
+    if (!devicePath || !IsWinwingDevice(device)) {
         return;
     }
 
-    self->addDeviceFromPath(std::string(devicePath));
+    self->queueHotplugEvent(std::string(devicePath), true);
 }
 
 void USBController::DeviceRemovedCallback(void *context, struct udev_device *device) {
@@ -198,48 +479,65 @@ void USBController::DeviceRemovedCallback(void *context, struct udev_device *dev
         return;
     }
 
-    // First pass: disconnect
-    for (auto it = self->devices.begin(); it != self->devices.end(); ++it) {
-        if ((*it)->hidDevice >= 0) {
-            char existingPath[256];
-            snprintf(existingPath, sizeof(existingPath), "/proc/self/fd/%d", (*it)->hidDevice);
-            char linkTarget[256];
-            ssize_t len = readlink(existingPath, linkTarget, sizeof(linkTarget) - 1);
-            if (len > 0) {
-                linkTarget[len] = '\0';
-                if (strcmp(linkTarget, devicePath) == 0) {
-                    (*it)->disconnect();
-                    break;
-                }
-            }
-        } else {
-            (*it)->disconnect();
-            break;
+    self->queueHotplugEvent(std::string(devicePath), false);
+}
+
+void USBController::queueHotplugEvent(const std::string &devicePath, bool added) {
+    {
+        std::lock_guard<std::mutex> lock(hotplugMutex);
+        auto event = std::find_if(hotplugEvents.begin(), hotplugEvents.end(), [&](const HotplugEvent &candidate) {
+            return candidate.devicePath == devicePath;
+        });
+        if (event == hotplugEvents.end()) {
+            event = hotplugEvents.insert(hotplugEvents.end(), {devicePath});
         }
+
+        // An add followed by a remove cancels out; a remove followed by an add is a new device
+        event->present = added;
+        event->removed = event->removed || !added;
     }
 
-    // Second pass: deferred erase
-    AppState::getInstance()->executeAfter(0, [self, devicePath = std::string(devicePath)]() {
-        for (auto it = self->devices.begin(); it != self->devices.end();) {
-            if (!(*it) || !(*it)->profileReady) {
-                delete *it;
-                it = self->devices.erase(it);
+    // Every event restarts the window, so a hub full of devices is applied once it settled
+    AppState::getInstance()->executeAfterDebounced("usb-hotplug", HOTPLUG_BATCH_MILLISECONDS, [this]() {
+        applyHotplugEvents();
+    });
+}
+
+void USBController::applyHotplugEvents() {
+    std::vector<HotplugEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(hotplugMutex);
+        events.swap(hotplugEvents);
+    }
+    if (shouldShutdown) {
+        return;
+    }
+
+    int removedCount = 0;
+    int addedCount = 0;
+    for (const HotplugEvent &event : events) {
+        if (event.removed) {
+            auto found = devicesByPath.find(event.devicePath);
+            if (found == devicesByPath.end()) {
+                // Unplugged while still coming up
+                cancelBringUp(event.devicePath);
             } else {
-                char existingPath[256];
-                snprintf(existingPath, sizeof(existingPath), "/proc/self/fd/%d", (*it)->hidDevice);
-                char linkTarget[256];
-                ssize_t len = readlink(existingPath, linkTarget, sizeof(linkTarget) - 1);
-                if (len > 0) {
-                    linkTarget[len] = '\0';
-                    if (strcmp(linkTarget, devicePath.c_str()) == 0) {
-                        delete *it;
-                        it = self->devices.erase(it);
-                        continue;
-                    }
-                }
-                ++it;
+                USBDevice *device = found->second;
+                didLoseDevice(event.devicePath, device);
+                devicesByPath.erase(found);
+                devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end());
+                device->markUnplugged();
+                delete device;
+                removedCount++;
             }
         }
-    });
+
+        if (event.present && !devicesByPath.count(event.devicePath) && !isBringingUp(event.devicePath)) {
+            addDeviceFromPath(event.devicePath);
+            addedCount++;
+        }
+    }
+
+    debug("Hot-plug: %zu nodes changed, %d devices removed, %d coming up\n", events.size(), removedCount, addedCount);
 }
 #endif
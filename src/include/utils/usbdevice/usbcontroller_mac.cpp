@@ -152,6 +152,7 @@ void USBController::DeviceRemovedCallback(void *context, IOReturn result, void *
     auto *self = static_cast<USBController *>(context);
     for (auto it = self->devices.begin(); it != self->devices.end(); ) {
         if ((*it)->hidDevice == device) {
+            (*it)->markUnplugged();
             (*it)->disconnect();
             ++it;
         } else {
@@ -1,6 +1,7 @@
 #if IBM
 #include "appstate.h"
 #include "config.h"
+#include "thread-registry.h"
 #include "usbcontroller.h"
 #include "usbdevice.h"
 
@@ -26,15 +27,15 @@ static std::set<std::pair<uint16_t, uint16_t>> pendingDevices;
 USBController::USBController() {
     enumerateDevices();
 
-    std::thread monitorThread([this]() {
-        while (!shouldShutdown) {
-            std::this_thread::sleep_for(std::chrono::seconds(5));
-            if (!shouldShutdown) {
-                checkForDeviceChanges();
-            }
+    monitorThread = std::thread([this]() {
+        ThreadScope scope(ThreadRole::Monitor, "ww-hid-monitor");
+        std::unique_lock<std::mutex> lock(monitorMutex);
+        while (!monitorCondition.wait_for(lock, std::chrono::seconds(5), [this]() { return shouldShutdown.load(); })) {
+            lock.unlock();
+            checkForDeviceChanges();
+            lock.lock();
         }
     });
-    monitorThread.detach();
 }
 
 USBController::~USBController() {
@@ -49,9 +50,18 @@ USBController *USBController::getInstance() {
 }
 
 void USBController::destroy() {
-    shouldShutdown = true;
+    {
+        std::lock_guard<std::mutex> lock(monitorMutex);
+        shouldShutdown = true;
+    }
+    monitorCondition.notify_all();
+
+    // Returns at once unless a scan is running, which then finishes first
+    if (monitorThread.joinable()) {
+        monitorThread.join();
+    }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    abandonBringUps();
 
     for (auto ptr : devices) {
         devicePaths.erase(ptr);
@@ -83,9 +93,8 @@ USBDevice *USBController::createDeviceFromHandle(HANDLE hidDevice, const std::st
     WideCharToMultiByte(CP_UTF8, 0, productName, -1, productNameA, sizeof(productNameA), nullptr, nullptr);
 
     USBDevice *device = USBDevice::Device(hidDevice, attributes.VendorID, attributes.ProductID, std::string(vendorNameA), std::string(productNameA));
-
-    if (device) {
-        devicePaths[device] = devicePath;
+    if (!device) {
+        CloseHandle(hidDevice);
     }
     return device;
 }
@@ -143,14 +152,17 @@ void USBController::addDeviceFromHandle(HANDLE hidDevice, const std::string &dev
     uint16_t vendorId = attributes.VendorID;
     uint16_t productId = attributes.ProductID;
 
-    AppState::getInstance()->executeAfter(0, [this, hidDevice, devicePath, vendorId, productId]() {
-        USBDevice *device = createDeviceFromHandle(hidDevice, devicePath);
+    auto open = [this, hidDevice, devicePath]() {
+        return createDeviceFromHandle(hidDevice, devicePath);
+    };
+    auto registered = [devicePath, vendorId, productId](USBDevice *device) {
         if (device) {
-            devices.push_back(device);
+            devicePaths[device] = devicePath;
         }
 
         pendingDevices.erase(std::make_pair(vendorId, productId));
-    });
+    };
+    bringUpDevice(devicePath, open, registered);
 }
 
 void USBController::enumerateHidDevices(std::function<void(HANDLE, const std::string &)> deviceHandler) {
@@ -222,24 +234,29 @@ void USBController::checkForDeviceChanges() {
         }
     });
 
-    // First pass: disconnect stale devices
-    for (auto *dev : devices) {
-        auto pathIt = devicePaths.find(dev);
-        bool found = false;
-        if (pathIt != devicePaths.end()) {
-            found = std::find(currentDevicePaths.begin(), currentDevicePaths.end(), pathIt->second) != currentDevicePaths.end();
-        }
-        if (!found || dev->hidDevice == INVALID_HANDLE_VALUE || !dev->connected) {
-            dev->disconnect();
+    // Devices belong to the main thread, stale ones are disconnected and erased there
+    AppState::getInstance()->executeAfter(0, [this, currentDevicePaths = std::move(currentDevicePaths)]() {
+        // First pass: disconnect stale devices
+        for (auto *dev : devices) {
+            auto pathIt = devicePaths.find(dev);
+            bool found = false;
+            if (pathIt != devicePaths.end()) {
+                found = std::find(currentDevicePaths.begin(), currentDevicePaths.end(), pathIt->second) != currentDevicePaths.end();
+            }
+            if (!found || dev->hidDevice == INVALID_HANDLE_VALUE || !dev->connected) {
+                if (!found) {
+                    dev->markUnplugged();
+                }
+                dev->disconnect();
+            }
         }
-    }
 
-    // Second pass: deferred erase
-    AppState::getInstance()->executeAfter(0, [this]() {
+        // Second pass: deferred erase
         for (auto it = devices.begin(); it != devices.end();) {
             auto pathIt = devicePaths.find(*it);
             bool remove = false;
-            if (!(*it)->profileReady || (*it)->hidDevice == INVALID_HANDLE_VALUE || !(*it)->connected) {
+            // Not on profileReady: profiles load on the first update after registration
+            if ((*it)->hidDevice == INVALID_HANDLE_VALUE || !(*it)->connected) {
                 remove = true;
             }
             if (pathIt != devicePaths.end() &&
@@ -1,10 +1,13 @@
 #include "usbdevice.h"
 
 #include "appstate.h"
+#include "hidcapture.h"
+#include "outputshadowstore.h"
 #include "product-fcu-efis.h"
 #include "product-fmc.h"
 #include "pap3_device.h"
 #include "product-ursa-minor-joystick.h"
+#include "startup-profiler.h"
 
 #include <XPLMUtilities.h>
 
@@ -14,6 +17,8 @@ USBDevice *USBDevice::Device(HIDDeviceHandle hidDevice, uint16_t vendorId, uint1
         return nullptr;
     }
 
+    StartupPhase phase("open %s", productName.c_str());
+
     switch (productId) {
         case 0xBC27: // URSA MINOR Airline Joystick L
         case 0xBC28: // URSA MINOR Airline Joystick R
@@ -88,7 +93,7 @@ const char *USBDevice::classIdentifier() {
     return "USBDevice (none)";
 }
 
-void USBDevice::didReceiveData(int reportId, uint8_t *report, int reportLength) {
+void USBDevice::didReceiveData(const InputFrame &frame) {
     // noop, expect override
 }
 
@@ -96,17 +101,216 @@ void USBDevice::didReceiveButton(uint16_t hardwareButtonIndex, bool pressed, uin
     // noop, expect override
 }
 
-void USBDevice::processOnMainThread(const InputEvent &event) {
-    std::lock_guard<std::mutex> lock(eventQueueMutex);
-    eventQueue.push(event);
+bool USBDevice::allowsDormantMode() {
+    return false;
+}
+
+void USBDevice::didEnterDormantMode() {
+    // noop, expect override
+}
+
+void USBDevice::didExitDormantMode() {
+    // noop, expect override
+}
+
+bool USBDevice::hasPendingInput() {
+#if APL
+    return hidValueAvailable.load();
+#else
+    return !inputRing.empty();
+#endif
+}
+
+void USBDevice::reportMemoryUsage(MemoryUsage &usage) {
+    usage.queues += sizeof(inputRing) + outputQueue.memoryFootprint() + sizeof(inputCoalescer) + inputCoalescer.frame().buttonEdges.capacity() * sizeof(InputButtonEdge);
+}
+
+void USBDevice::queueInputReport(const uint8_t *report, int length) {
+    stats.reportsReceived.fetch_add(1, std::memory_order_relaxed);
+    HIDCapture::getInstance()->record(HIDCaptureDirection::Input, vendorId, productId, std::span<const uint8_t>(report, length));
+    if (!reportFilter.accept(report, length)) {
+        stats.reportsSuppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    inputRing.push(report, length);
+}
+
+bool USBDevice::writeData(std::span<const uint8_t> data) {
+    return queueOutput(OutputLane::Control, 0, data);
+}
+
+bool USBDevice::writeData(std::initializer_list<uint8_t> data) {
+    return queueOutput(OutputLane::Control, 0, std::span<const uint8_t>(data.begin(), data.size()));
+}
+
+bool USBDevice::queueOutput(OutputLane lane, uint32_t target, std::span<const uint8_t> report) {
+    if (!acceptsOutput() || report.empty()) {
+        return false;
+    }
+
+    return outputQueue.push(lane, target, report);
+}
+
+bool USBDevice::queueOutput(OutputLane lane, uint32_t target, std::initializer_list<uint8_t> report) {
+    return queueOutput(lane, target, std::span<const uint8_t>(report.begin(), report.size()));
+}
+
+bool USBDevice::queueOutput(OutputLane lane, uint32_t target, std::span<const OutputReportBuffer> reports) {
+    if (!acceptsOutput() || reports.empty()) {
+        return false;
+    }
+
+    return outputQueue.push(lane, target, reports);
+}
+
+bool USBDevice::queueStaticOutput(OutputLane lane, uint32_t target, const std::vector<std::vector<uint8_t>> &reports) {
+    if (!acceptsOutput() || reports.empty()) {
+        return false;
+    }
+
+    return outputQueue.pushBorrowed(lane, target, reports);
+}
+
+std::array<uint8_t, 14> USBDevice::SetValueReport(uint8_t deviceId, uint8_t deviceType, uint8_t selector, uint8_t value) {
+    return {0x02, deviceId, deviceType, 0x00, 0x00, 0x03, 0x49, selector, value, 0x00, 0x00, 0x00, 0x00, 0x00};
+}
+
+bool USBDevice::acceptsOutput() {
+    // Two atomic loads; the writer is started by connect(), not per message
+    if (!connected || !outputQueue.isRunning()) {
+        debug_throttled(1000, "HID device not connected, not queueing output\n");
+        return false;
+    }
+    return true;
+}
+
+void USBDevice::startOutput() {
+    OutputQueue::BatchWriter batchWriter;
+#if LIN
+    batchWriter = [this](std::span<const std::span<const uint8_t>> reports) {
+        for (auto report : reports) {
+            HIDCapture::getInstance()->record(HIDCaptureDirection::Output, vendorId, productId, report);
+        }
+        if (batchedOutput.load(std::memory_order_relaxed)) {
+            return writeReports(reports);
+        }
+
+        size_t written = 0;
+        while (written < reports.size() && writeReport(reports[written])) {
+            ++written;
+        }
+        return written;
+    };
+#endif
+
+    char threadName[16];
+    snprintf(threadName, sizeof(threadName), "ww-out-%04x", productId);
+    outputQueue.start([this](std::span<const uint8_t> report) {
+        HIDCapture::getInstance()->record(HIDCaptureDirection::Output, vendorId, productId, report);
+        return writeReport(report);
+    }, threadName, std::move(batchWriter));
+}
+
+void USBDevice::invalidateOutputShadows() {
+    outputQueue.invalidateShadows();
+}
+
+void USBDevice::markUnplugged() {
+    unplugged = true;
+    OutputShadowStore::getInstance()->forget(vendorId, productId);
+}
+
+bool USBDevice::isOutputStalled() {
+    return connected && outputQueue.stalledFor() > std::chrono::seconds(OUTPUT_STALL_TIMEOUT_SECONDS);
+}
+
+void USBDevice::markUnhealthy() {
+    // What the device shows is unknown, the next connection starts from a full refresh
+    markUnplugged();
+    connected = false;
+    outputQueue.discard();
+}
+
+void USBDevice::stopOutput() {
+    outputQueue.stop(std::chrono::milliseconds(0));
+}
+
+void USBDevice::restoreOutputState() {
+    OutputShadowSnapshot snapshot;
+    bool restored = OutputShadowStore::getInstance()->take(vendorId, productId, snapshot);
+    if (restored) {
+        outputQueue.restoreShadows(snapshot);
+    } else {
+        invalidateOutputShadows();
+    }
+
+    stats.resyncRestored = restored;
+    resyncStartedAt = std::chrono::steady_clock::now();
+}
+
+void USBDevice::saveOutputState() {
+    // Only the first disconnect of a connection saves, the writer has flushed by then
+    if (!connected || unplugged) {
+        return;
+    }
+
+    OutputShadowStore::getInstance()->save(vendorId, productId, outputQueue.snapshotShadows());
+}
+
+void USBDevice::checkOutputResync() {
+    if (resyncStartedAt == std::chrono::steady_clock::time_point{} || !profileReady || !outputQueue.isIdle()) {
+        return;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - resyncStartedAt);
+    stats.resyncMicroseconds = elapsed.count();
+    resyncStartedAt = {};
+    debug_force("[%s] Output in sync %.1f ms after connecting (%s)\n", classIdentifier(), elapsed.count() / 1000.0, stats.resyncRestored ? "changes since last close" : "full refresh");
+}
+
+const OutputQueueStats &USBDevice::outputStats() const {
+    return outputQueue.stats;
+}
+
+uint64_t USBDevice::droppedInputReports() const {
+    return inputRing.droppedCount();
+}
+
+void USBDevice::setOutputBudget(double reportsPerSecond, double burst) {
+    outputQueue.setBudget(reportsPerSecond, burst);
+}
+
+void USBDevice::setBatchedOutput(bool batched) {
+    batchedOutput.store(batched, std::memory_order_relaxed);
+}
+
+bool USBDevice::hasPendingOutput() {
+    return !outputQueue.isIdle();
+}
+
+void USBDevice::setInputLayout(const InputLayout &layout) {
+    inputCoalescer.configure(layout);
 }
 
 void USBDevice::processQueuedEvents() {
-    std::lock_guard<std::mutex> lock(eventQueueMutex);
-    while (!eventQueue.empty()) {
-        InputEvent event = eventQueue.front();
-        eventQueue.pop();
+    // Everything that arrived since the last update becomes one frame; reports with other IDs
+    // are rare and delivered on their own, ahead of the frame.
+    InputReport report;
+    while (inputRing.pop(report)) {
+        if (!inputCoalescer.add(report)) {
+            didReceiveData(inputCoalescer.passthrough(report));
+        }
+    }
+
+    if (inputCoalescer.hasFrame()) {
+        didReceiveData(inputCoalescer.frame());
+        inputCoalescer.clearFrame();
+    }
 
-        didReceiveData(event.reportId, event.reportData.data(), event.reportLength);
+    uint64_t dropped = inputRing.droppedCount();
+    if (dropped != reportedDroppedReports) {
+        debug_throttled(1000, "[%s] Input ring overflowed, %llu reports dropped so far\n", classIdentifier(), (unsigned long long) dropped);
+        reportedDroppedReports = dropped;
     }
 }
@@ -2,11 +2,21 @@
 #define USBDEVICE_H
 
 #include "config.h"
+#include "inputcoalescer.h"
+#include "inputring.h"
+#include "memory-stats.h"
+#include "outputqueue.h"
+#include "reportfilter.h"
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <initializer_list>
 #include <mutex>
-#include <queue>
+#include <span>
 #include <string>
+#include <thread>
 #include <vector>
 
 #if APL
@@ -22,28 +32,68 @@ typedef HANDLE HIDDeviceHandle;
 typedef int HIDDeviceHandle;
 #endif
 
-struct InputEvent {
-        int reportId;
-        std::vector<uint8_t> reportData;
-        int reportLength;
+// Written by the reader and writer threads, read from the main thread
+struct USBDeviceStats {
+        std::atomic<uint64_t> reportsReceived{0};
+        std::atomic<uint64_t> reportsSuppressed{0};
+        std::atomic<uint64_t> shortWrites{0};      // The device took only part of a report
+        std::atomic<uint64_t> writesWouldBlock{0}; // Its endpoint was full (EAGAIN)
+        std::atomic<uint64_t> writeCalls{0};       // System calls the reports went out with
+        // From the last connect until the profile was loaded and all output written
+        std::atomic<uint64_t> resyncMicroseconds{0};
+        std::atomic<bool> resyncRestored{false}; // Only the difference to the saved state went out
+        // Times this unit came back after being unplugged or closed for a stall (Linux), carried
+        // over from the device object it replaces by USBController
+        std::atomic<uint32_t> reconnects{0};
 };
 
 class USBDevice {
     private:
         uint8_t *inputBuffer = nullptr;
-        std::queue<InputEvent> eventQueue;
-        std::mutex eventQueueMutex;
+        ReportFilter reportFilter;
+        InputRing inputRing;
+        InputCoalescer inputCoalescer;
+        uint64_t reportedDroppedReports = 0;
+        OutputQueue outputQueue;
+        bool unplugged = false;
+        std::atomic<bool> batchedOutput{true};
+        std::chrono::steady_clock::time_point resyncStartedAt{};
 
         void processQueuedEvents();
 
+        // Connect and disconnect: picks up what the device showed when it was last closed, or
+        // forgets all output if nothing is known, and saves it again on the way out
+        void restoreOutputState();
+        void saveOutputState();
+        void checkOutputResync();
+
+        // Blocking write of a single report, only called by the output queue's writer thread
+        bool writeReport(std::span<const uint8_t> report);
+        // connect(): starts the writer thread unless it runs already
+        void startOutput();
+        bool acceptsOutput();
+
 #if APL
-        IOHIDQueueRef hidQueue;
+        IOHIDQueueRef hidQueue = nullptr;
+        std::atomic<bool> hidValueAvailable{false};
         void handleHIDValue(IOHIDValueRef value);
+        static void HIDQueueValueAvailableCallback(void *context, IOReturn result, void *sender);
 #elif IBM
         USHORT outputReportByteLength = 0;
+        std::thread inputThread;
+        std::atomic<bool> inputThreadRunning{false};
         static void InputReportCallback(void *context, DWORD bytesRead, uint8_t *report);
+        void stopInputThread();
 #elif LIN
+        int serviceDevice = -1; // The helper's device id when hidDevice is a HIDServiceClient handle
+        bool socketOutput = false; // hidDevice is a socket (fake devices), not a hidraw node
         static void InputReportCallback(void *context, int bytesRead, uint8_t *report);
+
+        // Writer thread: a run of reports in one system call, returns how many went out
+        size_t writeReports(std::span<const std::span<const uint8_t>> reports);
+        // After EAGAIN: waits until the endpoint drained, false once the deadline passed or a
+        // disconnect is flushing the queue
+        bool waitUntilWritable(std::chrono::steady_clock::time_point deadline);
 #endif
 
     public:
@@ -51,8 +101,9 @@ class USBDevice {
         virtual ~USBDevice();
 
         HIDDeviceHandle hidDevice;
-        bool connected = false;
+        std::atomic<bool> connected{false}; // Also read by the reader and writer threads
         bool profileReady = false;
+        USBDeviceStats stats;
         uint16_t vendorId;
         uint16_t productId;
         std::string vendorName;
@@ -62,14 +113,63 @@ class USBDevice {
         virtual bool connect();
         virtual void disconnect();
         virtual void update();
-        virtual void didReceiveData(int reportId, uint8_t *report, int reportLength);
+        virtual void didReceiveData(const InputFrame &frame);
         virtual void didReceiveButton(uint16_t hardwareButtonIndex, bool pressed, uint8_t count = 1);
 
         virtual void forceStateSync();
 
-        void processOnMainThread(const InputEvent &event);
+        // Dormant mode hooks, see AppState. Devices that allow it are no longer updated while
+        // dormant; they blank their displays on entry and redraw everything on exit.
+        virtual bool allowsDormantMode();
+        virtual void didEnterDormantMode();
+        virtual void didExitDormantMode();
+        bool hasPendingInput();
+
+        // Adds the device's buffers, queues and referenced shared assets to usage.
+        virtual void reportMemoryUsage(MemoryUsage &usage);
+
+        // Reader thread: hands a raw input report to the main thread
+        void queueInputReport(const uint8_t *report, int length);
+
+        // Reports matching the layout are coalesced into one didReceiveData() call per update
+        void setInputLayout(const InputLayout &layout);
+
+        // Queue output for the writer thread, callers never block on the device. writeData()
+        // uses the ordered control lane; a non-zero target makes newer messages for it replace
+        // queued ones.
+        // The bytes are copied into the queue's preallocated slots, nothing here allocates.
+        bool writeData(std::span<const uint8_t> data);
+        bool writeData(std::initializer_list<uint8_t> data);
+        bool queueOutput(OutputLane lane, uint32_t target, std::span<const uint8_t> report);
+        bool queueOutput(OutputLane lane, uint32_t target, std::initializer_list<uint8_t> report);
+        bool queueOutput(OutputLane lane, uint32_t target, std::span<const OutputReportBuffer> reports);
+        // Writes the reports from the caller's storage, for static tables such as fonts
+        bool queueStaticOutput(OutputLane lane, uint32_t target, const std::vector<std::vector<uint8_t>> &reports);
+
+        // Output matching the last value queued for its target is skipped. connect() calls this
+        // unless the state the device was last closed with is known, see OutputShadowStore.
+        void invalidateOutputShadows();
+        // The hardware is gone and resets before it returns, so its output state is not saved
+        void markUnplugged();
+        // Output has waited OUTPUT_STALL_TIMEOUT_SECONDS without a report going out
+        bool isOutputStalled();
+        // Gives up on a stalled device: queued output is dropped and nothing new is accepted.
+        // stopOutput() then returns once the write in progress failed, which may take until the
+        // driver's timeout, so it is called off the main thread.
+        void markUnhealthy();
+        void stopOutput();
+        const OutputQueueStats &outputStats() const;
+        uint64_t droppedInputReports() const;
+        // Devices needing slower pacing than OutputScheduler's default lower their budget
+        void setOutputBudget(double reportsPerSecond, double burst);
+        // Multi-report messages go out in one system call where the platform allows (Linux);
+        // turning that off, one call per report again, is only meant for comparisons
+        void setBatchedOutput(bool batched);
+        bool hasPendingOutput();
 
-        bool writeData(std::vector<uint8_t> data);
+        // The 14-byte "set value" report most panels use for LEDs, backlight and vibration:
+        // 02 <device> <type> 00 00 03 49 <selector> <value> 00 00 00 00 00
+        static std::array<uint8_t, 14> SetValueReport(uint8_t deviceId, uint8_t deviceType, uint8_t selector, uint8_t value);
 
         static USBDevice *Device(HIDDeviceHandle hidDevice, uint16_t vendorId, uint16_t productId, std::string vendorName, std::string productName);
 };
@@ -1,22 +1,29 @@
 #if LIN
 #include "appstate.h"
 #include "config.h"
+#include "hidreactor.h"
+#include "hidserviceclient.h"
 #include "usbdevice.h"
 
-#include <atomic>
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <errno.h>
 #include <fcntl.h>
 #include <iostream>
 #include <linux/hidraw.h>
+#include <poll.h>
 #include <sys/ioctl.h>
-#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <XPLMUtilities.h>
 
 USBDevice::USBDevice(HIDDeviceHandle aHidDevice, uint16_t aVendorId, uint16_t aProductId, std::string aVendorName, std::string aProductName) :
-    hidDevice(aHidDevice), vendorId(aVendorId), productId(aProductId), vendorName(aVendorName), productName(aProductName), connected(false) {}
+    hidDevice(aHidDevice), vendorId(aVendorId), productId(aProductId), vendorName(aVendorName), productName(aProductName), connected(false) {
+    serviceDevice = HIDServiceClient::getInstance()->deviceId(aHidDevice);
+}
 
 USBDevice::~USBDevice() {
     disconnect();
@@ -24,34 +31,75 @@ USBDevice::~USBDevice() {
 
 bool USBDevice::connect() {
     static const size_t kInputReportSize = 65;
+    if (hidDevice < 0) {
+        return false;
+    }
+
+    // Reconnecting: stop reading into the old buffer before replacing it
+    if (serviceDevice >= 0) {
+        HIDServiceClient::getInstance()->unwatch(hidDevice);
+    } else {
+        HIDReactor::getInstance()->remove(hidDevice);
+    }
+
     if (inputBuffer) {
         delete[] inputBuffer;
         inputBuffer = nullptr;
     }
     inputBuffer = new uint8_t[kInputReportSize];
+    inputRing.clear();
+    inputCoalescer.reset();
+    reportFilter.resync();
+    restoreOutputState();
+
+    if (serviceDevice >= 0) {
+        // winwing-hid-helper reads the node, its reports arrive on the reactor thread
+        connected = true;
+        if (!HIDServiceClient::getInstance()->watch(hidDevice, [this](uint8_t *report, int length) {
+                InputReportCallback(this, length, report);
+            })) {
+            connected = false;
+            return false;
+        }
+        startOutput();
+        return true;
+    }
+
+    // Reads are drained until EAGAIN by the reactor. Nodes are opened non-blocking, fds handed
+    // over by other means (fake devices) may not be.
+    int flags = fcntl(hidDevice, F_GETFL, 0);
+    if (flags >= 0 && !(flags & O_NONBLOCK)) {
+        fcntl(hidDevice, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    // Fake devices are seqpacket sockets, where one writev would be one report
+    struct stat status;
+    socketOutput = fstat(hidDevice, &status) == 0 && S_ISSOCK(status.st_mode);
 
     connected = true;
-    std::thread inputThread([this]() {
-        uint8_t buffer[65];
-        while (connected && hidDevice >= 0) {
-            ssize_t bytesRead = read(hidDevice, buffer, sizeof(buffer));
-            if (bytesRead > 0 && connected) {
-                InputReportCallback(this, (int) bytesRead, buffer);
-            } else if (bytesRead < 0) {
-                // Device error or disconnected
-                break;
-            } else if (bytesRead == 0) {
-                // EOF - device disconnected
-                break;
+    bool watching = HIDReactor::getInstance()->add(hidDevice, [this]() {
+        while (true) {
+            ssize_t bytesRead = read(hidDevice, inputBuffer, kInputReportSize);
+            if (bytesRead > 0) {
+                InputReportCallback(this, (int) bytesRead, inputBuffer);
+            } else if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            } else if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;
+            } else {
+                // EOF or device error, the udev remove event cleans up the device
+                debug("Input reports stopped for %s\n", productName.c_str());
+                return false;
             }
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-
-        debug("Input thread exiting\n");
     });
-    inputThread.detach();
 
+    if (!watching) {
+        connected = false;
+        return false;
+    }
+
+    startOutput();
     return true;
 }
 
@@ -61,17 +109,7 @@ void USBDevice::InputReportCallback(void *context, int bytesRead, uint8_t *repor
         return;
     }
 
-    try {
-        InputEvent event;
-        event.reportId = report[0];
-        event.reportData.assign(report, report + bytesRead);
-        event.reportLength = bytesRead;
-
-        self->processOnMainThread(event);
-    } catch (const std::system_error &e) {
-        // Silently ignore mutex errors that occur during shutdown
-        return;
-    }
+    self->queueInputReport(report, bytesRead);
 }
 
 void USBDevice::update() {
@@ -79,16 +117,26 @@ void USBDevice::update() {
         return;
     }
 
+    checkOutputResync();
+
     processQueuedEvents();
 }
 
 void USBDevice::disconnect() {
+    // Flush the final output queued before the disconnect, e.g. LEDs switched off by the
+    // product; the sim waits at most OUTPUT_FLUSH_MILLISECONDS plus the write in progress
+    outputQueue.stop(std::chrono::milliseconds(OUTPUT_FLUSH_MILLISECONDS));
+    saveOutputState();
     connected = false;
 
-    // Give input thread time to exit
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    if (hidDevice >= 0) {
+    if (hidDevice >= 0 && serviceDevice >= 0) {
+        // Returns once no input callback for this device is running anymore; the helper keeps
+        // the node open, so its displays stay as they are
+        HIDServiceClient::getInstance()->close(hidDevice);
+        hidDevice = -1;
+    } else if (hidDevice >= 0) {
+        // Returns once no read callback for this device is running anymore
+        HIDReactor::getInstance()->remove(hidDevice);
         close(hidDevice);
         hidDevice = -1;
     }
@@ -102,20 +150,136 @@ void USBDevice::disconnect() {
 }
 
 void USBDevice::forceStateSync() {
-    // noop, code does not use partial data
+    // Reports carry the full state, the next one just must not be filtered as a duplicate
+    inputCoalescer.reset();
+    reportFilter.resync();
 }
 
-bool USBDevice::writeData(std::vector<uint8_t> data) {
+bool USBDevice::writeReport(std::span<const uint8_t> data) {
     if (hidDevice < 0 || !connected || data.empty()) {
-        debug("HID device not open, not connected, or empty data\n");
+        debug_throttled(1000, "HID device not open, not connected, or empty data\n");
         return false;
     }
 
-    ssize_t bytesWritten = write(hidDevice, data.data(), data.size());
-    if (bytesWritten == (ssize_t) data.size()) {
-        return true;
+    if (serviceDevice >= 0) {
+        return HIDServiceClient::getInstance()->write(static_cast<uint16_t>(serviceDevice), data);
     }
 
+    // A full endpoint refuses the report with EAGAIN; the writer waits for it to drain, but only
+    // briefly, so a stalled device fails its writes and is reconnected (see isOutputStalled)
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(OUTPUT_WRITE_WAIT_MILLISECONDS);
+    while (true) {
+        stats.writeCalls.fetch_add(1, std::memory_order_relaxed);
+        ssize_t bytesWritten = write(hidDevice, data.data(), data.size());
+        if (bytesWritten == (ssize_t) data.size()) {
+            return true;
+        }
+
+        if (bytesWritten >= 0) {
+            stats.shortWrites.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        if (!waitUntilWritable(deadline)) {
+            return false;
+        }
+    }
+}
+
+size_t USBDevice::writeReports(std::span<const std::span<const uint8_t>> reports) {
+    if (hidDevice < 0 || !connected || reports.empty()) {
+        debug_throttled(1000, "HID device not open, not connected, or empty data\n");
+        return 0;
+    }
+
+    if (serviceDevice >= 0) {
+        size_t written = 0;
+        while (written < reports.size() && HIDServiceClient::getInstance()->write(static_cast<uint16_t>(serviceDevice), reports[written])) {
+            ++written;
+        }
+        return written;
+    }
+
+    // hidraw sends each iovec as its own report and stops at the first one that fails, so a
+    // partial result still ends on a report boundary unless the device took a report short.
+    // Sockets would join the iovecs into one record and get one message per report instead.
+    static constexpr size_t MaxReports = 64;
+    iovec vectors[MaxReports];
+    mmsghdr messages[MaxReports];
+    size_t count = std::min(reports.size(), MaxReports);
+    for (size_t i = 0; i < count; ++i) {
+        vectors[i] = {const_cast<uint8_t *>(reports[i].data()), reports[i].size()};
+        messages[i] = {};
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(OUTPUT_WRITE_WAIT_MILLISECONDS);
+    size_t written = 0;
+    while (written < count) {
+        stats.writeCalls.fetch_add(1, std::memory_order_relaxed);
+        if (socketOutput) {
+            int sent = sendmmsg(hidDevice, messages + written, (unsigned int) (count - written), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent > 0) {
+                written += sent;
+                continue;
+            }
+            if (sent == 0) {
+                // Nothing taken and no error, errno is stale
+                stats.shortWrites.fetch_add(1, std::memory_order_relaxed);
+                return written;
+            }
+        } else {
+            ssize_t bytesWritten = writev(hidDevice, vectors + written, (int) (count - written));
+            if (bytesWritten > 0) {
+                size_t before = written;
+                while (written < count && (size_t) bytesWritten >= vectors[written].iov_len) {
+                    bytesWritten -= vectors[written].iov_len;
+                    ++written;
+                }
+                if (bytesWritten > 0 || written == before) {
+                    stats.shortWrites.fetch_add(1, std::memory_order_relaxed);
+                    return written;
+                }
+                continue;
+            }
+            if (bytesWritten == 0) {
+                stats.shortWrites.fetch_add(1, std::memory_order_relaxed);
+                return written;
+            }
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || !waitUntilWritable(deadline)) {
+            return written;
+        }
+    }
+    return written;
+}
+
+bool USBDevice::waitUntilWritable(std::chrono::steady_clock::time_point deadline) {
+    stats.writesWouldBlock.fetch_add(1, std::memory_order_relaxed);
+
+    // Waits in short slices, so a disconnect flushing the queue does not wait out the deadline
+    static constexpr int SliceMilliseconds = 10;
+    while (connected && !outputQueue.isFlushing()) {
+        int remaining = (int) std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+            return false;
+        }
+
+        pollfd writable = {hidDevice, POLLOUT, 0};
+        if (poll(&writable, 1, std::min(remaining, SliceMilliseconds)) > 0) {
+            return true;
+        }
+    }
     return false;
 }
 #endif
@@ -44,11 +44,14 @@ bool USBDevice::connect() {
         }
         CFRelease(elements);
 
+        IOHIDQueueRegisterValueAvailableCallback(hidQueue, &USBDevice::HIDQueueValueAvailableCallback, this);
         IOHIDQueueScheduleWithRunLoop(hidQueue, CFRunLoopGetCurrent(), kCFRunLoopCommonModes);
         IOHIDQueueStart(hidQueue);
     }
 
+    restoreOutputState();
     connected = true;
+    startOutput();
     return true;
 }
 
@@ -57,10 +60,14 @@ void USBDevice::update() {
         return;
     }
 
+    checkOutputResync();
+
     if (!hidQueue) {
         return;
     }
 
+    hidValueAvailable = false;
+
     IOHIDValueRef value = nullptr;
     while ((value = IOHIDQueueCopyNextValue(hidQueue))) {
         handleHIDValue(value);
@@ -69,19 +76,23 @@ void USBDevice::update() {
 }
 
 void USBDevice::disconnect() {
+    // Flush the final output queued before the disconnect, e.g. LEDs switched off by the
+    // product; the sim waits at most OUTPUT_FLUSH_MILLISECONDS plus the write in progress
+    outputQueue.stop(std::chrono::milliseconds(OUTPUT_FLUSH_MILLISECONDS));
+    saveOutputState();
     connected = false;
 
-    if (hidDevice) {
+    if (hidQueue) {
+        // Callbacks run on this thread's run loop, none can fire once unscheduled
+        IOHIDQueueRegisterValueAvailableCallback(hidQueue, nullptr, nullptr);
         IOHIDQueueStop(hidQueue);
         IOHIDQueueUnscheduleFromRunLoop(hidQueue, CFRunLoopGetCurrent(), kCFRunLoopCommonModes);
+        CFRelease(hidQueue);
         hidQueue = nullptr;
+        hidValueAvailable = false;
+    }
 
-        // Force run loop to process any remaining queued callbacks to drain them
-        // This ensures any pending callbacks are processed while connected=false
-        for (int i = 0; i < 10; i++) {
-            CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.001, true);
-        }
-
+    if (hidDevice) {
         IOHIDDeviceClose(hidDevice, kIOHIDOptionsTypeNone);
         hidDevice = nullptr;
     }
@@ -108,21 +119,31 @@ void USBDevice::forceStateSync() {
     CFRelease(elements);
 }
 
-bool USBDevice::writeData(std::vector<uint8_t> data) {
+bool USBDevice::writeReport(std::span<const uint8_t> data) {
     if (!hidDevice || !connected || data.empty()) {
-        debug("HID device not open, not connected, or empty data\n");
+        debug_throttled(1000, "HID device not open, not connected, or empty data\n");
         return false;
     }
 
     uint8_t reportID = data[0];
     IOReturn kr = IOHIDDeviceSetReport(hidDevice, kIOHIDReportTypeOutput, reportID, data.data(), data.size());
     if (kr != kIOReturnSuccess) {
+        if (kr == kIOReturnBusy) {
+            stats.writesWouldBlock.fetch_add(1, std::memory_order_relaxed);
+        }
         debug("IOHIDDeviceSetReport failed: %d\n", kr);
         return false;
     }
     return true;
 }
 
+void USBDevice::HIDQueueValueAvailableCallback(void *context, IOReturn result, void *sender) {
+    auto *self = static_cast<USBDevice *>(context);
+    if (self) {
+        self->hidValueAvailable = true;
+    }
+}
+
 void USBDevice::handleHIDValue(IOHIDValueRef value) {
     IOHIDElementRef element = IOHIDValueGetElement(value);
     if (!element) {
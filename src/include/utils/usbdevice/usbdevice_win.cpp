@@ -1,9 +1,12 @@
 #if IBM
 #include "appstate.h"
 #include "config.h"
+#include "thread-registry.h"
 #include "usbdevice.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <hidsdi.h>
 #include <iostream>
 #include <setupapi.h>
@@ -29,6 +32,10 @@ bool USBDevice::connect() {
         inputBuffer = nullptr;
     }
     inputBuffer = new uint8_t[kInputReportSize];
+    inputRing.clear();
+    inputCoalescer.reset();
+    reportFilter.resync();
+    restoreOutputState();
 
     // Query the HID output report size
     PHIDP_PREPARSED_DATA preparsedData = nullptr;
@@ -45,26 +52,30 @@ bool USBDevice::connect() {
         debug_force("Failed to get preparsed data\n");
     }
 
-    // Start input reading thread with proper cleanup
+    // Reconnecting: the previous reader must be gone before a new one starts
+    stopInputThread();
+
+    // The reader blocks in ReadFile; disconnect() cancels the read and joins it
     connected = true;
-    std::thread inputThread([this]() {
+    inputThreadRunning = true;
+    HANDLE readHandle = hidDevice;
+    inputThread = std::thread([this, readHandle]() {
+        ThreadScope scope(ThreadRole::Reader, "ww-in-%04x", productId);
         uint8_t buffer[65];
         DWORD bytesRead;
-        while (connected && hidDevice != INVALID_HANDLE_VALUE) {
-            BOOL result = ReadFile(hidDevice, buffer, sizeof(buffer), &bytesRead, nullptr);
-            if (result && bytesRead > 0 && connected) {
+        while (connected) {
+            BOOL result = ReadFile(readHandle, buffer, sizeof(buffer), &bytesRead, nullptr);
+            if (result && bytesRead > 0) {
                 InputReportCallback(this, bytesRead, buffer);
             } else if (!result) {
-                DWORD error = GetLastError();
-                if (error != ERROR_DEVICE_NOT_CONNECTED) {
-                }
+                // Cancelled by disconnect() or the device is gone
                 break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
+        inputThreadRunning = false;
     });
-    inputThread.detach();
 
+    startOutput();
     return true;
 }
 
@@ -78,18 +89,7 @@ void USBDevice::InputReportCallback(void *context, DWORD bytesRead, uint8_t *rep
         return;
     }
 
-    try {
-        InputEvent event;
-        event.reportId = report[0];
-        event.reportData.assign(report, report + bytesRead);
-        event.reportLength = (int) bytesRead;
-
-        self->processOnMainThread(event);
-    } catch (const std::system_error &e) {
-        return;
-    } catch (...) {
-        return;
-    }
+    self->queueInputReport(report, (int) bytesRead);
 }
 
 void USBDevice::update() {
@@ -97,19 +97,40 @@ void USBDevice::update() {
         return;
     }
 
+    checkOutputResync();
+
     processQueuedEvents();
 }
 
+void USBDevice::stopInputThread() {
+    if (!inputThread.joinable()) {
+        return;
+    }
+
+    // Wakes the blocking ReadFile, the reader then sees connected == false and returns. The
+    // reader may have checked connected just before and enter ReadFile after a cancel found
+    // nothing pending, so the cancel is repeated until it is gone.
+    connected = false;
+    while (inputThreadRunning) {
+        CancelIoEx(hidDevice, nullptr);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    inputThread.join();
+}
+
 void USBDevice::disconnect() {
+    // Flush the final output queued before the disconnect, e.g. LEDs switched off by the
+    // product; the sim waits at most OUTPUT_FLUSH_MILLISECONDS plus the write in progress
+    outputQueue.stop(std::chrono::milliseconds(OUTPUT_FLUSH_MILLISECONDS));
+    saveOutputState();
     connected = false;
 
     if (hidDevice != INVALID_HANDLE_VALUE) {
+        stopInputThread();
         CloseHandle(hidDevice);
         hidDevice = INVALID_HANDLE_VALUE;
     }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
     if (inputBuffer) {
         delete[] inputBuffer;
         inputBuffer = nullptr;
@@ -117,30 +138,36 @@ void USBDevice::disconnect() {
 }
 
 void USBDevice::forceStateSync() {
-    // noop, code does not use partial data
+    // Reports carry the full state, the next one just must not be filtered as a duplicate
+    inputCoalescer.reset();
+    reportFilter.resync();
 }
 
-bool USBDevice::writeData(std::vector<uint8_t> data) {
+bool USBDevice::writeReport(std::span<const uint8_t> data) {
+    static const size_t kMaxOutputReportSize = 1024;
     if (hidDevice == INVALID_HANDLE_VALUE || !connected || data.empty()) {
         return false;
     }
 
-    if (data.size() > 1024) {
+    if (data.size() > kMaxOutputReportSize || outputReportByteLength > kMaxOutputReportSize) {
         return false;
     }
 
     // Windows HID requires the data to be exactly the output report size
     // If we have a known report size and data is smaller, pad with zeros
-    std::vector<uint8_t> paddedData = data;
-    if (outputReportByteLength > 0 && paddedData.size() < outputReportByteLength) {
-        paddedData.resize(outputReportByteLength, 0);
-    }
+    uint8_t paddedData[kMaxOutputReportSize];
+    size_t paddedSize = std::max<size_t>(data.size(), outputReportByteLength);
+    std::memcpy(paddedData, data.data(), data.size());
+    std::memset(paddedData + data.size(), 0, paddedSize - data.size());
 
     DWORD bytesWritten;
-    BOOL result = WriteFile(hidDevice, paddedData.data(), (DWORD) paddedData.size(), &bytesWritten, nullptr);
-    if (!result || bytesWritten < paddedData.size()) {
+    BOOL result = WriteFile(hidDevice, paddedData, (DWORD) paddedSize, &bytesWritten, nullptr);
+    if (!result || bytesWritten < paddedSize) {
+        if (result) {
+            stats.shortWrites.fetch_add(1, std::memory_order_relaxed);
+        }
         DWORD error = GetLastError();
-        debug_force("WriteFile failed: %lu (expected %zu bytes, wrote %lu)\n", error, paddedData.size(), bytesWritten);
+        debug_force("WriteFile failed: %lu (expected %zu bytes, wrote %lu)\n", error, paddedSize, bytesWritten);
         return false;
     }
     return true;
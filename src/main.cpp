@@ -1,124 +1,144 @@
-#ifndef XPLM410
-#error This is made to be compiled against the XPLM410 SDK for XP12
-#endif
-
-#include "appstate.h"
-#include "config.h"
-#include "usbcontroller.h"
-
-#include <cstring>
-#include <XPLMDisplay.h>
-#include <XPLMMenus.h>
-#include <XPLMPlugin.h>
-#include <XPLMProcessing.h>
-
-#if IBM
-#include <windows.h>
-
-BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
-    switch (ul_reason_for_call) {
-        case DLL_PROCESS_ATTACH:
-        case DLL_THREAD_ATTACH:
-        case DLL_THREAD_DETACH:
-        case DLL_PROCESS_DETACH:
-            break;
-    }
-
-    return TRUE;
-}
-#endif
-
-PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, long msg, void *params);
-void menuAction(void *mRef, void *iRef);
-
-XPLMMenuID mainMenuId;
-int debugLoggingMenuItemIndex;
-
-PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
-    strcpy(name, FRIENDLY_NAME);
-    strcpy(sig, BUNDLE_ID);
-    strcpy(desc, "Winwing X-Plane plugin");
-    XPLMEnableFeature("XPLM_USE_NATIVE_PATHS", 1);
-    XPLMEnableFeature("XPLM_USE_NATIVE_WIDGET_WINDOWS", 1);
-    XPLMEnableFeature("XPLM_WANTS_DATAREF_NOTIFICATIONS", 1);
-
-    int item = XPLMAppendMenuItem(XPLMFindPluginsMenu(), FRIENDLY_NAME, nullptr, 1);
-    mainMenuId = XPLMCreateMenu(FRIENDLY_NAME, XPLMFindPluginsMenu(), item, menuAction, nullptr);
-    XPLMAppendMenuItem(mainMenuId, "Reload devices", (void *) "ActionReloadDevices", 0);
-    debugLoggingMenuItemIndex = XPLMAppendMenuItem(mainMenuId, "Enable debug logging", (void *) "ActionToggleDebugLogging", 0);
-    XPLMCheckMenuItem(mainMenuId, debugLoggingMenuItemIndex, xplm_Menu_Unchecked);
-
-
-    return 1;
-}
-
-PLUGIN_API void XPluginStop(void) {
-    AppState::getInstance()->deinitialize();
-}
-
-PLUGIN_API int XPluginEnable(void) {
-    XPluginReceiveMessage(0, XPLM_MSG_PLANE_LOADED, nullptr);
-
-    return 1;
-}
-
-PLUGIN_API void XPluginDisable(void) {
-}
-
-PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, long msg, void *params) {
-    switch (msg) {
-        case XPLM_MSG_PLANE_LOADED: {
-            if ((intptr_t) params != 0) {
-                // It was not the user's plane. Ignore.
-                return;
-            }
-
-            AppState::getInstance()->initialize();
-            USBController::getInstance()->connectAllDevices();
-            break;
-        }
-
-        case XPLM_MSG_PLANE_UNLOADED: {
-            if ((intptr_t) params != 0) {
-                // It was not the user's plane. Ignore.
-                return;
-            }
-
-            USBController::getInstance()->disconnectAllDevices();
-            break;
-        }
-
-        case XPLM_MSG_AIRPORT_LOADED: {
-            break;
-        }
-
-        case XPLM_MSG_WILL_WRITE_PREFS:
-            // AppState::getInstance()->saveState();
-            break;
-
-        default:
-            break;
-    }
-}
-
-void menuAction(void *mRef, void *iRef) {
-    if (!strcmp((char *) iRef, "ActionReloadDevices")) {
-        USBController::getInstance()->disconnectAllDevices();
-        USBController::getInstance()->connectAllDevices();
-    } else if (!strcmp((char *) iRef, "ActionToggleDebugLogging")) {
-        XPLMMenuCheck currentState;
-        XPLMCheckMenuItemState(mainMenuId, debugLoggingMenuItemIndex, &currentState);
-
-        bool debugLoggingEnabled = (currentState != xplm_Menu_Checked);
-        XPLMSetMenuItemName(mainMenuId, debugLoggingMenuItemIndex, debugLoggingEnabled ? "Disable debug logging" : "Enable debug logging", 0);
-        XPLMCheckMenuItem(mainMenuId, debugLoggingMenuItemIndex, debugLoggingEnabled ? xplm_Menu_Checked : xplm_Menu_Unchecked);
-        AppState::getInstance()->debuggingEnabled = debugLoggingEnabled;
-
-        if (debugLoggingEnabled) {
-
-            for (auto &device : USBController::getInstance()->devices) {
-            }
-        } else {
-        }
-    }
-}
+#ifndef XPLM410
+#error This is made to be compiled against the XPLM410 SDK for XP12
+#endif
+
+#include "appstate.h"
+#include "config.h"
+#include "hidcapture.h"
+#include "io-stats.h"
+#include "logger.h"
+#include "startup-profiler.h"
+#include "usbcontroller.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <XPLMDisplay.h>
+#include <XPLMMenus.h>
+#include <XPLMPlugin.h>
+#include <XPLMProcessing.h>
+
+#if IBM
+#include <windows.h>
+
+BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved) {
+    switch (ul_reason_for_call) {
+        case DLL_PROCESS_ATTACH:
+        case DLL_THREAD_ATTACH:
+        case DLL_THREAD_DETACH:
+        case DLL_PROCESS_DETACH:
+            break;
+    }
+
+    return TRUE;
+}
+#endif
+
+PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, long msg, void *params);
+void menuAction(void *mRef, void *iRef);
+
+XPLMMenuID mainMenuId;
+int debugLoggingMenuItemIndex;
+
+PLUGIN_API int XPluginStart(char *name, char *sig, char *desc) {
+    strcpy(name, FRIENDLY_NAME);
+    strcpy(sig, BUNDLE_ID);
+    strcpy(desc, "Winwing X-Plane plugin");
+    XPLMEnableFeature("XPLM_USE_NATIVE_PATHS", 1);
+    XPLMEnableFeature("XPLM_USE_NATIVE_WIDGET_WINDOWS", 1);
+    XPLMEnableFeature("XPLM_WANTS_DATAREF_NOTIFICATIONS", 1);
+
+    int item = XPLMAppendMenuItem(XPLMFindPluginsMenu(), FRIENDLY_NAME, nullptr, 1);
+    mainMenuId = XPLMCreateMenu(FRIENDLY_NAME, XPLMFindPluginsMenu(), item, menuAction, nullptr);
+    XPLMAppendMenuItem(mainMenuId, "Reload devices", (void *) "ActionReloadDevices", 0);
+    debugLoggingMenuItemIndex = XPLMAppendMenuItem(mainMenuId, "Enable debug logging", (void *) "ActionToggleDebugLogging", 0);
+    XPLMCheckMenuItem(mainMenuId, debugLoggingMenuItemIndex, xplm_Menu_Unchecked);
+    XPLMAppendMenuItem(mainMenuId, "USB statistics", (void *) "ActionToggleIOStats", 0);
+
+    // Raw HID traffic for winwing-hid-replay, see hidcapture.h
+    const char *capturePath = getenv("WINWING_HID_CAPTURE");
+    if (capturePath && *capturePath) {
+        HIDCapture::getInstance()->start(capturePath);
+    }
+
+    return 1;
+}
+
+PLUGIN_API void XPluginStop(void) {
+    AppState::getInstance()->deinitialize();
+    HIDCapture::getInstance()->stop();
+    Logger::getInstance()->drain();
+}
+
+PLUGIN_API int XPluginEnable(void) {
+    StartupProfiler::getInstance()->begin();
+    StartupPhase phase("XPluginEnable");
+    XPluginReceiveMessage(0, XPLM_MSG_PLANE_LOADED, nullptr);
+
+    return 1;
+}
+
+PLUGIN_API void XPluginDisable(void) {
+}
+
+PLUGIN_API void XPluginReceiveMessage(XPLMPluginID from, long msg, void *params) {
+    switch (msg) {
+        case XPLM_MSG_PLANE_LOADED: {
+            if ((intptr_t) params != 0) {
+                // It was not the user's plane. Ignore.
+                return;
+            }
+
+            AppState::getInstance()->initialize();
+            AppState::getInstance()->setAircraftLoaded(true);
+            AppState::getInstance()->wake();
+            USBController::getInstance()->connectAllDevices();
+            break;
+        }
+
+        case XPLM_MSG_PLANE_UNLOADED: {
+            if ((intptr_t) params != 0) {
+                // It was not the user's plane. Ignore.
+                return;
+            }
+
+            AppState::getInstance()->setAircraftLoaded(false);
+            USBController::getInstance()->disconnectAllDevices();
+            break;
+        }
+
+        case XPLM_MSG_AIRPORT_LOADED: {
+            break;
+        }
+
+        case XPLM_MSG_WILL_WRITE_PREFS:
+            // AppState::getInstance()->saveState();
+            break;
+
+        default:
+            break;
+    }
+}
+
+void menuAction(void *mRef, void *iRef) {
+    if (!strcmp((char *) iRef, "ActionReloadDevices")) {
+        USBController::getInstance()->disconnectAllDevices();
+        USBController::getInstance()->connectAllDevices();
+    } else if (!strcmp((char *) iRef, "ActionToggleDebugLogging")) {
+        XPLMMenuCheck currentState;
+        XPLMCheckMenuItemState(mainMenuId, debugLoggingMenuItemIndex, &currentState);
+
+        bool debugLoggingEnabled = (currentState != xplm_Menu_Checked);
+        XPLMSetMenuItemName(mainMenuId, debugLoggingMenuItemIndex, debugLoggingEnabled ? "Disable debug logging" : "Enable debug logging", 0);
+        XPLMCheckMenuItem(mainMenuId, debugLoggingMenuItemIndex, debugLoggingEnabled ? xplm_Menu_Checked : xplm_Menu_Unchecked);
+        AppState::getInstance()->debuggingEnabled = debugLoggingEnabled;
+
+        if (debugLoggingEnabled) {
+
+            for (auto &device : USBController::getInstance()->devices) {
+            }
+        } else {
+        }
+    } else if (!strcmp((char *) iRef, "ActionToggleIOStats")) {
+        IOStats::getInstance()->toggleWindow();
+    }
+}
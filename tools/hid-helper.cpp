@@ -0,0 +1,551 @@
+// winwing-hid-helper: owns the Winwing hidraw nodes on behalf of the plugin, so a panel or
+// driver that hangs in write() stalls this process instead of X-Plane. Start it before the sim
+// and run X-Plane with WINWING_HID_SERVICE=1; see hidservice.h for the protocol.
+//
+// The helper keeps the nodes open while the plugin is reloaded or X-Plane restarts, so the
+// panels are not re-enumerated and keep what they show until the plugin is back. It serves one
+// plugin at a time.
+//
+//   winwing-hid-helper [--socket <name>]
+//   winwing-hid-helper --loopback [<round trips>]
+//
+// --loopback measures the round trip through the shared-memory rings between two processes,
+// without any device, and prints the latency distribution.
+
+#include "config.h"
+#include "hidservice.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <linux/hidraw.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Reports queued for one device before further ones are refused, about two seconds of a
+// display refresh
+static constexpr size_t OutputQueueLimit = 512;
+
+static volatile sig_atomic_t running = 1;
+
+static uint64_t TimestampNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One open hidraw node. Writes block on the device, so every node has its own writer thread and
+// a hung panel only fills its own queue.
+struct HelperDevice {
+        uint16_t id = 0;
+        int fd = -1;
+        uint16_t vendorId = 0;
+        uint16_t productId = 0;
+        std::string path;
+        std::string name;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<std::vector<uint8_t>> queue;
+        bool stopping = false;
+        uint64_t refused = 0;
+        uint64_t failed = 0;
+        std::thread writer;
+
+        void start() {
+            writer = std::thread([this]() {
+                pthread_setname_np(pthread_self(), "ww-helper-out");
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    condition.wait(lock, [this]() {
+                        return stopping || !queue.empty();
+                    });
+                    if (stopping) {
+                        return;
+                    }
+
+                    std::vector<uint8_t> report = std::move(queue.front());
+                    queue.pop_front();
+                    lock.unlock();
+                    ssize_t written = write(fd, report.data(), report.size());
+                    lock.lock();
+                    if (written != (ssize_t) report.size()) {
+                        failed++;
+                    }
+                }
+            });
+        }
+
+        // An unplugged node fails the write in progress, so this returns quickly
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            condition.notify_all();
+            if (writer.joinable()) {
+                writer.join();
+            }
+        }
+
+        void enqueue(const uint8_t *report, size_t length) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (queue.size() >= OutputQueueLimit) {
+                    refused++;
+                    return;
+                }
+                queue.emplace_back(report, report + length);
+            }
+            condition.notify_one();
+        }
+};
+
+// Shared memory and eventfds of one plugin connection
+struct Session {
+        int socketFd = -1;
+        int regionFd = -1;
+        int toHelperFd = -1;
+        int toPluginFd = -1;
+        HIDServiceRegion *region = nullptr;
+
+        bool create() {
+            regionFd = memfd_create("winwing-hid", MFD_CLOEXEC);
+            toHelperFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            toPluginFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (regionFd < 0 || toHelperFd < 0 || toPluginFd < 0 || ftruncate(regionFd, sizeof(HIDServiceRegion)) < 0) {
+                destroy();
+                return false;
+            }
+
+            void *mapping = mmap(nullptr, sizeof(HIDServiceRegion), PROT_READ | PROT_WRITE, MAP_SHARED, regionFd, 0);
+            if (mapping == MAP_FAILED) {
+                destroy();
+                return false;
+            }
+            region = new (mapping) HIDServiceRegion();
+            return true;
+        }
+
+        void destroy() {
+            if (region) {
+                munmap(region, sizeof(HIDServiceRegion));
+                region = nullptr;
+            }
+            for (int *fd : {&socketFd, &regionFd, &toHelperFd, &toPluginFd}) {
+                if (*fd >= 0) {
+                    close(*fd);
+                    *fd = -1;
+                }
+            }
+        }
+
+        bool active() const {
+            return region != nullptr;
+        }
+
+        bool send(const HIDServiceRecord &record) {
+            if (!region || !region->toPlugin.push(record)) {
+                return false;
+            }
+            if (region->toPlugin.takeWakeup()) {
+                uint64_t one = 1;
+                (void) !write(toPluginFd, &one, sizeof(one));
+            }
+            return true;
+        }
+};
+
+struct Helper {
+        int listenFd = -1;
+        Session session;
+        std::map<uint16_t, std::unique_ptr<HelperDevice>> devices;
+        uint16_t nextId = 1;
+};
+
+static HIDServiceRecord DeviceAddedRecord(const HelperDevice &device) {
+    HIDServiceRecord record = HIDServiceMakeRecord(HIDServiceMessage::DeviceAdded, device.id, reinterpret_cast<const uint8_t *>(device.name.data()), device.name.size());
+    record.vendorId = device.vendorId;
+    record.productId = device.productId;
+    record.timestamp = TimestampNow();
+    return record;
+}
+
+static void RemoveDevice(Helper &helper, uint16_t id) {
+    auto found = helper.devices.find(id);
+    if (found == helper.devices.end()) {
+        return;
+    }
+
+    HelperDevice &device = *found->second;
+    device.stop();
+    close(device.fd);
+    printf("Removed %s (%s), %llu reports refused, %llu failed\n", device.name.c_str(), device.path.c_str(), (unsigned long long) device.refused, (unsigned long long) device.failed);
+    helper.session.send(HIDServiceMakeRecord(HIDServiceMessage::DeviceRemoved, id, nullptr, 0));
+    helper.devices.erase(found);
+}
+
+// Opens new Winwing nodes and drops vanished ones. Only sysfs is read for the others, like the
+// plugin never opens a node that is not a Winwing interface.
+static void ScanDevices(Helper &helper) {
+    std::vector<std::string> present;
+    DIR *directory = opendir("/sys/class/hidraw");
+    struct dirent *entry;
+    while (directory && (entry = readdir(directory)) != nullptr) {
+        if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+            continue;
+        }
+
+        std::ifstream uevent(std::string("/sys/class/hidraw/") + entry->d_name + "/device/uevent");
+        std::string line;
+        bool winwing = false;
+        while (std::getline(uevent, line)) {
+            // HID_ID=<bus>:<vendor>:<product>
+            size_t vendor = line.rfind("HID_ID=", 0) == 0 ? line.find(':') : std::string::npos;
+            if (vendor != std::string::npos && strtoul(line.c_str() + vendor + 1, nullptr, 16) == WINWING_VENDOR_ID) {
+                winwing = true;
+            }
+        }
+        if (!winwing) {
+            continue;
+        }
+
+        std::string path = std::string("/dev/") + entry->d_name;
+        present.push_back(path);
+        bool known = std::any_of(helper.devices.begin(), helper.devices.end(), [&](const auto &device) {
+            return device.second->path == path;
+        });
+        if (known) {
+            continue;
+        }
+
+        int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        struct hidraw_devinfo info;
+        char name[HIDServicePayloadSize] = {};
+        if (fd < 0 || ioctl(fd, HIDIOCGRAWINFO, &info) < 0 || info.vendor != WINWING_VENDOR_ID || ioctl(fd, HIDIOCGRAWNAME(sizeof(name) - 1), name) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+
+        auto device = std::make_unique<HelperDevice>();
+        device->id = helper.nextId++;
+        device->fd = fd;
+        device->vendorId = info.vendor;
+        device->productId = info.product;
+        device->path = path;
+        device->name = name;
+        device->start();
+        printf("Opened %s (%s), device %u\n", device->name.c_str(), path.c_str(), device->id);
+        helper.session.send(DeviceAddedRecord(*device));
+        helper.devices[device->id] = std::move(device);
+    }
+    if (directory) {
+        closedir(directory);
+    }
+
+    std::vector<uint16_t> vanished;
+    for (auto &[id, device] : helper.devices) {
+        if (std::find(present.begin(), present.end(), device->path) == present.end()) {
+            vanished.push_back(id);
+        }
+    }
+    for (uint16_t id : vanished) {
+        RemoveDevice(helper, id);
+    }
+}
+
+// Returns false once the node is gone
+static bool ReadDevice(Helper &helper, HelperDevice &device) {
+    uint8_t buffer[HIDServicePayloadSize];
+    while (true) {
+        ssize_t length = read(device.fd, buffer, sizeof(buffer));
+        if (length > 0) {
+            // Without a plugin the panels' input has nowhere to go
+            HIDServiceRecord record = HIDServiceMakeRecord(HIDServiceMessage::Input, device.id, buffer, length);
+            record.timestamp = TimestampNow();
+            helper.session.send(record);
+        } else if (length < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+}
+
+// Consumer side of the plugin's ring; returns with the ring armed for the next eventfd wakeup
+static void DrainOutputs(Helper &helper) {
+    uint64_t count;
+    (void) !read(helper.session.toHelperFd, &count, sizeof(count));
+
+    HIDServiceRing &ring = helper.session.region->toHelper;
+    HIDServiceRecord record;
+    do {
+        while (ring.pop(record)) {
+            if (record.type == HIDServiceMessage::Output) {
+                auto found = helper.devices.find(record.device);
+                if (found != helper.devices.end()) {
+                    found->second->enqueue(record.data, record.length);
+                }
+            } else if (record.type == HIDServiceMessage::Ping) {
+                record.type = HIDServiceMessage::Pong;
+                helper.session.send(record);
+            }
+        }
+    } while (!ring.prepareSleep());
+}
+
+static void AcceptPlugin(Helper &helper) {
+    int fd = accept4(helper.listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    struct ucred credentials = {};
+    socklen_t credentialsLength = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) < 0 || credentials.uid != getuid()) {
+        fprintf(stderr, "Refusing a connection from another user\n");
+        close(fd);
+        return;
+    }
+    if (helper.session.active()) {
+        fprintf(stderr, "Refusing a second plugin, pid %d\n", credentials.pid);
+        close(fd);
+        return;
+    }
+    if (!helper.session.create()) {
+        fprintf(stderr, "Could not create the shared memory: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    uint32_t hello[2] = {HIDServiceMagic, HIDServiceVersion};
+    int descriptors[3] = {helper.session.regionFd, helper.session.toHelperFd, helper.session.toPluginFd};
+    char control[CMSG_SPACE(sizeof(descriptors))] = {};
+    iovec vector = {hello, sizeof(hello)};
+    msghdr message = {};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(descriptors));
+    memcpy(CMSG_DATA(header), descriptors, sizeof(descriptors));
+    if (sendmsg(fd, &message, MSG_NOSIGNAL) != sizeof(hello)) {
+        close(fd);
+        helper.session.destroy();
+        return;
+    }
+
+    helper.session.socketFd = fd;
+    printf("Plugin connected, pid %d\n", credentials.pid);
+    for (auto &[id, device] : helper.devices) {
+        helper.session.send(DeviceAddedRecord(*device));
+    }
+}
+
+static void DisconnectPlugin(Helper &helper) {
+    // Output still queued goes out; the nodes stay open for the next plugin
+    helper.session.destroy();
+    printf("Plugin disconnected, keeping %zu devices open\n", helper.devices.size());
+}
+
+static int RunHelper(const std::string &socketName) {
+    Helper helper;
+    helper.listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    size_t nameLength = std::min(socketName.size(), sizeof(address.sun_path) - 1);
+    memcpy(address.sun_path + 1, socketName.data(), nameLength);
+    socklen_t addressLength = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + nameLength);
+    if (helper.listenFd < 0 || bind(helper.listenFd, reinterpret_cast<sockaddr *>(&address), addressLength) < 0 || listen(helper.listenFd, 2) < 0) {
+        fprintf(stderr, "Could not listen on @%s: %s\n", socketName.c_str(), strerror(errno));
+        return 1;
+    }
+    printf("Listening on @%s\n", socketName.c_str());
+
+    auto lastScan = std::chrono::steady_clock::time_point();
+    std::vector<pollfd> descriptors;
+    std::vector<uint16_t> polledDevices;
+    while (running) {
+        // udev is not needed for a handful of nodes; a new panel shows up within a second
+        if (std::chrono::steady_clock::now() - lastScan >= std::chrono::seconds(1)) {
+            ScanDevices(helper);
+            lastScan = std::chrono::steady_clock::now();
+        }
+
+        descriptors.clear();
+        polledDevices.clear();
+        descriptors.push_back({helper.listenFd, POLLIN, 0});
+        if (helper.session.active()) {
+            descriptors.push_back({helper.session.socketFd, POLLIN, 0});
+            descriptors.push_back({helper.session.toHelperFd, POLLIN, 0});
+        }
+        for (auto &[id, device] : helper.devices) {
+            descriptors.push_back({device->fd, POLLIN, 0});
+            polledDevices.push_back(id);
+        }
+
+        if (poll(descriptors.data(), descriptors.size(), 1000) <= 0) {
+            continue;
+        }
+
+        size_t index = 0;
+        if (descriptors[index++].revents & POLLIN) {
+            AcceptPlugin(helper);
+        }
+        if (descriptors.size() > index + polledDevices.size()) {
+            short socketEvents = descriptors[index++].revents;
+            short ringEvents = descriptors[index++].revents;
+            char byte;
+            if ((socketEvents & (POLLHUP | POLLERR)) || ((socketEvents & POLLIN) && recv(helper.session.socketFd, &byte, sizeof(byte), MSG_DONTWAIT) <= 0)) {
+                DisconnectPlugin(helper);
+            } else if (ringEvents & POLLIN) {
+                DrainOutputs(helper);
+            }
+        }
+        for (uint16_t id : polledDevices) {
+            short events = descriptors[index++].revents;
+            auto found = helper.devices.find(id);
+            if (events && found != helper.devices.end() && ((events & (POLLHUP | POLLERR)) || !ReadDevice(helper, *found->second))) {
+                RemoveDevice(helper, id);
+            }
+        }
+    }
+
+    std::vector<uint16_t> ids;
+    for (auto &[id, device] : helper.devices) {
+        ids.push_back(id);
+    }
+    for (uint16_t id : ids) {
+        RemoveDevice(helper, id);
+    }
+    helper.session.destroy();
+    close(helper.listenFd);
+    return 0;
+}
+
+// Forks a helper that answers pings and measures the round trip from this side, eventfd
+// wakeups included, as for the sparse traffic of a panel
+static int RunLoopback(int roundTrips) {
+    Session session;
+    if (!session.create()) {
+        fprintf(stderr, "Could not create the shared memory: %s\n", strerror(errno));
+        return 1;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        HIDServiceRing &ring = session.region->toHelper;
+        HIDServiceRecord record;
+        while (getppid() != 1) {
+            pollfd descriptor = {session.toHelperFd, POLLIN, 0};
+            if (poll(&descriptor, 1, 1000) <= 0) {
+                continue;
+            }
+
+            uint64_t count;
+            (void) !read(session.toHelperFd, &count, sizeof(count));
+            do {
+                while (ring.pop(record)) {
+                    record.type = HIDServiceMessage::Pong;
+                    session.send(record);
+                }
+            } while (!ring.prepareSleep());
+        }
+        _exit(0);
+    }
+
+    HIDServiceRing &toHelper = session.region->toHelper;
+    HIDServiceRing &toPlugin = session.region->toPlugin;
+    std::vector<double> microseconds;
+    microseconds.reserve(roundTrips);
+    for (int i = 0; i < roundTrips; i++) {
+        HIDServiceRecord ping = HIDServiceMakeRecord(HIDServiceMessage::Ping, 0, nullptr, 0);
+        ping.timestamp = TimestampNow();
+        toHelper.push(ping);
+        if (toHelper.takeWakeup()) {
+            uint64_t one = 1;
+            (void) !write(session.toHelperFd, &one, sizeof(one));
+        }
+
+        HIDServiceRecord pong;
+        bool answered = false;
+        while (!answered) {
+            while (!answered && toPlugin.pop(pong)) {
+                answered = pong.type == HIDServiceMessage::Pong && pong.timestamp == ping.timestamp;
+            }
+            if (!answered && toPlugin.prepareSleep()) {
+                pollfd descriptor = {session.toPluginFd, POLLIN, 0};
+                poll(&descriptor, 1, 1000);
+                uint64_t count;
+                (void) !read(session.toPluginFd, &count, sizeof(count));
+            }
+        }
+        microseconds.push_back((TimestampNow() - ping.timestamp) / 1000.0);
+    }
+
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+    session.destroy();
+
+    std::sort(microseconds.begin(), microseconds.end());
+    auto percentile = [&](double fraction) {
+        return microseconds[std::min(microseconds.size() - 1, static_cast<size_t>(fraction * microseconds.size()))];
+    };
+    printf("%d round trips between two processes: min %.1f us, median %.1f us, p99 %.1f us, max %.1f us\n", roundTrips, microseconds.front(), percentile(0.5), percentile(0.99), microseconds.back());
+    return 0;
+}
+
+static void Stop(int) {
+    running = 0;
+}
+
+int main(int argc, char **argv) {
+    std::string socketName = HIDServiceSocketName + std::to_string(getuid());
+    int loopback = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+            socketName = argv[++i];
+        } else if (!strcmp(argv[i], "--loopback")) {
+            loopback = i + 1 < argc && argv[i + 1][0] != '-' ? std::max(1, atoi(argv[++i])) : 10000;
+        } else {
+            fprintf(stderr, "Usage: %s [--socket <name>] | --loopback [<round trips>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    if (loopback) {
+        return RunLoopback(loopback);
+    }
+
+    signal(SIGINT, Stop);
+    signal(SIGTERM, Stop);
+    signal(SIGPIPE, SIG_IGN);
+    return RunHelper(socketName);
+}
@@ -0,0 +1,922 @@
+// winwing-hid-replay: feeds the input reports of a HID capture (see hidcapture.h) back into the
+// product classes and checks that their output keeps the captured volume and timing: report
+// count per report ID and length, and the peak reports per second, per device.
+//
+// The products run against the XPLM mock, so only their own logic is exercised: dataref values
+// are not part of a capture. Outputs that depend on the sim or on wall-clock rate limits only
+// match a baseline made under the same conditions, which --write produces: the replayed inputs
+// and the outputs they caused, on the capture's timeline. Reports are not
+// compared byte for byte, since rate-limited redraws and sequence counters vary between runs.
+//
+//   winwing-hid-replay <capture> [--speed <factor>] [--frame-ms <ms>] [--tolerance <percent>]
+//                      [--write <capture>]
+//   winwing-hid-replay --bench-fmc-pages <pages>
+//   winwing-hid-replay --bench-teardown
+//   winwing-hid-replay --bench-alloc <rounds>
+//   winwing-hid-replay --check-input-edges <reports>
+//   winwing-hid-replay --bench-input <seconds>
+//   winwing-hid-replay --stress-connect <cycles>
+//   winwing-hid-replay --bench-enumerate <nodes>
+//
+// --speed 1 replays in real time, larger factors accelerate, 0 (the default) runs unthrottled.
+// Differences up to --tolerance (default 10) percent pass.
+//
+// --bench-fmc-pages sends full MCDU pages, first one system call per report and then batched,
+// and prints the write calls and the CPU time each page cost. --bench-teardown fills the output
+// queues of an MCDU, an FCU and a PAP3, with the device end draining and stalled, and prints
+// how long disconnect() held up the caller. --bench-alloc counts the heap calls of all threads
+// while an MCDU redraws pages and an FCU toggles its LEDs and redraws its display, and fails if
+// there are any once the first rounds set everything up. --check-input-edges feeds a scripted
+// report stream through InputCoalescer with and without ReportFilter in front and fails unless
+// both see the same button edges and encoder steps. --bench-input has a fake FCU send 1000
+// input reports per second and prints how often the reader thread woke up and how long the
+// reports took to reach the main thread. --stress-connect connects and tears down fake devices
+// while they send input and take output, and fails if a teardown took longer than 20 ms; build
+// with -fsanitize=thread to have the races checked as well. --bench-enumerate adds that many
+// foreign uhid devices next to a Winwing one and times device enumeration against opening every
+// node, as enumeration did before it read sysfs; it needs write access to /dev/uhid.
+
+#include "appstate.h"
+#include "fakehid.h"
+#include "frame-arena.h"
+#include "hidcapture.h"
+#include "hidreactor.h"
+#include "inputcoalescer.h"
+#include "product-fcu-efis.h"
+#include "product-fmc.h"
+#include "reportfilter.h"
+#include "usbcontroller.h"
+#include "usbdevice.h"
+
+#include <XPLMDataAccess.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <glob.h>
+#include <linux/hidraw.h>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// xplane-sdk-mock.cpp, makes a dataref exist so an aircraft profile is picked
+XPLMDataRef createMockDataRef(const char *name, XPLMDataTypeID type);
+
+// --bench-alloc: heap calls of every thread, counted while enabled
+static std::atomic<bool> countingAllocations{false};
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(size_t size) {
+    if (countingAllocations.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void *memory = malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+// Output volume of one side (captured or replayed), by report kind and per second of capture time
+struct OutputTally {
+        uint64_t reports = 0;
+        uint64_t bytes = 0;
+        std::map<uint32_t, uint64_t> kinds; // Report ID << 16 | length
+        std::map<uint64_t, uint64_t> perSecond;
+
+        void add(uint64_t timestamp, const uint8_t *report, size_t length) {
+            reports++;
+            bytes += length;
+            kinds[(report[0] << 16) | static_cast<uint32_t>(length)]++;
+            perSecond[timestamp / 1000000000]++;
+        }
+
+        uint64_t peakPerSecond() const {
+            uint64_t peak = 0;
+            for (auto &[second, count] : perSecond) {
+                peak = std::max(peak, count);
+            }
+            return peak;
+        }
+};
+
+struct ReplayDevice {
+        USBDevice *device = nullptr;
+        int peerFd = -1;
+        uint64_t inputs = 0;
+        OutputTally expected;
+        OutputTally produced;
+};
+
+static bool WithinTolerance(uint64_t expected, uint64_t produced, double tolerance) {
+    uint64_t difference = expected > produced ? expected - produced : produced - expected;
+    return difference <= std::max<uint64_t>(2, static_cast<uint64_t>(expected * tolerance));
+}
+
+// Prints the comparison and returns whether the replay stayed within tolerance
+static bool CompareOutputs(uint32_t key, ReplayDevice &replay, double tolerance) {
+    const OutputTally &expected = replay.expected;
+    const OutputTally &produced = replay.produced;
+    printf("%04X:%04X %s: %llu inputs, %llu/%llu output reports and %llu/%llu bytes produced/expected, peak %llu/%llu reports/s\n",
+           key >> 16,
+           key & 0xFFFF,
+           replay.device->classIdentifier(),
+           (unsigned long long) replay.inputs,
+           (unsigned long long) produced.reports,
+           (unsigned long long) expected.reports,
+           (unsigned long long) produced.bytes,
+           (unsigned long long) expected.bytes,
+           (unsigned long long) produced.peakPerSecond(),
+           (unsigned long long) expected.peakPerSecond());
+
+    bool matches = WithinTolerance(expected.peakPerSecond(), produced.peakPerSecond(), tolerance);
+    std::map<uint32_t, std::pair<uint64_t, uint64_t>> kinds;
+    for (auto &[kind, count] : expected.kinds) {
+        kinds[kind].first = count;
+    }
+    for (auto &[kind, count] : produced.kinds) {
+        kinds[kind].second = count;
+    }
+
+    for (auto &[kind, counts] : kinds) {
+        if (!WithinTolerance(counts.first, counts.second, tolerance)) {
+            printf("    report 0x%02X, %u bytes: %llu produced, %llu expected\n", kind >> 16, kind & 0xFFFF, (unsigned long long) counts.second, (unsigned long long) counts.first);
+            matches = false;
+        }
+    }
+    return matches;
+}
+
+static bool DrainOutputs(std::map<uint32_t, ReplayDevice> &devices, uint64_t timestamp, HIDCaptureWriter &baseline) {
+    bool received = false;
+    uint8_t buffer[1024];
+    for (auto &[key, replay] : devices) {
+        ssize_t length;
+        while (replay.peerFd >= 0 && (length = recv(replay.peerFd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            replay.produced.add(timestamp, buffer, length);
+            baseline.write(timestamp, HIDCaptureDirection::Output, key >> 16, key & 0xFFFF, std::span<const uint8_t>(buffer, length));
+            received = true;
+        }
+    }
+    return received;
+}
+
+// Waits for every writer thread to hand over what the frame queued, as they easily do between
+// real frames; otherwise an unthrottled replay would coalesce most display frames away
+static void WaitForOutputs(std::map<uint32_t, ReplayDevice> &devices, uint64_t timestamp, HIDCaptureWriter &baseline) {
+    auto waitingSince = std::chrono::steady_clock::now();
+    for (auto &[key, replay] : devices) {
+        while (replay.device && replay.device->hasPendingOutput() && std::chrono::steady_clock::now() - waitingSince < std::chrono::seconds(1)) {
+            DrainOutputs(devices, timestamp, baseline);
+            std::this_thread::yield();
+        }
+    }
+    DrainOutputs(devices, timestamp, baseline);
+}
+
+static ReplayDevice &DeviceFor(std::map<uint32_t, ReplayDevice> &devices, uint16_t vendorId, uint16_t productId) {
+    uint32_t key = (vendorId << 16) | productId;
+    auto found = devices.find(key);
+    if (found != devices.end()) {
+        return found->second;
+    }
+
+    ReplayDevice &replay = devices[key];
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+        return replay;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "Replay %04X:%04X", vendorId, productId);
+    replay.device = USBDevice::Device(fds[0], vendorId, productId, "Winwing", name);
+    if (!replay.device) {
+        printf("%04X:%04X: no product class, its reports are skipped\n", vendorId, productId);
+        close(fds[0]);
+        close(fds[1]);
+        return replay;
+    }
+
+    replay.peerFd = fds[1];
+    USBController::getInstance()->devices.push_back(replay.device);
+    return replay;
+}
+
+// Reads and discards what a device end writes until draining turns false
+static std::thread DrainPeer(int fd, std::atomic<bool> &draining) {
+    return std::thread([fd, &draining]() {
+        uint8_t buffer[1024];
+        while (draining) {
+            if (recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) <= 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    });
+}
+
+// Disconnects run on the main thread, whatever is still queued must not hold it up
+static int BenchTeardown() {
+    AppState::getInstance()->initialize();
+
+    for (bool stalled : {false, true}) {
+        for (uint16_t productId : {0xBB36, 0xBA01, 0xBF0F}) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+                return 2;
+            }
+            if (stalled) {
+                // Fills after a few reports, then every write meets EAGAIN
+                int small = 4096;
+                setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &small, sizeof(small));
+            }
+
+            std::atomic<bool> draining{!stalled};
+            std::thread peer = DrainPeer(fds[1], draining);
+
+            USBDevice *device = USBDevice::Device(fds[0], 0x4098, productId, "Winwing", "Teardown");
+            if (!device) {
+                draining = false;
+                peer.join();
+                close(fds[1]);
+                continue;
+            }
+
+            // LED changes for 100 targets and 20 display frames, more than the budgets let out
+            // before the teardown
+            for (uint8_t led = 0; led < 100; ++led) {
+                device->queueOutput(OutputLane::Indicators, 0xBE4C0100 + led, {0x02, 0x10, 0xBB, 0x00, 0x00, 0x03, 0x49, led, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00});
+            }
+            std::vector<OutputReportBuffer> frame(16);
+            for (uint8_t i = 0; i < 20; ++i) {
+                for (auto &report : frame) {
+                    report.fill(i);
+                    report[0] = 0xf2;
+                }
+                device->queueOutput(OutputLane::Display, 0, std::span<const OutputReportBuffer>(frame));
+            }
+
+            const OutputQueueStats &stats = device->outputStats();
+            uint64_t written = stats.reportsWritten.load();
+            uint64_t dropped = stats.messagesDropped.load();
+            auto startedAt = std::chrono::steady_clock::now();
+            device->disconnect();
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startedAt).count();
+            printf("%04X %-8s disconnect took %.1f ms: %llu reports written, %llu messages dropped\n", productId, stalled ? "stalled" : "draining", milliseconds, (unsigned long long) (stats.reportsWritten.load() - written), (unsigned long long) (stats.messagesDropped.load() - dropped));
+            delete device;
+
+            draining = false;
+            peer.join();
+            close(fds[1]);
+        }
+    }
+
+    AppState::getInstance()->deinitialize();
+    return 0;
+}
+
+static double ProcessCPUMicroseconds() {
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+// Sends pages to an MCDU on a socket pair, spaced like redraws so the budget never splits one
+static int BenchFMCPages(int pages) {
+    static const uint32_t BenchTarget = 0xBE4C0000;
+    static const size_t PageReports = 16; // 14 lines of 24 characters, 3 stream bytes each
+
+    AppState::getInstance()->initialize();
+    std::map<uint32_t, ReplayDevice> devices;
+    ReplayDevice &replay = DeviceFor(devices, 0x4098, 0xBB36);
+    if (!replay.device) {
+        fprintf(stderr, "Could not create the MCDU\n");
+        return 2;
+    }
+
+    // Two pages, alternated so the output shadow never drops one as unchanged
+    std::vector<OutputReportBuffer> variants[2];
+    for (int variant = 0; variant < 2; ++variant) {
+        variants[variant].resize(PageReports);
+        for (size_t i = 0; i < PageReports; ++i) {
+            OutputReportBuffer &report = variants[variant][i];
+            report[0] = 0xf2;
+            for (size_t j = 1; j < report.size(); ++j) {
+                report[j] = static_cast<uint8_t>('A' + (i + j + variant) % 26);
+            }
+        }
+    }
+
+    HIDCaptureWriter none;
+    WaitForOutputs(devices, 0, none);
+    for (bool batched : {false, true}) {
+        replay.device->setBatchedOutput(batched);
+        uint64_t callsBefore = replay.device->stats.writeCalls.load();
+        uint64_t reportsBefore = replay.device->outputStats().reportsWritten.load();
+        double cpuBefore = ProcessCPUMicroseconds();
+
+        for (int page = 0; page < pages; ++page) {
+            replay.device->queueOutput(OutputLane::Display, BenchTarget, std::span<const OutputReportBuffer>(variants[page % 2]));
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            WaitForOutputs(devices, 0, none);
+        }
+
+        uint64_t calls = replay.device->stats.writeCalls.load() - callsBefore;
+        uint64_t reports = replay.device->outputStats().reportsWritten.load() - reportsBefore;
+        double cpu = ProcessCPUMicroseconds() - cpuBefore;
+        printf("%-9s %d pages, %llu reports: %.1f write calls and %.0f us CPU per page\n", batched ? "batched" : "unbatched", pages, (unsigned long long) reports, (double) calls / pages, cpu / pages);
+    }
+
+    close(replay.peerFd);
+    AppState::getInstance()->deinitialize();
+    return 0;
+}
+
+// Redraws and LED changes must not touch the heap once a device is set up, on any thread. The
+// first rounds are not counted: they allocate the shadow entries and the line buffers.
+static int BenchAllocations(int rounds) {
+    static const int WarmupRounds = 2;
+    static const FCUEfisLed Leds[] = {
+        FCUEfisLed::LOC_GREEN, FCUEfisLed::AP1_GREEN, FCUEfisLed::AP2_GREEN, FCUEfisLed::ATHR_GREEN, FCUEfisLed::EXPED_GREEN, FCUEfisLed::APPR_GREEN,
+        FCUEfisLed::EFISR_FD_GREEN, FCUEfisLed::EFISR_LS_GREEN, FCUEfisLed::EFISR_CSTR_GREEN, FCUEfisLed::EFISR_WPT_GREEN, FCUEfisLed::EFISR_VORD_GREEN, FCUEfisLed::EFISR_NDB_GREEN, FCUEfisLed::EFISR_ARPT_GREEN,
+        FCUEfisLed::EFISL_FD_GREEN, FCUEfisLed::EFISL_LS_GREEN, FCUEfisLed::EFISL_CSTR_GREEN, FCUEfisLed::EFISL_WPT_GREEN, FCUEfisLed::EFISL_VORD_GREEN, FCUEfisLed::EFISL_NDB_GREEN, FCUEfisLed::EFISL_ARPT_GREEN};
+
+    AppState::getInstance()->initialize();
+    // The Laminar A330 profile, so pages go through its colour map and character table
+    createMockDataRef("laminar/A333/ckpt_temp", xplmType_Float);
+    int fmcFds[2];
+    int fcuFds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fmcFds) < 0 || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fcuFds) < 0) {
+        return 2;
+    }
+    std::atomic<bool> draining{true};
+    std::thread fmcPeer = DrainPeer(fmcFds[1], draining);
+    std::thread fcuPeer = DrainPeer(fcuFds[1], draining);
+
+    auto *fmc = static_cast<ProductFMC *>(USBDevice::Device(fmcFds[0], WINWING_VENDOR_ID, 0xBB36, "Winwing", "Alloc MCDU"));
+    auto *fcu = static_cast<ProductFCUEfis *>(USBDevice::Device(fcuFds[0], WINWING_VENDOR_ID, 0xBA01, "Winwing", "Alloc FCU"));
+    fmc->update();
+
+    // Two pages, alternated so the I/O pass never skips one as unchanged
+    std::vector<std::vector<char>> pages[2];
+    for (int variant = 0; variant < 2; ++variant) {
+        ProductFMC::ClearPage(pages[variant]);
+        for (int line = 0; line < static_cast<int>(ProductFMC::PageLines); ++line) {
+            fmc->writeLineToPage(pages[variant], line, variant, "ALLOC BENCH PAGE", variant ? 'g' : 'w', line % 2);
+        }
+    }
+
+    auto waitForOutput = [](USBDevice *device) {
+        auto waitingSince = std::chrono::steady_clock::now();
+        while (device->hasPendingOutput() && std::chrono::steady_clock::now() - waitingSince < std::chrono::seconds(1)) {
+            std::this_thread::yield();
+        }
+    };
+
+    // Spaced further apart than the MCDU's redraw limit, so each page goes out
+    uint64_t reportsBefore = 0;
+    uint64_t redrawAllocations = 0;
+    for (int round = 0; round < WarmupRounds + rounds; ++round) {
+        if (round == WarmupRounds) {
+            reportsBefore = fmc->outputStats().reportsWritten.load();
+            allocations = 0;
+            countingAllocations = true;
+        }
+        fmc->draw(&pages[round % 2]);
+        std::this_thread::sleep_for(std::chrono::milliseconds(45));
+        waitForOutput(fmc);
+    }
+    countingAllocations = false;
+    redrawAllocations = allocations.load();
+    printf("MCDU redraw: %d pages, %llu reports, %llu heap calls (%.2f per redraw)\n", rounds, (unsigned long long) (fmc->outputStats().reportsWritten.load() - reportsBefore), (unsigned long long) redrawAllocations, (double) redrawAllocations / rounds);
+
+    uint64_t ledAllocations = 0;
+    for (int round = 0; round < WarmupRounds + rounds; ++round) {
+        if (round == WarmupRounds) {
+            reportsBefore = fcu->outputStats().reportsWritten.load();
+            allocations = 0;
+            countingAllocations = true;
+        }
+        for (FCUEfisLed led : Leds) {
+            fcu->setLedBrightness(led, round % 2);
+        }
+        waitForOutput(fcu);
+    }
+    countingAllocations = false;
+    ledAllocations = allocations.load();
+    size_t changes = static_cast<size_t>(rounds) * std::size(Leds);
+    printf("FCU LED storm: %zu changes, %llu reports, %llu heap calls (%.3f per change)\n", changes, (unsigned long long) (fcu->outputStats().reportsWritten.load() - reportsBefore), (unsigned long long) ledAllocations, (double) ledAllocations / changes);
+
+    // The segment encoding uses the frame arena, reset once per frame like AppState::update does
+    static const char *Speeds[] = {"250", "251"};
+    uint64_t displayAllocations = 0;
+    for (int round = 0; round < WarmupRounds + rounds; ++round) {
+        if (round == WarmupRounds) {
+            reportsBefore = fcu->outputStats().reportsWritten.load();
+            allocations = 0;
+            countingAllocations = true;
+        }
+        FrameArena::forCurrentThread()->reset();
+        fcu->sendFCUDisplay(Speeds[round % 2], "090", "12000", "-0800");
+        waitForOutput(fcu);
+    }
+    countingAllocations = false;
+    displayAllocations = allocations.load();
+    printf("FCU redraw: %d frames, %llu reports, %llu heap calls (%.2f per redraw), %llu arena fallbacks\n", rounds, (unsigned long long) (fcu->outputStats().reportsWritten.load() - reportsBefore), (unsigned long long) displayAllocations, (double) displayAllocations / rounds, (unsigned long long) FrameArena::forCurrentThread()->heapFallbackCount());
+
+    delete fmc;
+    delete fcu;
+    draining = false;
+    fmcPeer.join();
+    fcuPeer.join();
+    close(fmcFds[1]);
+    close(fcuFds[1]);
+    AppState::getInstance()->deinitialize();
+    return redrawAllocations == 0 && ledAllocations == 0 && displayAllocations == 0 ? 0 : 1;
+}
+
+// Button edges, the baseline flag and encoder steps of the frame, tagged with its number
+static void CollectInputFrame(InputCoalescer &coalescer, uint64_t frame, std::vector<uint64_t> &events) {
+    if (!coalescer.hasFrame()) {
+        return;
+    }
+
+    const InputFrame &input = coalescer.frame();
+    if (input.initial) {
+        events.push_back(frame << 32 | 0x40000000);
+    }
+    for (const InputButtonEdge &edge : input.buttonEdges) {
+        events.push_back(frame << 32 | edge.index << 1 | edge.pressed);
+    }
+    for (size_t i = 0; i < input.encoderDeltas.size(); ++i) {
+        if (input.encoderDeltas[i] != 0) {
+            events.push_back(frame << 32 | 0x80000000 | i << 16 | static_cast<uint16_t>(input.encoderDeltas[i]));
+        }
+    }
+    coalescer.clearFrame();
+}
+
+// The reader drops reports identical to the last one, which must never lose an edge: mostly
+// repeated reports with button flips (some within one frame), axis and encoder changes,
+// reports with another ID and reconnects, the same script every run.
+static int CheckInputEdges(int reports) {
+    struct ScriptedDevice {
+            const char *name;
+            InputLayout layout;
+            int length;
+    };
+    // As set up by ProductFMC / ProductFCUEfis and PAP3Device::setupInputLayout
+    const ScriptedDevice devices[] = {
+        {"MCDU/FCU", {.reportId = 1, .minimumLength = 13, .buttonOffset = 1, .buttonBytes = 12}, 25},
+        {"PAP3", {.reportId = 1, .minimumLength = 0x20, .buttonOffset = 1, .buttonBytes = 6, .firstReportPressesButtons = false, .encoderOffsets = {0x15, 0x17, 0x19, 0x1B, 0x1D, 0x1F}}, 0x20},
+    };
+
+    bool identical = true;
+    for (const ScriptedDevice &device : devices) {
+        std::mt19937 random(1);
+        ReportFilter filter;
+        InputCoalescer direct;
+        InputCoalescer filtered;
+        direct.configure(device.layout);
+        filtered.configure(device.layout);
+
+        std::vector<uint64_t> directEvents;
+        std::vector<uint64_t> filteredEvents;
+        uint64_t frame = 0;
+        uint64_t delivered = 0;
+        int frameEndsAt = 1 + random() % 30;
+
+        InputReport report = {};
+        report.length = device.length;
+        report.data[0] = device.layout.reportId;
+        InputReport other = {};
+        other.length = 8;
+        other.data[0] = device.layout.reportId + 1;
+
+        int firstAxis = device.layout.buttonOffset + device.layout.buttonBytes;
+        for (int sent = 0; sent < reports; ++sent) {
+            int roll = random() % 100;
+            const InputReport *next = &report;
+            if (roll < 5) {
+                report.data[device.layout.buttonOffset + random() % device.layout.buttonBytes] ^= 1 << (random() % 8);
+            } else if (roll < 10) {
+                int offset = firstAxis + random() % (device.length - firstAxis);
+                if (std::find(device.layout.encoderOffsets.begin(), device.layout.encoderOffsets.end(), offset) == device.layout.encoderOffsets.end()) {
+                    report.data[offset] = static_cast<uint8_t>(random());
+                }
+            } else if (roll < 13 && !device.layout.encoderOffsets.empty()) {
+                report.data[device.layout.encoderOffsets[random() % device.layout.encoderOffsets.size()]] += static_cast<int>(random() % 7) - 3;
+            } else if (roll < 15) {
+                other.data[1] = static_cast<uint8_t>(random());
+                next = &other;
+            }
+
+            direct.add(*next);
+            if (filter.accept(next->data, next->length)) {
+                filtered.add(*next);
+                delivered++;
+            }
+
+            if (sent == frameEndsAt) {
+                CollectInputFrame(direct, frame, directEvents);
+                CollectInputFrame(filtered, frame, filteredEvents);
+                frame++;
+                frameEndsAt = sent + 1 + random() % 30;
+            }
+            if (sent % 5000 == 4999) {
+                // A reconnect, see USBDevice::connect
+                CollectInputFrame(direct, frame, directEvents);
+                CollectInputFrame(filtered, frame, filteredEvents);
+                frame++;
+                direct.reset();
+                filtered.reset();
+                filter.resync();
+            }
+        }
+        CollectInputFrame(direct, frame, directEvents);
+        CollectInputFrame(filtered, frame, filteredEvents);
+
+        if (directEvents == filteredEvents && !directEvents.empty()) {
+            printf("%s: %d reports, %llu through the filter, %zu edges and encoder steps in %llu frames, identical\n", device.name, reports, (unsigned long long) delivered, directEvents.size(), (unsigned long long) frame + 1);
+            continue;
+        }
+
+        auto mismatch = std::mismatch(directEvents.begin(), directEvents.end(), filteredEvents.begin(), filteredEvents.end());
+        size_t at = mismatch.first - directEvents.begin();
+        printf("%s: %zu events unfiltered, %zu filtered, first difference at event %zu (frame %llu)\n", device.name, directEvents.size(), filteredEvents.size(), at, (unsigned long long) ((mismatch.first != directEvents.end() ? *mismatch.first : *mismatch.second) >> 32));
+        identical = false;
+    }
+    return identical ? 0 : 1;
+}
+
+// Takes the send time the fake device wrote into the end of every input report
+class LatencyProbe : public USBDevice {
+    public:
+        std::vector<int64_t> latencies;
+
+        LatencyProbe(int fd) :
+            USBDevice(fd, WINWING_VENDOR_ID, 0xBA01, "Winwing", "Latency probe") {
+            setInputLayout({.reportId = 1, .minimumLength = 13, .buttonOffset = 1, .buttonBytes = 12});
+        }
+
+        void didReceiveData(const InputFrame &frame) override {
+            int64_t sentAt;
+            if (!frame.report || frame.reportLength < (int) sizeof(sentAt) || latencies.size() == latencies.capacity()) {
+                return;
+            }
+            memcpy(&sentAt, frame.report + frame.reportLength - sizeof(sentAt), sizeof(sentAt));
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            latencies.push_back(now - sentAt);
+        }
+};
+
+// The reader thread should only wake up for reports, and hand them over within a main thread
+// poll, here every 100 us instead of once per sim frame
+static int BenchInput(int seconds) {
+    static const double ReportsPerSecond = 1000;
+
+    AppState::getInstance()->initialize();
+    FakeHIDDevice fake(*FakeHIDDevice::Model("fcu-efis"), FakeHIDDevice::Transport::Socketpair);
+    fake.setTimestampedInputs(true);
+    if (!fake.start()) {
+        return 2;
+    }
+    LatencyProbe probe(fake.openDeviceFd());
+    if (!probe.connect()) {
+        fprintf(stderr, "Could not connect the probe\n");
+        return 2;
+    }
+    probe.latencies.reserve(static_cast<size_t>(seconds * ReportsPerSecond * 2));
+    fake.setInputRate(ReportsPerSecond);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    probe.update();
+    probe.latencies.clear();
+
+    HIDReactor *reactor = HIDReactor::getInstance();
+    uint64_t wakeups = reactor->wakeupCount();
+    uint64_t dispatches = reactor->dispatchCount();
+    uint64_t received = probe.stats.reportsReceived.load();
+    auto startedAt = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - startedAt < std::chrono::seconds(seconds)) {
+        probe.update();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count();
+    wakeups = reactor->wakeupCount() - wakeups;
+    dispatches = reactor->dispatchCount() - dispatches;
+    received = probe.stats.reportsReceived.load() - received;
+
+    probe.disconnect();
+    fake.stop();
+
+    std::vector<int64_t> &latencies = probe.latencies;
+    if (latencies.empty()) {
+        fprintf(stderr, "No input reports arrived\n");
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double fraction) {
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()))] / 1000.0;
+    };
+    printf("%.0f reports/s in: %.0f reader wakeups/s, %.0f dispatches/s, %.2f wakeups per report\n", received / elapsed, wakeups / elapsed, dispatches / elapsed, received ? (double) wakeups / received : 0.0);
+    printf("Send to main thread: p50 %.0f us, p99 %.0f us, max %.0f us over %zu frames\n", percentile(0.5), percentile(0.99), latencies.back() / 1000.0, latencies.size());
+
+    AppState::getInstance()->deinitialize();
+    return 0;
+}
+
+// Teardown is bounded by the reader and writer threads exiting, not by sleeps, and must not race
+// them: every cycle opens each fake product, lets input and output run for a moment and deletes
+// it again, the way a hot-unplug or plugin reload does
+static int StressConnect(int cycles) {
+    static const double MaxTeardownMilliseconds = 20;
+    static const char *Models[] = {"fmc", "fcu-efis", "pap3", "ursa-minor"};
+
+    AppState::getInstance()->initialize();
+    std::vector<std::unique_ptr<FakeHIDDevice>> fakes;
+    for (const char *key : Models) {
+        fakes.push_back(std::make_unique<FakeHIDDevice>(*FakeHIDDevice::Model(key), FakeHIDDevice::Transport::Socketpair));
+        if (!fakes.back()->start()) {
+            return 2;
+        }
+        fakes.back()->setInputRate(1000);
+    }
+
+    std::mt19937 random(1);
+    double slowest = 0;
+    uint16_t slowestProductId = 0;
+    double total = 0;
+    int teardowns = 0;
+    for (int cycle = 0; cycle < cycles; ++cycle) {
+        std::vector<USBDevice *> devices;
+        for (auto &fake : fakes) {
+            const FakeHIDModel &model = fake->getModel();
+            USBDevice *device = USBDevice::Device(fake->openDeviceFd(), WINWING_VENDOR_ID, model.productId, "Winwing", model.productName);
+            if (device) {
+                devices.push_back(device);
+            }
+        }
+
+        // Main thread updates against the reader, output against the writer
+        auto runUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(random() % 10);
+        uint8_t value = 0;
+        do {
+            for (USBDevice *device : devices) {
+                device->update();
+                device->queueOutput(OutputLane::Indicators, 0xBE4C0001, {0x02, 0x10, 0xBB, 0x00, 0x00, 0x03, 0x49, 0x03, value, 0x00, 0x00, 0x00, 0x00, 0x00});
+            }
+            value++;
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        } while (std::chrono::steady_clock::now() < runUntil);
+
+        for (USBDevice *device : devices) {
+            uint16_t productId = device->productId;
+            auto startedAt = std::chrono::steady_clock::now();
+            delete device;
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startedAt).count();
+            if (milliseconds > slowest) {
+                slowest = milliseconds;
+                slowestProductId = productId;
+            }
+            total += milliseconds;
+            teardowns++;
+        }
+    }
+
+    for (auto &fake : fakes) {
+        fake->stop();
+    }
+    printf("%d cycles, %d teardowns: %.2f ms on average, slowest %.1f ms (%04X)\n", cycles, teardowns, teardowns ? total / teardowns : 0.0, slowest, slowestProductId);
+
+    AppState::getInstance()->deinitialize();
+    return slowest <= MaxTeardownMilliseconds ? 0 : 1;
+}
+
+static std::vector<std::string> HIDRawNodes() {
+    std::vector<std::string> nodes;
+    glob_t found;
+    if (glob("/dev/hidraw*", 0, nullptr, &found) == 0) {
+        nodes.assign(found.gl_pathv, found.gl_pathv + found.gl_pathc);
+    }
+    globfree(&found);
+    return nodes;
+}
+
+// Enumeration runs on the main thread; with dozens of other HID devices attached it should only
+// read sysfs and open the Winwing nodes alone
+static int BenchEnumerate(int foreignNodes) {
+    static const uint16_t ForeignVendorId = 0x046D;
+    static const int Rounds = 20;
+
+    AppState::getInstance()->initialize();
+    size_t nodesBefore = HIDRawNodes().size();
+    std::vector<std::unique_ptr<FakeHIDDevice>> fakes;
+    for (int i = 0; i <= foreignNodes; ++i) {
+        auto fake = std::make_unique<FakeHIDDevice>(*FakeHIDDevice::Model("fcu-efis"), FakeHIDDevice::Transport::UHID);
+        if (i < foreignNodes) {
+            fake->setVendorId(ForeignVendorId);
+        }
+        if (!fake->start()) {
+            fprintf(stderr, "Could not create uhid devices, this needs write access to /dev/uhid\n");
+            AppState::getInstance()->deinitialize();
+            return 2;
+        }
+        fakes.push_back(std::move(fake));
+    }
+
+    // udev creates the nodes asynchronously
+    auto waitingSince = std::chrono::steady_clock::now();
+    while (HIDRawNodes().size() < nodesBefore + fakes.size() && std::chrono::steady_clock::now() - waitingSince < std::chrono::seconds(5)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    size_t nodes = HIDRawNodes().size();
+
+    // The first round queues the Winwing device's bring-up, later ones find it known. The
+    // enumeration runs as a task of the next update, which is timed without one as well.
+    std::vector<double> updates;
+    std::vector<double> enumerations;
+    std::vector<double> opens;
+    for (int round = 0; round < Rounds; ++round) {
+        auto startedAt = std::chrono::steady_clock::now();
+        AppState::Update(0.02f, 0.02f, round, nullptr);
+        updates.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startedAt).count());
+
+        startedAt = std::chrono::steady_clock::now();
+        USBController::getInstance()->connectAllDevices();
+        AppState::Update(0.02f, 0.02f, round, nullptr);
+        enumerations.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startedAt).count());
+
+        startedAt = std::chrono::steady_clock::now();
+        for (const std::string &node : HIDRawNodes()) {
+            int fd = open(node.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            struct hidraw_devinfo info;
+            char name[256];
+            ioctl(fd, HIDIOCGRAWINFO, &info);
+            ioctl(fd, HIDIOCGRAWNAME(sizeof(name)), name);
+            close(fd);
+        }
+        opens.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startedAt).count());
+    }
+    std::sort(updates.begin(), updates.end());
+    std::sort(enumerations.begin(), enumerations.end());
+    std::sort(opens.begin(), opens.end());
+    printf("%zu hidraw nodes, %d of them foreign fakes: update with enumeration %.2f ms, without %.2f ms; opening every node %.2f ms (medians of %d)\n", nodes, foreignNodes, enumerations[Rounds / 2], updates[Rounds / 2], opens[Rounds / 2], Rounds);
+
+    AppState::getInstance()->deinitialize();
+    for (auto &fake : fakes) {
+        fake->stop();
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *capturePath = nullptr;
+    const char *writePath = nullptr;
+    double speed = 0;
+    int frameMilliseconds = 20;
+    double tolerance = 0.1;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--bench-teardown")) {
+            signal(SIGPIPE, SIG_IGN);
+            return BenchTeardown();
+        } else if (!strcmp(argv[i], "--bench-enumerate") && i + 1 < argc) {
+            return BenchEnumerate(std::max(0, atoi(argv[i + 1])));
+        } else if (!strcmp(argv[i], "--stress-connect") && i + 1 < argc) {
+            signal(SIGPIPE, SIG_IGN);
+            return StressConnect(std::max(1, atoi(argv[i + 1])));
+        } else if (!strcmp(argv[i], "--bench-input") && i + 1 < argc) {
+            signal(SIGPIPE, SIG_IGN);
+            return BenchInput(std::max(1, atoi(argv[i + 1])));
+        } else if (!strcmp(argv[i], "--check-input-edges") && i + 1 < argc) {
+            return CheckInputEdges(std::max(1, atoi(argv[i + 1])));
+        } else if (!strcmp(argv[i], "--bench-alloc") && i + 1 < argc) {
+            signal(SIGPIPE, SIG_IGN);
+            return BenchAllocations(std::max(1, atoi(argv[i + 1])));
+        } else if (!strcmp(argv[i], "--bench-fmc-pages") && i + 1 < argc) {
+            signal(SIGPIPE, SIG_IGN);
+            return BenchFMCPages(std::max(1, atoi(argv[i + 1])));
+        } else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--frame-ms") && i + 1 < argc) {
+            frameMilliseconds = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            tolerance = atof(argv[++i]) / 100.0;
+        } else if (!strcmp(argv[i], "--write") && i + 1 < argc) {
+            writePath = argv[++i];
+        } else if (argv[i][0] != '-' && !capturePath) {
+            capturePath = argv[i];
+        } else {
+            capturePath = nullptr;
+            break;
+        }
+    }
+
+    if (!capturePath) {
+        fprintf(stderr, "Usage: %s <capture> [--speed <factor>] [--frame-ms <ms>] [--tolerance <percent>] [--write <capture>]\n", argv[0]);
+        fprintf(stderr, "       %s --bench-fmc-pages <pages>\n", argv[0]);
+        fprintf(stderr, "       %s --bench-teardown\n", argv[0]);
+        fprintf(stderr, "       %s --bench-alloc <rounds>\n", argv[0]);
+        fprintf(stderr, "       %s --check-input-edges <reports>\n", argv[0]);
+        fprintf(stderr, "       %s --bench-input <seconds>\n", argv[0]);
+        fprintf(stderr, "       %s --stress-connect <cycles>\n", argv[0]);
+        fprintf(stderr, "       %s --bench-enumerate <nodes>\n", argv[0]);
+        return 2;
+    }
+
+    HIDCaptureReader reader;
+    if (!reader.open(capturePath)) {
+        fprintf(stderr, "%s is not a HID capture\n", capturePath);
+        return 2;
+    }
+
+    // A device end writing after its peer is gone must fail, not kill the tool
+    signal(SIGPIPE, SIG_IGN);
+
+    AppState::getInstance()->initialize();
+    // Keep the devices out of dormant mode
+    XPLMSetDatai(XPLMFindDataRef("sim/cockpit/electrical/avionics_on"), 1);
+
+    HIDCaptureWriter baseline;
+    if (writePath && !baseline.open(writePath)) {
+        fprintf(stderr, "Could not write %s\n", writePath);
+        return 2;
+    }
+
+    std::map<uint32_t, ReplayDevice> devices;
+    const uint64_t frameNanoseconds = static_cast<uint64_t>(frameMilliseconds) * 1000000;
+    auto startedAt = std::chrono::steady_clock::now();
+    uint64_t frameEnd = frameNanoseconds;
+    uint64_t frames = 0;
+
+    HIDCaptureRecord record;
+    bool haveRecord = reader.next(record);
+    while (haveRecord) {
+        while (haveRecord && record.timestamp < frameEnd) {
+            ReplayDevice &replay = DeviceFor(devices, record.vendorId, record.productId);
+            if (replay.device) {
+                if (record.direction == HIDCaptureDirection::Input) {
+                    replay.device->queueInputReport(record.data.data(), static_cast<int>(record.data.size()));
+                    baseline.write(record.timestamp, record.direction, record.vendorId, record.productId, record.data);
+                    replay.inputs++;
+                } else {
+                    replay.expected.add(record.timestamp, record.data.data(), record.data.size());
+                }
+            }
+            haveRecord = reader.next(record);
+        }
+
+        AppState::Update(frameMilliseconds / 1000.0f, frameMilliseconds / 1000.0f, static_cast<int>(frames), nullptr);
+        WaitForOutputs(devices, frameEnd, baseline);
+        frames++;
+
+        if (speed > 0) {
+            auto due = startedAt + std::chrono::nanoseconds(static_cast<int64_t>(frameEnd / speed));
+            std::this_thread::sleep_until(due);
+        }
+        frameEnd += frameNanoseconds;
+    }
+
+    uint64_t replayedNanoseconds = frameEnd - frameNanoseconds;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startedAt).count();
+    printf("Replayed %.1f s of traffic in %.1f s (%llu frames)\n", replayedNanoseconds / 1e9, elapsed, (unsigned long long) frames);
+
+    bool matches = true;
+    for (auto &[key, replay] : devices) {
+        if (replay.device) {
+            matches = CompareOutputs(key, replay, tolerance) && matches;
+        }
+    }
+
+    baseline.close();
+    for (auto &[key, replay] : devices) {
+        if (replay.peerFd >= 0) {
+            close(replay.peerFd);
+        }
+    }
+    AppState::getInstance()->deinitialize();
+
+    return matches ? 0 : 1;
+}